@@ -23,12 +23,17 @@ let currentMode = "AP"; // The current operating mode of the device ("AP" or "ST
 let ussdSessionActive = false; // Flag to track if a USSD session is waiting for a reply.
 let currentSmsIndex = null; // Stores the index of the SMS currently viewed in the modal.
 let notificationTimeout = null; // Timeout ID for hiding notifications automatically.
+let inboxCursor = 0; // Id the next inbox page starts below (0 = newest), or null when all pages are loaded.
+let inboxLoading = false; // Flag to avoid overlapping inbox page requests.
 
 // --- Constants ---
 const MAX_SMS_CHARS_SINGLE_GSM7 = 160;
 const MAX_SMS_CHARS_MULTI_GSM7 = 153;
 const MAX_SMS_CHARS_SINGLE_UNICODE = 70;
 const MAX_SMS_CHARS_MULTI_UNICODE = 67;
+const INBOX_PAGE_SIZE = 20; // Messages requested per inbox page.
+// Binary (MessagePack) WebSocket format, opt-in with ?proto=msgpack (remembered; ?proto=json reverts).
+const WS_BINARY_PROTOCOL = "gsm.msgpack";
 
 // --- Language Functions ---
 /**
@@ -141,10 +146,12 @@ function initWebSocket() {
   ) {
     return; // Connection already exists or is being established.
   }
-  const wsUrl = `ws://${window.location.hostname}:81/`;
+  const binary = useBinaryProtocol();
+  const wsUrl = `ws://${window.location.host}/ws`;
   setConnectionStatus("connecting");
   console.log(`Attempting to connect to WebSocket at ${wsUrl}`);
-  ws = new WebSocket(wsUrl);
+  ws = binary ? new WebSocket(wsUrl, WS_BINARY_PROTOCOL) : new WebSocket(wsUrl);
+  ws.binaryType = "arraybuffer";
 
   ws.onopen = (event) => {
     console.log("WebSocket connection established.");
@@ -156,11 +163,15 @@ function initWebSocket() {
     );
     requestStatusUpdate();
     requestConfig();
+    loadSignalHistory();
   };
 
   ws.onmessage = (event) => {
     try {
-      const msg = JSON.parse(event.data);
+      const msg =
+        typeof event.data === "string"
+          ? JSON.parse(event.data)
+          : msgpackDecodeMessage(new Uint8Array(event.data));
       console.log("WS RX:", msg);
       handleWebSocketPayload(msg);
     } catch (e) {
@@ -195,6 +206,148 @@ function initWebSocket() {
   };
 }
 
+// --- Binary WebSocket Format (MessagePack) ---
+/**
+ * Decides whether to connect with the binary format; ?proto= overrides and is remembered.
+ * @returns {boolean} True for MessagePack, false for JSON (the default).
+ */
+function useBinaryProtocol() {
+  const requested = new URLSearchParams(window.location.search).get("proto");
+  if (requested === "msgpack" || requested === "json") {
+    localStorage.setItem("gsm_gateway_ws_proto", requested);
+  }
+  return localStorage.getItem("gsm_gateway_ws_proto") === "msgpack";
+}
+
+/**
+ * Decodes a MessagePack frame from the device; it carries the same schema as JSON.
+ * @param {Uint8Array} bytes The received frame.
+ * @returns {object} The message ({ type, data }).
+ */
+function msgpackDecodeMessage(bytes) {
+  const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  const utf8 = new TextDecoder();
+  let pos = 0;
+  const uint = (n) => {
+    const v =
+      n === 1 ? view.getUint8(pos) : n === 2 ? view.getUint16(pos) : n === 4 ? view.getUint32(pos) : Number(view.getBigUint64(pos));
+    pos += n;
+    return v;
+  };
+  const int = (n) => {
+    const v =
+      n === 1 ? view.getInt8(pos) : n === 2 ? view.getInt16(pos) : n === 4 ? view.getInt32(pos) : Number(view.getBigInt64(pos));
+    pos += n;
+    return v;
+  };
+  const str = (len) => {
+    const s = utf8.decode(bytes.subarray(pos, pos + len));
+    pos += len;
+    return s;
+  };
+  const map = (count) => {
+    const obj = {};
+    for (let i = 0; i < count; i++) {
+      const key = read();
+      obj[key] = read();
+    }
+    return obj;
+  };
+  const array = (count) => Array.from({ length: count }, () => read());
+  const read = () => {
+    if (pos >= bytes.length) throw new Error("Truncated MessagePack frame");
+    const b = bytes[pos++];
+    if (b < 0x80) return b;
+    if (b >= 0xe0) return b - 0x100;
+    if ((b & 0xf0) === 0x80) return map(b & 0x0f);
+    if ((b & 0xf0) === 0x90) return array(b & 0x0f);
+    if ((b & 0xe0) === 0xa0) return str(b & 0x1f);
+    switch (b) {
+      case 0xc0: return null;
+      case 0xc2: return false;
+      case 0xc3: return true;
+      case 0xca: { const v = view.getFloat32(pos); pos += 4; return v; }
+      case 0xcb: { const v = view.getFloat64(pos); pos += 8; return v; }
+      case 0xcc: return uint(1);
+      case 0xcd: return uint(2);
+      case 0xce: return uint(4);
+      case 0xcf: return uint(8);
+      case 0xd0: return int(1);
+      case 0xd1: return int(2);
+      case 0xd2: return int(4);
+      case 0xd3: return int(8);
+      case 0xd9: return str(uint(1));
+      case 0xda: return str(uint(2));
+      case 0xdb: return str(uint(4));
+      case 0xdc: return array(uint(2));
+      case 0xdd: return array(uint(4));
+      case 0xde: return map(uint(2));
+      case 0xdf: return map(uint(4));
+    }
+    throw new Error(`Unsupported MessagePack format 0x${b.toString(16)}`);
+  };
+  return read();
+}
+
+/**
+ * Encodes an action for the device as MessagePack.
+ * @param {object} payload The action object (same schema as the JSON format).
+ * @returns {Uint8Array} The binary frame.
+ */
+function msgpackEncodeMessage(payload) {
+  const out = [];
+  const utf8 = new TextEncoder();
+  const be = (format, value, n) => {
+    out.push(format);
+    for (let i = n - 1; i >= 0; i--) out.push(Math.floor(value / 2 ** (8 * i)) & 0xff);
+  };
+  const header = (fix, format16, count) => {
+    if (count < 16) out.push(fix | count);
+    else if (count <= 0xffff) be(format16, count, 2);
+    else be(format16 + 1, count, 4);
+  };
+  const text = (s) => {
+    const bytes = utf8.encode(s);
+    if (bytes.length < 32) out.push(0xa0 | bytes.length);
+    else if (bytes.length <= 0xff) be(0xd9, bytes.length, 1);
+    else if (bytes.length <= 0xffff) be(0xda, bytes.length, 2);
+    else be(0xdb, bytes.length, 4);
+    out.push(...bytes);
+  };
+  const write = (v) => {
+    if (v === null || v === undefined) out.push(0xc0);
+    else if (typeof v === "boolean") out.push(v ? 0xc3 : 0xc2);
+    else if (typeof v === "string") text(v);
+    else if (typeof v === "number" && Number.isInteger(v) && Math.abs(v) <= 0xffffffff) {
+      if (v >= 0) {
+        if (v < 0x80) out.push(v);
+        else if (v <= 0xff) be(0xcc, v, 1);
+        else if (v <= 0xffff) be(0xcd, v, 2);
+        else be(0xce, v, 4);
+      } else if (v >= -32) out.push(v & 0xff);
+      else if (v >= -0x80) be(0xd0, v & 0xff, 1);
+      else if (v >= -0x8000) be(0xd1, v & 0xffff, 2);
+      else be(0xd2, v >>> 0, 4);
+    } else if (typeof v === "number") {
+      const f = new DataView(new ArrayBuffer(8));
+      f.setFloat64(0, v);
+      out.push(0xcb, ...new Uint8Array(f.buffer));
+    } else if (Array.isArray(v)) {
+      header(0x90, 0xdc, v.length);
+      v.forEach(write);
+    } else {
+      const entries = Object.entries(v);
+      header(0x80, 0xde, entries.length);
+      for (const [key, value] of entries) {
+        text(key);
+        write(value);
+      }
+    }
+  };
+  write(payload);
+  return new Uint8Array(out);
+}
+
 /**
  * Updates the connection status indicator dot in the UI.
  * @param {string} status 'connecting', 'connected', or 'disconnected'.
@@ -244,10 +397,31 @@ function handleWebSocketPayload(msg) {
       hideLoader("ussd-reply-loader");
       handleUssdResponse(data);
       break;
+    case "ussd_queued":
+      getElement("ussd-response").innerHTML = `<em>${
+        langData.ussdQueued || "Waiting for another USSD session to finish"
+      } (${data?.position || "?"})</em>`;
+      break;
     case "sms_sent":
       hideLoader("sms-loader");
       handleSmsSentStatus(data);
       break;
+    case "sms_queued":
+      showNotification(
+        `${
+          data?.retry
+            ? langData.smsRetrying || "Network busy, SMS will be retried"
+            : langData.smsQueued || "SMS queued"
+        } (#${data?.job || "?"}, ${data?.position || "?"}/${
+          data?.queue_depth || "?"
+        })`,
+        false,
+        "info"
+      );
+      break;
+    case "sms_delivery":
+      handleSmsDelivery(data);
+      break;
     case "sms_received_indication":
       showNotification(
         `${langData.newSmsReceived || "New SMS"} (#${data?.index || "?"})`,
@@ -274,7 +448,7 @@ function handleWebSocketPayload(msg) {
       // This message contains a single, complete, decoded SMS message.
       // We add it to the list.
       console.log("Received a single SMS item:", data);
-      appendSmsItem(data);
+      if (matchesInboxFilter(data)) appendSmsItem(data);
       break;
 
     case "sms_list_finished":
@@ -313,7 +487,10 @@ function handleWebSocketPayload(msg) {
       break;
     case "error":
       hideAllLoaders();
-      showNotification(`${langData.errorPrefix || "Error"}: ${data}`, true);
+      showNotification(
+        `${langData.errorPrefix || "Error"}: ${msgText(data)}`,
+        true
+      );
       break;
     default:
       console.warn(`Unhandled WebSocket message type: ${type}`);
@@ -331,7 +508,11 @@ function sendWebSocketMessage(payload) {
   if (ws && ws.readyState === WebSocket.OPEN) {
     const jsonPayload = JSON.stringify(payload);
     console.log("WS TX:", jsonPayload);
-    ws.send(jsonPayload);
+    ws.send(
+      ws.protocol === WS_BINARY_PROTOCOL
+        ? msgpackEncodeMessage(payload)
+        : jsonPayload
+    );
     return true;
   } else {
     console.warn("WebSocket not open. Message not sent:", payload);
@@ -347,11 +528,144 @@ function sendWebSocketMessage(payload) {
 function requestStatusUpdate() {
   sendWebSocketMessage({ action: "getStatus" });
 }
+/**
+ * Fetches the signal history for the selected range and draws it.
+ */
+function loadSignalHistory() {
+  const range = getValue("signal-range") || "1h";
+  fetch(`/api/signal?range=${range}`)
+    .then((r) => r.json())
+    .then((d) => drawSignalChart(d))
+    .catch((e) => console.error("Failed to load signal history:", e));
+}
+
+/**
+ * Draws the signal history: min/max as a band and the average as a line.
+ * @param {object} d The /api/signal response.
+ */
+function drawSignalChart(d) {
+  const canvas = getElement("signal-chart");
+  if (!canvas || !canvas.getContext) return;
+  const ctx = canvas.getContext("2d");
+  const w = canvas.width;
+  const h = canvas.height;
+  ctx.clearRect(0, 0, w, h);
+
+  // Normalize both formats to [x, min, avg, max]
+  const pts =
+    d.range === "live"
+      ? (d.samples || []).map(([ago, dbm]) => [-ago, dbm, dbm, dbm])
+      : d.buckets || [];
+  setText(
+    "signal-chart-empty",
+    pts.length ? "" : langData.signalNoData || "No signal data yet."
+  );
+  if (!pts.length) return;
+
+  const lo = -113;
+  const hi = -51;
+  const x0 = pts[0][0];
+  const x1 = pts[pts.length - 1][0];
+  const X = (x) => (x1 === x0 ? w / 2 : 35 + ((x - x0) / (x1 - x0)) * (w - 40));
+  const Y = (v) => h - 10 - ((v - lo) / (hi - lo)) * (h - 20);
+  const path = (idx) =>
+    pts.forEach((p, i) =>
+      i ? ctx.lineTo(X(p[0]), Y(p[idx])) : ctx.moveTo(X(p[0]), Y(p[idx]))
+    );
+
+  // Grid with dBm labels
+  ctx.fillStyle = "#888";
+  ctx.font = "10px sans-serif";
+  [-110, -90, -70].forEach((v) => {
+    ctx.fillText(v, 0, Y(v) + 3);
+    ctx.fillRect(30, Y(v), w - 30, 1);
+  });
+
+  // Min/max band
+  ctx.fillStyle = "rgba(0, 120, 200, 0.2)";
+  ctx.beginPath();
+  path(3);
+  for (let i = pts.length - 1; i >= 0; i--) ctx.lineTo(X(pts[i][0]), Y(pts[i][1]));
+  ctx.closePath();
+  ctx.fill();
+
+  // Average line
+  ctx.strokeStyle = "#0078c8";
+  ctx.lineWidth = 1.5;
+  ctx.beginPath();
+  path(2);
+  ctx.stroke();
+}
 function requestConfig() {
   sendWebSocketMessage({ action: "getConfig" });
 }
 function refreshInbox() {
-  sendWebSocketMessage({ action: "getSMSList" });
+  const list = getElement("sms-list");
+  if (list) {
+    list.innerHTML = `<li><em>${langData.inboxLoading || "Loading..."}</em></li>`;
+  }
+  inboxCursor = 0;
+  loadMoreInbox();
+}
+
+/**
+ * Fetches the next page of the inbox from /api/inbox and appends it to the list.
+ * Pages are requested lazily: on refresh, on "Load more" and when the list is
+ * scrolled to its end.
+ */
+function loadMoreInbox() {
+  if (inboxLoading || inboxCursor === null) return;
+  inboxLoading = true;
+  showLoader("inbox-loader");
+
+  const params = new URLSearchParams({
+    before: inboxCursor,
+    limit: INBOX_PAGE_SIZE,
+  });
+  const sender = getValue("inbox-sender").trim();
+  if (sender) params.set("sender", sender);
+  const since = getValue("inbox-since");
+  if (since) params.set("since", Math.floor(new Date(since).getTime() / 1000));
+
+  fetch(`/api/inbox?${params}`)
+    .then((r) => {
+      if (!r.ok) throw new Error(`HTTP ${r.status}`);
+      return r.json();
+    })
+    .then((page) => {
+      (page.items || []).forEach((sms) => appendSmsItem(sms, true));
+      inboxCursor = page.next ?? null;
+    })
+    .catch((e) => {
+      console.error("Failed to load inbox page:", e);
+      showNotification(langData.inboxLoadError || "Failed to load inbox.", true);
+      inboxCursor = null;
+    })
+    .finally(() => {
+      inboxLoading = false;
+      hideLoader("inbox-loader");
+      const list = getElement("sms-list");
+      if (list && (list.innerHTML.includes("<em>") || list.innerHTML === "")) {
+        list.innerHTML = `<li><em>${
+          langData.inboxEmpty || "Inbox is empty."
+        }</em></li>`;
+      }
+      const more = getElement("inbox-more");
+      if (more) more.style.display = inboxCursor === null ? "none" : "";
+    });
+}
+
+/**
+ * Returns true if a live SMS matches the inbox filter currently applied.
+ * @param {object} sms The SMS object received from the backend.
+ */
+function matchesInboxFilter(sms) {
+  const sender = getValue("inbox-sender").trim();
+  if (sender && sms.sender !== sender) return false;
+  const since = getValue("inbox-since");
+  if (since && sms.epoch && sms.epoch < new Date(since).getTime() / 1000)
+    return false;
+  return true;
 }
 function readSmsContent(idx) {
   if (idx <= 0) return;
@@ -378,6 +692,29 @@ function updateStatusDisplay(s) {
   setText("network-operator", s?.network_operator || "---");
   setText("sim-phone-number", s?.sim_phone_number || "---");
   setText("sim-pin-status", s?.sim_pin_status || "---");
+  setText("sms-queue-depth", s?.sms_queue_depth ?? "---");
+  setText("sms-send-rate", s?.sms_send_rate ?? "---");
+  const mh = s?.modem_health;
+  setText("modem-health-state", mh?.state || "---");
+  setText("modem-recoveries", mh?.recoveries ?? "---");
+  setText(
+    "modem-mttr",
+    Number.isFinite(mh?.mttr_ms) ? (mh.mttr_ms / 1000).toFixed(1) : "---"
+  );
+  const lanes = getElement("modem-lanes");
+  if (lanes) lanes.hidden = !(s?.modems?.length > 1);
+  if (s?.modems?.length > 1) {
+    setText(
+      "modem-lanes-list",
+      s.modems
+        .map(
+          (m) =>
+            `#${m.id + 1} ${m.sim_status || "---"}, ${m.signal_quality || "---"}` +
+            (m.busy ? ` (${langData.modemBusy || "sending"})` : "")
+        )
+        .join(" | ")
+    );
+  }
 }
 function updateConfigDisplay(c) {
   setValue("server-host", c?.server_host || "");
@@ -429,7 +766,9 @@ function handleUssdResponse(data) {
 
   if (data && typeof data === "object") {
     // The message from the backend is already decoded UTF-8. Just display it.
-    let displayMessage = data.message || "";
+    let displayMessage =
+      data.message ??
+      msgText(data.code) + (data.detail ? ` (${data.detail})` : "");
     console.log(`Displaying pre-decoded USSD message: [${displayMessage}]`);
     responseDiv.textContent = displayMessage;
 
@@ -466,12 +805,15 @@ function handleUssdResponse(data) {
 }
 
 function handleSmsSentStatus(data) {
+  const cmsSuffix =
+    data.cms_error !== undefined ? ` (CMS ${data.cms_error})` : "";
   showNotification(
-    data.message ||
+    msgText(
+      data.code,
       (data.status === "OK"
         ? langData.smsSentSuccess
-        : langData.smsSentError) ||
-      "SMS Status",
+        : langData.smsSentError) || "SMS Status"
+    ) + cmsSuffix,
     data.status !== "OK",
     data.status === "OK" ? "success" : "error"
   );
@@ -482,11 +824,35 @@ function handleSmsSentStatus(data) {
   }
 }
 
+/**
+ * Shows the final delivery outcome reported by the network for a sent SMS.
+ * @param {object} data The delivery report object from the device.
+ */
+function handleSmsDelivery(data) {
+  if (!data || !data.status) return;
+  const delivered = data.status === "delivered";
+  let text;
+  if (delivered) {
+    text = langData.smsDelivered || "SMS delivered";
+  } else if (data.status === "expired") {
+    text = langData.smsDeliveryExpired || "SMS expired before delivery";
+  } else {
+    text = langData.smsDeliveryFailed || "SMS delivery failed";
+  }
+  const seconds = Math.round((data.latency_ms || 0) / 1000);
+  showNotification(
+    `${text}: ${data.number || "?"} (${seconds}s)`,
+    !delivered,
+    delivered ? "success" : "error"
+  );
+}
+
 /**
  * Appends a single SMS item to the inbox list in the UI.
  * @param {object} sms The SMS object received from the backend.
+ * @param {boolean} atEnd Append after the existing items (older page) instead of on top.
  */
-function appendSmsItem(sms) {
+function appendSmsItem(sms, atEnd = false) {
   const listElement = getElement("sms-list");
   if (!listElement || !sms || typeof sms.index === "undefined") return;
 
@@ -521,9 +887,17 @@ function appendSmsItem(sms) {
   dateSpan.textContent = sms.timestamp || "";
 
   li.appendChild(senderSpan);
+  // Tags added by the gateway's SMS rules (live messages only)
+  (Array.isArray(sms.tags) ? sms.tags : []).forEach((tag) => {
+    const tagSpan = document.createElement("span");
+    tagSpan.className = "sms-tag";
+    tagSpan.textContent = tag;
+    li.appendChild(tagSpan);
+  });
   li.appendChild(previewSpan);
   li.appendChild(dateSpan);
-  listElement.prepend(li);
+  if (atEnd) listElement.appendChild(li);
+  else listElement.prepend(li);
 }
 
 function displaySmsContent(sms) {
@@ -567,7 +941,10 @@ function handleSmsDeleted(data) {
     refreshInbox();
   } else {
     showNotification(
-      `${data?.message || langData.smsDeletedError || "Failed to delete SMS."}`,
+      msgText(
+        data?.code,
+        langData.smsDeletedError || "Failed to delete SMS."
+      ),
       true
     );
   }
@@ -718,6 +1095,15 @@ function setValue(id, value) {
 function getValue(id) {
   return getElement(id)?.value || "";
 }
+/**
+ * Translates a message code sent by the device (looked up as "msg_<code>").
+ * @param {string} code The message code.
+ * @param {string} [fallback] Text to show if the code has no translation.
+ */
+function msgText(code, fallback) {
+  if (!code) return fallback || "";
+  return langData[`msg_${code}`] || fallback || code;
+}
 function getCurrentStatusFromUI() {
   return {
     wifi_status: getElement("wifi-status")?.textContent || "---",
@@ -727,6 +1113,13 @@ function getCurrentStatusFromUI() {
     network_operator: getElement("network-operator")?.textContent || "---",
     sim_phone_number: getElement("sim-phone-number")?.textContent || "---",
     sim_pin_status: getElement("sim-pin-status")?.textContent || "---",
+    sms_queue_depth: getElement("sms-queue-depth")?.textContent || "---",
+    sms_send_rate: getElement("sms-send-rate")?.textContent || "---",
+    modem_health: {
+      state: getElement("modem-health-state")?.textContent || "---",
+      recoveries: getElement("modem-recoveries")?.textContent || "---",
+      mttr_ms: parseFloat(getElement("modem-mttr")?.textContent) * 1000,
+    },
   };
 }
 
@@ -748,7 +1141,7 @@ function submitPinForm(e) {
     .then((r) => r.json())
     .then((d) => {
       hideLoader("pin-loader");
-      showNotification(d.message, !d.success);
+      showNotification(msgText(d.code, d.message), !d.success);
       if (d.success) {
         getElement("pin-entry-section").style.display = "none";
       }
@@ -777,7 +1170,7 @@ function submitWifiForm(e) {
   fetch("/savewifi", { method: "POST", body: new URLSearchParams(fd) })
     .then((r) => r.json().catch(() => ({})))
     .then((d) => {
-      if (d && !d.success) showNotification(d.message, true);
+      if (d && !d.success) showNotification(msgText(d.code, d.message), true);
     })
     .catch((er) =>
       showNotification(langData.saveWifiError || "Failed to save WiFi.", true)
@@ -794,7 +1187,7 @@ function submitConfigForm(e) {
   fetch("/saveconfig", { method: "POST", body: new URLSearchParams(fd) })
     .then((r) => r.json())
     .then((d) => {
-      showNotification(d.message, !d.success);
+      showNotification(msgText(d.code, d.message), !d.success);
       if (d.success) requestConfig();
     })
     .catch((er) =>
@@ -866,6 +1259,7 @@ function openTab(e, tN) {
   e.currentTarget.classList.add("active");
   activeTab = tN;
   if (tN === "sms") refreshInbox();
+  if (tN === "status") loadSignalHistory();
 }
 function scanWifi() {
   const list = getElement("wifi-list");
@@ -891,7 +1285,7 @@ function scanWifi() {
         });
       } else {
         list.innerHTML = `<li><em>${
-          d.message || langData.scanFailed || "Scan failed."
+          msgText(d.code, langData.scanFailed || "Scan failed.")
         }</em></li>`;
       }
     })
@@ -945,6 +1339,14 @@ window.onload = async function () {
     submitUssdReplyForm
   );
   getElement("pin-form")?.addEventListener("submit", submitPinForm);
+  getElement("inbox-filter-form")?.addEventListener("submit", (e) => {
+    e.preventDefault();
+    refreshInbox();
+  });
+  getElement("sms-list")?.addEventListener("scroll", (e) => {
+    const l = e.target;
+    if (l.scrollTop + l.clientHeight >= l.scrollHeight - 40) loadMoreInbox();
+  });
 
   window.addEventListener("click", function (e) {
     document.querySelectorAll(".modal").forEach((m) => {
@@ -27,39 +27,47 @@
 #include "sim_handler.h"
 #include "wifi_manager.h"
 #include "web_server.h"
+#include "delivery_reports.h"
+#include "sms_scheduler.h"
+#include "sms_archive.h"
+#include "sms_dedup.h"
+#include "sms_rules.h"
+#include "boot_sequencer.h"
+#include "ussd_session.h"
+#include "signal_history.h"
+#include "modem_health.h"
+#include "logger.h"
 
 // --- Global Variable Definitions ---
 // (These are declared as 'extern' in config.h and defined here)
 SoftwareSerial sim900(RX_PIN, TX_PIN);
+#if MODEM_COUNT >= 2
+SoftwareSerial sim900b(MODEM2_RX_PIN, MODEM2_TX_PIN);
+#endif
+#if MODEM_COUNT >= 3
+SoftwareSerial sim900c(MODEM3_RX_PIN, MODEM3_TX_PIN);
+#endif
+static_assert(MODEM_COUNT >= 1 && MODEM_COUNT <= 3, "MODEM_COUNT must be 1, 2 or 3");
 AsyncWebServer server(80);
 DNSServer dnsServer;
-WebSocketsServer webSocket = WebSocketsServer(81);
+AsyncWebSocket webSocket(WS_PATH);
 GatewayConfig config;
 
 // State Variables
 bool apMode = false;
 String currentIP = "0.0.0.0";
-String simStatus = "Initializing...";
-String signalQuality = "N/A";
-String networkOperator = "N/A";
-String simPhoneNumber = "N/A";
 unsigned long lastStatusUpdate = 0;
-String simResponseBuffer = "";
-bool simRequiresPin = false;
-bool simPinOk = false;
-String currentSimCharset = "";
-
-// State Machine Variables
-SmsListState smsListState = SMS_LIST_IDLE;
-unsigned long smsListStartTime = 0;
-bool smsWaitingForContent = false;
-JsonDocument currentSmsJson;
-
-SmsSendState smsSendState = SMS_SEND_IDLE;
-unsigned long smsSendStartTime = 0;
-String smsNumberToSend;
-String smsMessageToSend;
-bool smsIsUnicode = false;
+
+// Modems (declared in sim_handler.h); the index is the id reported in events
+Modem modems[MODEM_COUNT] = {
+    Modem(0, sim900),
+#if MODEM_COUNT >= 2
+    Modem(1, sim900b),
+#endif
+#if MODEM_COUNT >= 3
+    Modem(2, sim900c),
+#endif
+};
 
 /**
  * @brief Main setup function, runs once on boot.
@@ -67,25 +75,45 @@ bool smsIsUnicode = false;
 void setup()
 {
     Serial.begin(115200);
-    Serial.println("\nBooting GSM Gateway...");
+    // Free heap before any module allocates: compare builds to see the DRAM used by constants
+    LOG_I("Booting GSM Gateway... (free heap %u bytes)", ESP.getFreeHeap());
 
     sim900.begin(SIM_BAUD);
-    Serial.println("Waiting for modem to stabilize (5 seconds)...");
-    delay(5000);
+#if MODEM_COUNT >= 2
+    sim900b.begin(SIM_BAUD);
+#endif
+#if MODEM_COUNT >= 3
+    sim900c.begin(SIM_BAUD);
+#endif
+#ifdef MODEM_PWRKEY_PIN
+    pinMode(MODEM_PWRKEY_PIN, OUTPUT);
+    digitalWrite(MODEM_PWRKEY_PIN, LOW);
+#endif
 
     initFileSystem();
     loadConfig();
-    initializeSIM();
-    initializeWifi();
+    initSmsArchive();
+    initSmsDedup();
+    initSmsRules();
+    initSmsScheduler();
+    initSignalHistory();
+
+    // Modem readiness is probed from the main loop while WiFi associates
+    startBootSequence();
 
     setupWebServer();
     server.begin();
-    Serial.println("HTTP server started.");
+    LOG_I("HTTP server started (free heap %u bytes).", ESP.getFreeHeap());
+}
 
+/**
+ * @brief Starts the services that depend on the mode chosen by the boot sequence.
+ */
+static void onBootComplete()
+{
     if (!apMode) {
-        webSocket.begin();
-        webSocket.onEvent(handleWebSocketMessage);
-        Serial.println("WebSocket server started.");
+        startWebSocket();
+        LOG_I("WebSocket server started on %s (free heap %u bytes).", WS_PATH, ESP.getFreeHeap());
         // Set last update time to force an immediate first update
         lastStatusUpdate = millis() - STATUS_UPDATE_INTERVAL + 5000;
     }
@@ -96,12 +124,44 @@ void setup()
  */
 void loop()
 {
+    // Drain buffered log messages to the UART as far as its FIFO allows
+    handleLogger();
+
+    // Finish bringing up the modem and WiFi before running the modem pipeline
+    if (!bootComplete()) {
+        if (handleBootSequence()) onBootComplete();
+        handleWebServer();
+        delay(10);
+        return;
+    }
+
     // Handle web server and DNS requests
     handleWebServer();
 
     // Handle incoming data from the SIM module and state machines
     handleSimData();
 
+    // Detect a hung modem and walk the recovery ladder
+    handleModemHealth();
+
+    // Drive the USSD session (queued requests, replies, timeouts, cancellation)
+    handleUssdSession();
+
+    // Sample the signal quality while the modem is idle and roll up its history
+    handleSignalHistory();
+
+    // Release queued SMS to the modem within the configured send rate
+    handleSmsScheduler();
+
+    // Read stored status reports and expire stale delivery tracking entries
+    handleDeliveryReports();
+
+    // Move new SMS from the SIM into the archive and free their SIM slots
+    handleSmsArchive();
+
+    // Compile and save rules uploaded through /api/rules
+    handleSmsRules();
+
     // Handle WiFi connectivity and periodic status updates
     handleMainLoopTasks();
 
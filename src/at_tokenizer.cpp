@@ -0,0 +1,151 @@
+/**
+ * @file    at_tokenizer.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of the AT result line tokenizer.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Fields are separated by commas outside double quotes. Unquoted
+ *              fields are trimmed of spaces; quoted fields are the text between
+ *              the quotes, and anything between the closing quote and the next
+ *              comma is ignored. A missing closing quote runs to the end of the
+ *              line. Every access is bounded by the line length, so malformed or
+ *              truncated input can only yield short or empty fields.
+ */
+
+
+/**
+ * @file at_tokenizer.cpp
+ * @brief Implementation of the AT result line tokenizer.
+ */
+
+#include "at_tokenizer.h"
+
+/**
+ * @brief Checks whether the field is exactly the given text.
+ */
+bool AtField::equals(const char *s) const {
+    return strlen(s) == len && memcmp(ptr, s, len) == 0;
+}
+
+/**
+ * @brief Checks whether the field begins with the given text.
+ */
+bool AtField::startsWith(const char *s) const {
+    size_t n = strlen(s);
+    return n <= len && memcmp(ptr, s, n) == 0;
+}
+
+/**
+ * @brief Parses the field as a decimal integer (optional sign).
+ * @param value Receives the number; unchanged on failure.
+ * @return False if the field is empty, not numeric or too long for a long.
+ */
+bool AtField::toInt(long &value) const {
+    size_t i = 0;
+    bool negative = false;
+    if (i < len && (ptr[i] == '-' || ptr[i] == '+')) negative = ptr[i++] == '-';
+    if (i == len || len - i > 9) return false; // No digits, or may overflow 32 bits
+    long v = 0;
+    for (; i < len; i++) {
+        if (ptr[i] < '0' || ptr[i] > '9') return false;
+        v = v * 10 + (ptr[i] - '0');
+    }
+    value = negative ? -v : v;
+    return true;
+}
+
+/**
+ * @brief Copies the field into a buffer as a NUL-terminated string.
+ * @return The number of characters copied (truncated to size - 1).
+ */
+size_t AtField::copyTo(char *out, size_t size) const {
+    if (size == 0) return 0;
+    size_t n = std::min(len, size - 1);
+    memcpy(out, ptr, n);
+    out[n] = '\0';
+    return n;
+}
+
+/**
+ * @brief Returns the field as a String (allocates; for values that are kept).
+ */
+String AtField::toString() const {
+    String s;
+    if (len > 0 && s.reserve(len)) s.concat(ptr, len);
+    return s;
+}
+
+/**
+ * @brief Starts tokenizing a line; use prefix() to skip a "+XXX:" result code.
+ * @param line The line (need not be NUL-terminated).
+ * @param len The line length.
+ */
+AtTokenizer::AtTokenizer(const char *line, size_t len) : pos_(line), end_(line + len) {
+    while (end_ > pos_ && (end_[-1] == '\r' || end_[-1] == '\n')) end_--;
+    done_ = pos_ == end_;
+}
+
+/**
+ * @brief Skips the result code (e.g., "+CMGL:") and the spaces after it.
+ * @return False (and nothing is skipped) if the line does not start with it.
+ */
+bool AtTokenizer::prefix(const char *p) {
+    size_t n = strlen(p);
+    if ((size_t)(end_ - pos_) < n || memcmp(pos_, p, n) != 0) return false;
+    pos_ += n;
+    while (pos_ < end_ && *pos_ == ' ') pos_++;
+    done_ = pos_ == end_; // A bare result code has no fields
+    return true;
+}
+
+/**
+ * @brief Reads the next field.
+ * @return False if there are no fields left.
+ */
+bool AtTokenizer::next(AtField &field) {
+    if (done_) return false;
+    while (pos_ < end_ && *pos_ == ' ') pos_++;
+    field.quoted = pos_ < end_ && *pos_ == '"';
+    if (field.quoted) {
+        const char *start = ++pos_;
+        while (pos_ < end_ && *pos_ != '"') pos_++;
+        field.ptr = start;
+        field.len = pos_ - start;
+        while (pos_ < end_ && *pos_ != ',') pos_++; // Closing quote and anything up to the comma
+    } else {
+        const char *start = pos_;
+        while (pos_ < end_ && *pos_ != ',') pos_++;
+        const char *stop = pos_;
+        while (stop > start && stop[-1] == ' ') stop--;
+        field.ptr = start;
+        field.len = stop - start;
+    }
+    if (pos_ < end_) pos_++; // The comma; a field follows, even if empty
+    else done_ = true;
+    return true;
+}
+
+/**
+ * @brief Reads the next field as an integer.
+ * @return False if the field is missing, empty or not numeric.
+ */
+bool AtTokenizer::nextInt(long &value) {
+    AtField field;
+    return next(field) && field.toInt(value);
+}
+
+/**
+ * @brief Skips fields.
+ * @return False if the line had fewer fields left.
+ */
+bool AtTokenizer::skip(uint8_t count) {
+    AtField field;
+    while (count-- > 0) {
+        if (!next(field)) return false;
+    }
+    return true;
+}
@@ -0,0 +1,66 @@
+/**
+ * @file    at_tokenizer.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Tokenizer for AT command result lines.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares AtTokenizer, which splits a result line such as
+ *              +CMGL: 1,"REC UNREAD","+963...","","25/07/04,12:34:56+12"
+ *              into its comma-separated fields. Fields point into the line, so
+ *              parsing allocates nothing; commas inside quoted strings do not
+ *              split, and empty fields are reported as such.
+ */
+
+
+/**
+ * @file at_tokenizer.h
+ * @brief Tokenizer for AT command result lines.
+ */
+
+#ifndef AT_TOKENIZER_H
+#define AT_TOKENIZER_H
+
+#include <Arduino.h>
+
+/**
+ * @struct AtField
+ * @brief One field of a result line. Points into the line; not NUL-terminated.
+ */
+struct AtField {
+    const char *ptr = nullptr;
+    size_t len = 0;
+    bool quoted = false; // The field was a quoted string (quotes not included)
+
+    bool empty() const { return len == 0; }
+    bool equals(const char *s) const;
+    bool startsWith(const char *s) const;
+    bool toInt(long &value) const;
+    size_t copyTo(char *out, size_t size) const;
+    String toString() const;
+};
+
+/**
+ * @class AtTokenizer
+ * @brief Iterates over the fields of an AT result line without copying it.
+ */
+class AtTokenizer {
+public:
+    AtTokenizer(const char *line, size_t len);
+    explicit AtTokenizer(const String &line) : AtTokenizer(line.c_str(), line.length()) {}
+
+    bool prefix(const char *p);
+    bool next(AtField &field);
+    bool nextInt(long &value);
+    bool skip(uint8_t count = 1);
+
+private:
+    const char *pos_;
+    const char *end_;
+    bool done_; // No fields left
+};
+
+#endif // AT_TOKENIZER_H
@@ -0,0 +1,171 @@
+/**
+ * @file    boot_sequencer.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of the boot sequencer.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Replaces the fixed modem start-up delay with short AT pings and the
+ *              modem's own readiness signals ("Call Ready", "SMS Ready", +CCALR).
+ *              WiFi association is started first and runs in the background while
+ *              the modem is probed and initialized. The time each phase took is
+ *              recorded and reported in the status payload.
+ */
+
+
+/**
+ * @file boot_sequencer.cpp
+ * @brief Implementation of the boot sequencer.
+ */
+
+#include "config.h"
+#include "boot_sequencer.h"
+#include "logger.h"
+#include "sim_handler.h"  // For initializeSIM
+#include "wifi_manager.h" // For beginWifi, finishWifiInit
+
+/**
+ * @enum BootPhase
+ * @brief Phases of the boot sequence, in order.
+ */
+enum BootPhase {
+    BOOT_MODEM_PROBE,  // Pinging the modem until it answers and reports ready
+    BOOT_MODEM_INIT,   // Sending the initialization commands
+    BOOT_WIFI,         // Waiting for the WiFi association started at boot
+    BOOT_DONE
+};
+
+static BootPhase bootPhase = BOOT_MODEM_PROBE;
+static unsigned long bootStart = 0;
+static unsigned long lastProbe = 0;
+static bool modemResponding = false;
+static bool queryCallReady = true; // Alternates the readiness queries
+static String probeBuffer = "";
+
+// Milliseconds from boot start until each phase finished (0 = not reached yet)
+static unsigned long tModemResponding = 0;
+static unsigned long tModemReady = 0;
+static unsigned long tSimInit = 0;
+static unsigned long tWifi = 0;
+static unsigned long tBootDone = 0;
+
+/**
+ * @brief (Static) Returns the milliseconds elapsed since the boot sequence started.
+ */
+static unsigned long sinceBoot() {
+    unsigned long t = millis() - bootStart;
+    return t > 0 ? t : 1; // 0 is reserved for "not reached"
+}
+
+/**
+ * @brief (Static) Interprets a line received from the modem while probing.
+ * @return true once the modem is ready for the initialization commands.
+ */
+static bool handleProbeLine(const String &line) {
+    if (line == "OK") {
+        if (!modemResponding) {
+            modemResponding = true;
+            tModemResponding = sinceBoot();
+            LOG_I("Boot: Modem answered after %lu ms.", tModemResponding);
+        }
+        return false;
+    }
+    if (line == "Call Ready" || line == "SMS Ready" || line.startsWith("+CCALR: 1"))
+        return true;
+    // A SIM that needs a PIN/PUK never becomes call ready; checkSimPin() deals with it
+    if (line.startsWith("+CPIN:") && !line.startsWith("+CPIN: READY"))
+        return true;
+    if (line == "RDY")
+        LOG_I("Boot: Modem power-on detected.");
+    return false;
+}
+
+/**
+ * @brief Starts the boot sequence: kicks off WiFi association and the modem probe.
+ */
+void startBootSequence() {
+    bootStart = millis();
+    bootPhase = BOOT_MODEM_PROBE;
+    lastProbe = 0;
+    beginWifi();
+}
+
+/**
+ * @brief Advances the boot sequence. Called from the main loop until it returns true.
+ * @return true once the modem and WiFi are both resolved and the gateway is running.
+ */
+bool handleBootSequence() {
+    switch (bootPhase) {
+    case BOOT_MODEM_PROBE: {
+        bool ready = false;
+        while (sim900.available() > 0) {
+            char c = sim900.read();
+            if (c == '\n') {
+                probeBuffer.trim();
+                if (probeBuffer.length() > 0 && handleProbeLine(probeBuffer)) ready = true;
+                probeBuffer = "";
+            } else if (c != '\r') {
+                probeBuffer += c;
+            }
+        }
+        if (!ready && millis() - bootStart > BOOT_MODEM_TIMEOUT) {
+            LOG_W("Boot: Modem did not report ready, initializing anyway.");
+            ready = true;
+        }
+        if (ready) {
+            probeBuffer = "";
+            tModemReady = sinceBoot();
+            LOG_I("Boot: Modem ready after %lu ms.", tModemReady);
+            bootPhase = BOOT_MODEM_INIT;
+            break;
+        }
+        if (lastProbe == 0 || millis() - lastProbe >= BOOT_PROBE_INTERVAL) {
+            lastProbe = millis();
+            if (!modemResponding) {
+                sim900.println(F("AT"));
+            } else {
+                sim900.println(queryCallReady ? "AT+CCALR?" : "AT+CPIN?");
+                queryCallReady = !queryCallReady;
+            }
+        }
+        break;
+    }
+    case BOOT_MODEM_INIT:
+        initializeSIM();
+        tSimInit = sinceBoot();
+        bootPhase = BOOT_WIFI;
+        break;
+    case BOOT_WIFI:
+        if (!finishWifiInit(millis() - bootStart > BOOT_WIFI_TIMEOUT)) break;
+        tWifi = sinceBoot();
+        tBootDone = tWifi;
+        bootPhase = BOOT_DONE;
+        LOG_I("Boot: Done in %lu ms (modem answered %lu, ready %lu, SIM init %lu, WiFi %lu).",
+                      tBootDone, tModemResponding, tModemReady, tSimInit, tWifi);
+        return true;
+    case BOOT_DONE:
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Returns true once the boot sequence has finished.
+ */
+bool bootComplete() {
+    return bootPhase == BOOT_DONE;
+}
+
+/**
+ * @brief Adds the recorded per-phase time-to-ready values (ms since boot) to a JSON object.
+ */
+void bootTimingsToJson(JsonObject obj) {
+    obj["modem_responding"] = tModemResponding;
+    obj["modem_ready"] = tModemReady;
+    obj["sim_init"] = tSimInit;
+    obj["wifi"] = tWifi;
+    obj["total"] = tBootDone;
+}
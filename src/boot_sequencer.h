@@ -0,0 +1,33 @@
+/**
+ * @file    boot_sequencer.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Function prototypes for the boot sequencer.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares the non-blocking boot sequence that probes the modem for
+ *              readiness while WiFi associates in the background, and the per-phase
+ *              time-to-ready measurements it records.
+ */
+
+
+/**
+ * @file boot_sequencer.h
+ * @brief Function prototypes for the boot sequencer.
+ */
+
+#ifndef BOOT_SEQUENCER_H
+#define BOOT_SEQUENCER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+void startBootSequence();
+bool handleBootSequence();
+bool bootComplete();
+void bootTimingsToJson(JsonObject obj);
+
+#endif // BOOT_SEQUENCER_H
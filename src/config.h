@@ -35,20 +35,136 @@
 #include <LittleFS.h>
 #include <ArduinoJson.h>
 #include <SoftwareSerial.h>
-#include <WebSocketsServer.h>
 #include <algorithm>
 
 // --- Hardware & Serial Configuration ---
 #define RX_PIN D2      ///< SoftwareSerial RX pin (connected to SIM TX)
 #define TX_PIN D1      ///< SoftwareSerial TX pin (connected to SIM RX)
 #define SIM_BAUD 9600  ///< Baud rate for the SIM900 module
+#ifndef MODEM_COUNT
+#define MODEM_COUNT 1  ///< SIM900 modems, each on its own SoftwareSerial (1-3); may be set in build_flags
+#endif
+#define PRIMARY_MODEM 0 ///< Modem on RX_PIN/TX_PIN; also serves USSD, the signal history and the watchdog
+#define MODEM2_RX_PIN D6 ///< Second modem (MODEM_COUNT >= 2)
+#define MODEM2_TX_PIN D7
+#define MODEM3_RX_PIN D5 ///< Third modem (MODEM_COUNT >= 3); RX needs a pin-change interrupt (not D0)
+#define MODEM3_TX_PIN D0 ///< GPIO16: output only, so it suits TX; keeps the boot-strap pins D3/D4/D8 free
+
+// --- Logging ---
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 3            ///< 0 = off, 1 = errors, 2 = +warnings, 3 = +info, 4 = +debug (AT traffic)
+#endif
+#define LOG_BUFFER_SIZE 4096   ///< RAM ring of recent log output (power of two), served at /logs
+#define LOG_LINE_MAX 192       ///< Longest formatted log line (longer ones are truncated)
+
+// --- JSON Arenas ---
+#define JSON_ARENA_COUNT 4   ///< Event documents that can exist at the same time without the heap
+#define JSON_ARENA_SIZE 2560 ///< Bytes per arena (fits an SMS item with a full-length body; larger documents spill to the heap)
+
+// --- Boot Sequence ---
+#define BOOT_PROBE_INTERVAL 200            ///< Interval between modem readiness probes (ms)
+const unsigned long BOOT_MODEM_TIMEOUT = 15000; ///< Initialize the modem anyway after this long
+const unsigned long BOOT_WIFI_TIMEOUT = 20000;  ///< Fall back to AP mode if WiFi is not up by then
 
 // --- Filesystem Configuration ---
-#define CONFIG_FILE "/config.json" ///< Path to the configuration file on LittleFS
+#define CONFIG_FILE "/config.json" ///< JSON configuration (import/export and migration only)
+#define CONFIG_IMAGE_FILE "/config.bin"   ///< Binary configuration image loaded at boot
+#define CONFIG_IMAGE_BACKUP "/config.bak" ///< Previous image, used if the primary is missing or corrupt
+#define CONFIG_IMAGE_TMP "/config.tmp"    ///< Image being written, renamed into place when complete
+#define CONFIG_IMAGE_MAGIC 0x46434747     ///< "GGCF"
+#define CONFIG_IMAGE_VERSION 1            ///< Bump when a GatewayConfig field changes meaning
+#define SMS_LOG_FILE "/sms.log"    ///< Append-only SMS archive log
+#define SMS_INDEX_FILE "/sms.idx"  ///< Fixed-size index of the SMS archive log
+
+// --- SMS Archive ---
+#define ARCHIVE_DEFAULT_BUDGET_KB 64 ///< Default flash budget of the SMS archive log
+#define ARCHIVE_MAX_BODY 1024        ///< Longest message body stored (bytes, UTF-8)
+#define ARCHIVE_LIST_LIMIT 50        ///< Newest messages sent to the inbox view (and max page size)
+#define ARCHIVE_QUERY_VISITS 64      ///< Index entries one /api/inbox chunk may visit before yielding
+#define SENDER_INDEX_CAPACITY 512    ///< Messages covered by the in-RAM sender index (6 bytes each)
+#define SIM_DELETE_QUEUE_SIZE 30     ///< Archived SIM slots waiting for AT+CMGD
+
+// --- Duplicate SMS Suppression ---
+#define SMS_DEDUP_FILE "/dedup.bin" ///< Fingerprints of recently received SMS (fixed size)
+#define SMS_DEDUP_SLOTS 128         ///< Hash slots per generation (power of two); 8 bytes of RAM and flash each
+const uint32_t SMS_DEDUP_WINDOW = 604800; ///< Remember a message for at least this long (SC time, 7 days)
+
+// --- SMS Rules ---
+#define SMS_RULES_FILE "/rules.json" ///< Keyword/sender rules run on incoming SMS
+#define SMS_RULES_MAX 16             ///< Rules kept from the file
+#define SMS_RULES_MAX_NODES 256      ///< Automaton states (one per distinct pattern prefix), 12 bytes each
+#define SMS_RULES_MAX_FILE 4096      ///< Largest rules file accepted
+const unsigned long SMS_RULES_ACTION_COOLDOWN = 600000; ///< Reply, forward or USSD for the same rule and sender at most every 10 minutes
 
 // --- Network Configuration ---
 #define AP_SSID "GSM-Gateway-Config" ///< SSID for the Access Point configuration mode
+#define NTP_SERVER "pool.ntp.org"    ///< Time source for timestamps of the signal history
 const long STATUS_UPDATE_INTERVAL = 1800000; ///< Periodic status update interval (30 minutes)
+const unsigned long WIFI_CONNECT_TIMEOUT = 15000; ///< Give up on an association attempt after this long
+const unsigned long WIFI_DIRECTED_TIMEOUT = 4000; ///< Give up on a directed (cached BSSID) attempt after this long
+const unsigned long WIFI_RECONNECT_BASE = 2000;   ///< First pause between reconnect attempts
+const unsigned long WIFI_RECONNECT_MAX = 120000;  ///< Longest pause between reconnect attempts
+const unsigned long WIFI_LEASE_REUSE_DEFAULT = 1800; ///< Reuse window (s) of a saved lease if the server gave no lease time
+
+// --- WebSocket Protocol ---
+#define WS_PATH "/ws"                    ///< WebSocket endpoint on the HTTP server
+#define WS_BINARY_PROTOCOL "gsm.msgpack" ///< Subprotocol that selects the compact binary (MessagePack) format
+#define WS_MAX_CLIENTS 4                 ///< Simultaneous WebSocket clients
+#define WS_MAX_MESSAGE_SIZE 4096         ///< Longest accepted client message
+#define WS_INBOUND_QUEUE 4               ///< Client messages waiting for the main loop
+#define WS_QUEUE_FRAMES 24               ///< Frames waiting per client
+#define WS_QUEUE_BUDGET 8192             ///< Bytes waiting per client before frames are dropped
+#define WS_QUEUE_INFLIGHT 4              ///< Frames handed to the library per client and not yet sent
+const unsigned long WS_OVER_BUDGET_TIMEOUT = 10000; ///< Disconnect a client that stays over budget this long
+
+// --- Signal Quality History ---
+#define SIGNAL_FILE "/signal.bin"                    ///< Min/avg/max roll-ups (fixed size)
+#define SIGNAL_RING_SIZE 60                          ///< Raw samples kept in RAM
+#define SIGNAL_MINUTE_SLOTS 1440                     ///< Minute buckets on flash (24 hours)
+#define SIGNAL_HOUR_SLOTS 168                        ///< Hour buckets on flash (7 days)
+#define SIGNAL_DAY_SLOTS 90                          ///< Day buckets on flash (90 days)
+const unsigned long SIGNAL_SAMPLE_INTERVAL = 10000;  ///< AT+CSQ sampling period
+const unsigned long SIGNAL_SAMPLE_TIMEOUT = 2000;    ///< Give up on an unanswered AT+CSQ
+const unsigned long SIGNAL_FLUSH_INTERVAL = 300000;  ///< Write the open and closed buckets to flash
+#define SIGNAL_CLOSED_BUCKETS (SIGNAL_FLUSH_INTERVAL / 60000 + 2) ///< Closed buckets per level kept in RAM between flushes
+
+// --- Modem Health Watchdog ---
+// #define MODEM_PWRKEY_PIN D8        ///< GPIO driving the SIM900 PWRKEY (enables the power-cycle step); D8 idles low as boot requires
+// #define MODEM_HANG_SIMULATION      ///< Adds the 'simulateModemHang' WebSocket action (testing only)
+#define MODEM_MAX_TIMEOUTS 3                             ///< Consecutive timeouts before the modem counts as hung
+#define MODEM_PROBE_ATTEMPTS 3                           ///< AT probes per recovery step
+const unsigned long MODEM_HUNG_AFTER = 20000;            ///< ...and no good response for at least this long
+const unsigned long MODEM_LIVENESS_INTERVAL = 30000;     ///< Probe an idle, silent modem with AT
+const unsigned long MODEM_PROBE_TIMEOUT = 1000;          ///< Wait for the answer to an AT probe
+const unsigned long MODEM_RESET_SETTLE = 15000;          ///< Wait after a restart before probing (unless RDY comes first)
+const unsigned long MODEM_PWRKEY_PULSE = 1200;           ///< PWRKEY pulse length (SIM900: at least 1 s)
+const unsigned long MODEM_PWRKEY_OFF_WAIT = 5000;        ///< Wait for NORMAL POWER DOWN before powering on again
+const unsigned long MODEM_RECOVERY_RETRY = 300000;       ///< Restart the recovery ladder after it failed
+
+// --- Modem Shadow Registers ---
+#define MODEM_REG_VALUE_LEN 24 ///< Longest cached setter argument (e.g., CPMS storages)
+
+// --- USSD Sessions ---
+#define USSD_QUEUE_SIZE 4                          ///< USSD requests waiting for the session
+#define USSD_NO_OWNER 0xFF                         ///< Owner of sessions the gateway starts itself (SMS rules)
+const unsigned long USSD_COMMAND_TIMEOUT = 5000;   ///< Wait for OK after a USSD-related command
+const unsigned long USSD_NETWORK_TIMEOUT = 30000;  ///< Wait for the network's +CUSD answer
+const unsigned long USSD_REPLY_TIMEOUT = 60000;    ///< Close a session the owner did not reply to
+
+// --- SMS Delivery Reports ---
+#define DELIVERY_TABLE_SIZE (16 * MODEM_COUNT) ///< Max number of sent SMS awaiting a status report
+#define DELIVERY_STORED_QUEUE_SIZE 8 ///< Stored reports (+CDSI) per modem waiting to be read and deleted
+const unsigned long DELIVERY_REPORT_TTL = 172800000; ///< Forget unanswered reports after 48 hours
+
+// --- SMS Send Scheduler ---
+#define SMS_QUEUE_SIZE 10          ///< Max number of SMS waiting to be sent
+#define SMS_DEFAULT_PER_MINUTE 6   ///< Default send limit per minute (token bucket)
+#define SMS_DEFAULT_PER_HOUR 200   ///< Default send limit per hour (token bucket)
+#define SMS_MAX_ATTEMPTS 3         ///< Attempts per SMS when the network reports congestion
+const unsigned long SMS_BACKOFF_BASE = 30000; ///< First pause after a congestion error (30 s)
+const unsigned long SMS_BACKOFF_MAX = 900000; ///< Longest pause after repeated congestion (15 min)
+const float SMS_PACE_STEP = 0.125f;           ///< Pace regained per successful send
+const float SMS_PACE_MIN = 0.0625f;           ///< Lowest pace (fraction of the configured rate)
 
 // --- Structs and Enums ---
 
@@ -65,6 +181,31 @@ struct GatewayConfig {
     char server_user[50] = "";
     char server_pass[50] = "";
     char sim_pin[10] = "";
+    int sms_per_minute = SMS_DEFAULT_PER_MINUTE;
+    int sms_per_hour = SMS_DEFAULT_PER_HOUR;
+    int archive_budget_kb = ARCHIVE_DEFAULT_BUDGET_KB;
+    char static_ip[16] = "";      ///< Static IPv4 address (empty = DHCP)
+    char static_gateway[16] = "";
+    char static_subnet[16] = "";
+    char static_dns[16] = "";
+    // Last good link, updated automatically for fast reassociation
+    uint8_t wifi_bssid[6] = {0};
+    int32_t wifi_channel = 0;     ///< 0 = no cached link
+    uint32_t lease_ip = 0;        ///< Last DHCP lease (IPv4, network order)
+    uint32_t lease_gateway = 0;
+    uint32_t lease_subnet = 0;
+    uint32_t lease_dns = 0;
+};
+
+/**
+ * @struct SmsListEntry
+ * @brief Header fields of the +CMGL entry whose body line comes next.
+ */
+struct SmsListEntry {
+    int index;
+    char status[12];    ///< e.g., "REC UNREAD"
+    char sender[64];    ///< Wide enough for a UCS2-hex encoded number
+    char timestamp[24];
 };
 
 /**
@@ -89,35 +230,16 @@ enum SmsSendState {
 
 
 // --- Global Object Declarations ---
-extern SoftwareSerial sim900;
+extern SoftwareSerial sim900; // Serial port of the primary modem
 extern AsyncWebServer server;
 extern DNSServer dnsServer;
-extern WebSocketsServer webSocket;
+extern AsyncWebSocket webSocket;
 extern GatewayConfig config;
 
 // --- Global State Variable Declarations ---
 extern bool apMode;
 extern String currentIP;
-extern String simStatus;
-extern String signalQuality;
-extern String networkOperator;
-extern String simPhoneNumber;
 extern unsigned long lastStatusUpdate;
-extern String simResponseBuffer;
-extern bool simRequiresPin;
-extern bool simPinOk;
-extern String currentSimCharset;
-
-// --- State Machine Variable Declarations ---
-extern SmsListState smsListState;
-extern unsigned long smsListStartTime;
-extern bool smsWaitingForContent;
-extern JsonDocument currentSmsJson;
-
-extern SmsSendState smsSendState;
-extern unsigned long smsSendStartTime;
-extern String smsNumberToSend;
-extern String smsMessageToSend;
-extern bool smsIsUnicode;
+// The modems and their state machines: modems[] in sim_handler.h
 
 #endif // CONFIG_H
\ No newline at end of file
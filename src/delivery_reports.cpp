@@ -0,0 +1,276 @@
+/**
+ * @file    delivery_reports.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of SMS delivery report tracking.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Keeps a small, fixed-size table of sent messages that requested a
+ *              status report. Reports arriving as +CDS (text or PDU mode) or stored
+ *              ones announced by +CDSI are matched by message reference and pushed
+ *              to the clients as 'sms_delivery' events.
+ */
+
+
+/**
+ * @file delivery_reports.cpp
+ * @brief Implementation of SMS delivery report tracking.
+ */
+
+#include "config.h"
+#include "delivery_reports.h"
+#include "logger.h"
+#include "json_arena.h"
+#include "at_tokenizer.h"
+#include "sim_handler.h" // For modems
+#include "web_server.h"  // For notifyClients
+#include "modem_state.h"  // For setModemRegister
+
+/**
+ * @struct DeliveryEntry
+ * @brief One sent message waiting for its status report.
+ */
+struct DeliveryEntry {
+    bool used;
+    uint8_t modem; // Message references are only unique per modem
+    uint8_t messageRef;
+    uint32_t jobId;
+    unsigned long submittedAt;
+    char number[21];
+};
+
+/**
+ * @struct StoredReportQueue
+ * @brief Storage indices announced by +CDSI on one modem, oldest first.
+ */
+struct StoredReportQueue {
+    int slots[DELIVERY_STORED_QUEUE_SIZE];
+    uint8_t count;
+};
+
+static DeliveryEntry deliveryTable[DELIVERY_TABLE_SIZE];
+static bool awaitingReportPdu[MODEM_COUNT]; // Set after a PDU-mode "+CDS: <len>" header
+static StoredReportQueue storedReports[MODEM_COUNT];
+
+/**
+ * @brief (Static) Reads one hex-encoded octet from a PDU string.
+ * @return The octet value, or -1 if the string is too short or not hex.
+ */
+static int pduOctet(const String &pdu, unsigned int pos) {
+    if (pos + 2 > pdu.length() || !isxdigit(pdu.charAt(pos)) || !isxdigit(pdu.charAt(pos + 1)))
+        return -1;
+    return (int)strtol(pdu.substring(pos, pos + 2).c_str(), NULL, 16);
+}
+
+/**
+ * @brief (Static) Finds the table slot tracking a message reference of a modem.
+ * @return The slot index, or -1 if the reference is not tracked.
+ */
+static int findEntry(uint8_t modem, uint8_t messageRef) {
+    for (int i = 0; i < DELIVERY_TABLE_SIZE; i++) {
+        const DeliveryEntry &e = deliveryTable[i];
+        if (e.used && e.modem == modem && e.messageRef == messageRef)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief (Static) Resolves a status report against the table and notifies the clients.
+ * @param modem The modem the report arrived on.
+ * @param messageRef The TP-MR of the original submission.
+ * @param st The TP-ST status octet (3GPP TS 23.040, 9.2.3.15).
+ */
+static void resolveDeliveryReport(uint8_t modem, uint8_t messageRef, int st) {
+    int slot = findEntry(modem, messageRef);
+    if (slot == -1) {
+        LOG_W("DLR: Report for untracked MR %u (st=%d) ignored.", messageRef, st);
+        return;
+    }
+
+    const char *status;
+    if (st >= 0x00 && st <= 0x1F) {
+        status = "delivered";
+    } else if (st >= 0x20 && st <= 0x3F) {
+        // Temporary error, the SC is still trying. Keep waiting for the final report.
+        LOG_I("DLR: MR %u still pending (st=%d).", messageRef, st);
+        return;
+    } else if (st == 0x46) {
+        status = "expired"; // Validity period expired
+    } else {
+        status = "failed";
+    }
+
+    DeliveryEntry &e = deliveryTable[slot];
+    PooledJsonDocument doc;
+    doc["job"] = e.jobId;
+    doc["mr"] = e.messageRef;
+    doc["number"] = e.number;
+    doc["status"] = status;
+    doc["st"] = st;
+    doc["latency_ms"] = millis() - e.submittedAt;
+    doc["modem"] = modem;
+    String s;
+    serializeJson(doc, s);
+    notifyClients("sms_delivery", s);
+    LOG_I("DLR: MR %u -> %s after %lu ms.", messageRef, status, millis() - e.submittedAt);
+    e.used = false;
+}
+
+/**
+ * @brief (Static) Parses a text-mode status report and resolves it.
+ * @param modem The modem the report arrived on.
+ * @param tok Positioned at the report fields: <fo>,<mr>,[<ra>],[<tora>],<scts>,<dt>,<st>.
+ */
+static void handleTextReport(uint8_t modem, AtTokenizer &tok) {
+    long mr, st;
+    if (!tok.skip() || !tok.nextInt(mr) || !tok.skip(4) || !tok.nextInt(st)) {
+        LOG_E("DLR: Malformed text status report.");
+        return;
+    }
+    resolveDeliveryReport(modem, (uint8_t)mr, st);
+}
+
+/**
+ * @brief (Static) Parses a PDU-mode SMS-STATUS-REPORT and resolves it.
+ * @param modem The modem the report arrived on.
+ * @param pdu The hex PDU, including the leading SMSC information.
+ */
+static void handlePduReport(uint8_t modem, const String &pdu) {
+    int scaLen = pduOctet(pdu, 0);
+    if (scaLen < 0) return;
+    unsigned int pos = 2 + scaLen * 2; // Skip SMSC address
+    pos += 2;                          // First octet (TP-MTI = 10, STATUS-REPORT)
+    int mr = pduOctet(pdu, pos);
+    pos += 2;
+    int raDigits = pduOctet(pdu, pos);
+    if (mr < 0 || raDigits < 0) return;
+    pos += 4 + ((raDigits + 1) / 2) * 2; // Length + TOA + BCD digits
+    pos += 14 + 14;                      // TP-SCTS + TP-DT (7 octets each)
+    int st = pduOctet(pdu, pos);
+    if (st < 0) {
+        LOG_E("DLR: Truncated status report PDU.");
+        return;
+    }
+    resolveDeliveryReport(modem, (uint8_t)mr, st);
+}
+
+/**
+ * @brief Starts tracking a sent message until its status report arrives.
+ * @details When the table is full the oldest entry is evicted, so the table never
+ *          grows beyond DELIVERY_TABLE_SIZE entries.
+ * @param modem The modem that sent the message.
+ * @param messageRef The TP-MR returned by +CMGS.
+ * @param jobId The gateway's job id for the send.
+ * @param number The destination number, echoed back in the event.
+ */
+void trackDeliveryReport(uint8_t modem, uint8_t messageRef, uint32_t jobId, const String &number) {
+    int slot = findEntry(modem, messageRef); // MR wrapped around: the old entry is stale
+    if (slot == -1) {
+        for (int i = 0; i < DELIVERY_TABLE_SIZE; i++) {
+            if (!deliveryTable[i].used) { slot = i; break; }
+        }
+    }
+    if (slot == -1) {
+        slot = 0;
+        for (int i = 1; i < DELIVERY_TABLE_SIZE; i++) {
+            if (millis() - deliveryTable[i].submittedAt > millis() - deliveryTable[slot].submittedAt)
+                slot = i;
+        }
+        LOG_W("DLR: Table full, evicting MR %u.", deliveryTable[slot].messageRef);
+    }
+
+    DeliveryEntry &e = deliveryTable[slot];
+    e.used = true;
+    e.modem = modem;
+    e.messageRef = messageRef;
+    e.jobId = jobId;
+    e.submittedAt = millis();
+    strlcpy(e.number, number.c_str(), sizeof(e.number));
+}
+
+/**
+ * @brief Handles a +CDS / +CDSI unsolicited result code.
+ * @param modem The modem the URC arrived on.
+ * @param line The full URC line.
+ */
+void handleDeliveryUrc(Modem &modem, const String &line) {
+    AtTokenizer tok(line);
+    if (tok.prefix("+CDSI:")) {
+        // Report was stored (e.g. CNMI <ds>=2). Fetch it once the modem is idle.
+        long index;
+        if (tok.skip() && tok.nextInt(index) && index > 0) {
+            StoredReportQueue &q = storedReports[modem.id()];
+            if (q.count < DELIVERY_STORED_QUEUE_SIZE)
+                q.slots[q.count++] = index;
+            else
+                LOG_W("DLR: Stored report queue of modem %u full, slot %ld left on the SIM.", modem.id(), index);
+        }
+    } else if (tok.prefix("+CDS:")) {
+        AtTokenizer fields = tok;
+        if (!tok.skip(2)) {
+            awaitingReportPdu[modem.id()] = true; // PDU mode: "+CDS: <length>", PDU follows
+        } else {
+            handleTextReport(modem.id(), fields);
+        }
+    }
+}
+
+/**
+ * @brief Consumes the PDU line that follows a PDU-mode +CDS header.
+ * @param modem The modem the line arrived on.
+ * @param line The received line.
+ * @return true if the line was consumed as a status report PDU.
+ */
+bool consumeDeliveryPduLine(uint8_t modem, const String &line) {
+    if (!awaitingReportPdu[modem])
+        return false;
+    awaitingReportPdu[modem] = false;
+    handlePduReport(modem, line);
+    return true;
+}
+
+/**
+ * @brief Main-loop housekeeping: reads stored reports and expires stale entries.
+ * @details Stored reports are only fetched while no SMS state machine owns the modem,
+ *          since reading them uses the blocking sendATCommand().
+ */
+void handleDeliveryReports() {
+    for (Modem &modem : modems) {
+        uint8_t id = modem.id();
+        StoredReportQueue &q = storedReports[id];
+        if (q.count == 0 || !modem.idle())
+            continue;
+        int index = q.slots[0]; // One report per pass keeps the loop responsive
+        memmove(&q.slots[0], &q.slots[1], --q.count * sizeof(int));
+        setModemRegister(MODEM_REG_CMGF, "1", id); // The report is parsed in text mode
+        String r = modem.sendATCommand("AT+CMGR=" + String(index), 5000, "+CMGR:", true);
+        AtTokenizer tok(r);
+        if (tok.prefix("+CMGR:") && tok.skip()) {
+            // Text mode: +CMGR: <stat>,<fo>,<mr>,[<ra>],[<tora>],<scts>,<dt>,<st>
+            handleTextReport(id, tok);
+        }
+        modem.sendATCommand("AT+CMGD=" + String(index), 5000, "OK", true);
+    }
+
+    for (int i = 0; i < DELIVERY_TABLE_SIZE; i++) {
+        if (deliveryTable[i].used && millis() - deliveryTable[i].submittedAt > DELIVERY_REPORT_TTL) {
+            LOG_W("DLR: No report for MR %u, dropping.", deliveryTable[i].messageRef);
+            deliveryTable[i].used = false;
+        }
+    }
+}
+
+/**
+ * @brief Returns the number of sent messages still waiting for a status report.
+ */
+uint8_t pendingDeliveryReports() {
+    uint8_t n = 0;
+    for (int i = 0; i < DELIVERY_TABLE_SIZE; i++) {
+        if (deliveryTable[i].used) n++;
+    }
+    return n;
+}
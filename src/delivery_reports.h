@@ -0,0 +1,40 @@
+/**
+ * @file    delivery_reports.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Function prototypes for SMS delivery report tracking.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares the interface for matching SMS status reports (+CDS / +CDSI)
+ *              back to the messages that requested them, using a bounded table keyed
+ *              by the TP-MR message reference returned in +CMGS.
+ */
+
+
+/**
+ * @file delivery_reports.h
+ * @brief Function prototypes for SMS delivery report tracking.
+ */
+
+#ifndef DELIVERY_REPORTS_H
+#define DELIVERY_REPORTS_H
+
+#include <Arduino.h>
+#include "urc_dispatch.h"
+
+void trackDeliveryReport(uint8_t modem, uint8_t messageRef, uint32_t jobId, const String &number);
+void handleDeliveryUrc(Modem &modem, const String &line);
+bool consumeDeliveryPduLine(uint8_t modem, const String &line);
+void handleDeliveryReports();
+uint8_t pendingDeliveryReports();
+
+// Merged into the URC dispatch table (urc_dispatch.cpp)
+constexpr UrcRoute deliveryUrcRoutes[] = {
+    {"+CDS:", handleDeliveryUrc},
+    {"+CDSI:", handleDeliveryUrc},
+};
+
+#endif // DELIVERY_REPORTS_H
@@ -9,8 +9,8 @@
  * @license MIT License
  * 
  * @description Implements the logic for mounting the LittleFS filesystem, formatting it
- *              if necessary, and handling the serialization/deserialization of the
- *              configuration to and from a JSON file.
+ *              if necessary, and persisting the configuration as a CRC-checked binary
+ *              image. The JSON form is kept for import/export only.
  */
 
  
@@ -22,6 +22,8 @@
 
 #include "config.h"
 #include "file_system.h"
+#include "logger.h"
+#include <coredecls.h> // For crc32()
 
 /**
  * @brief Initializes the LittleFS filesystem.
@@ -29,60 +31,191 @@
  *          Halts execution on a format failure.
  */
 void initFileSystem() {
-    Serial.println("Initializing LittleFS...");
+    LOG_I("Initializing LittleFS...");
     if (!LittleFS.begin()) {
-        Serial.println("Filesystem mount failed! Attempting to format...");
+        LOG_W("Filesystem mount failed! Attempting to format...");
         if (LittleFS.format()) {
-            Serial.println("Filesystem formatted successfully.");
+            LOG_I("Filesystem formatted successfully.");
         } else {
-            Serial.println("FATAL: Filesystem format failed!");
+            LOG_E("FATAL: Filesystem format failed!");
             while (1) delay(1000); // Halt
         }
     } else {
-        Serial.println("LittleFS mounted successfully.");
+        LOG_I("LittleFS mounted successfully.");
     }
 }
 
 /**
- * @brief Loads the configuration from the JSON file in LittleFS.
+ * @struct ConfigImageHeader
+ * @brief Header in front of the binary GatewayConfig image.
+ * @details GatewayConfig fields are only ever appended, so an image written by an
+ *          older firmware (smaller 'size') is loaded over the struct defaults.
+ */
+struct ConfigImageHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    uint32_t crc;
+};
+
+/**
+ * @brief (Static) Reads and validates a binary configuration image.
+ * @param path The image file.
+ * @param out Receives the configuration on success; untouched otherwise.
+ * @return true if the image exists, matches the version and passes the CRC check.
+ */
+static bool readConfigImage(const char *path, GatewayConfig &out) {
+    File f = LittleFS.open(path, "r");
+    if (!f) return false;
+    ConfigImageHeader h;
+    GatewayConfig c;
+    bool ok = f.read((uint8_t *)&h, sizeof(h)) == sizeof(h) &&
+              h.magic == CONFIG_IMAGE_MAGIC && h.version == CONFIG_IMAGE_VERSION &&
+              h.size <= sizeof(GatewayConfig) &&
+              f.read((uint8_t *)&c, h.size) == h.size &&
+              crc32(&c, h.size) == h.crc;
+    f.close();
+    if (!ok) {
+        LOG_W("Config image %s is invalid.", path);
+        return false;
+    }
+    out = c;
+    return true;
+}
+
+/**
+ * @brief (Static) Copies the configuration from its JSON form into the config struct.
+ */
+static void configFromJson(JsonVariantConst doc) {
+    strlcpy(config.wifi_ssid, doc["wifi_ssid"] | "", sizeof(config.wifi_ssid));
+    strlcpy(config.wifi_password, doc["wifi_password"] | "", sizeof(config.wifi_password));
+    strlcpy(config.ap_password, doc["ap_password"] | "", sizeof(config.ap_password));
+    strlcpy(config.server_host, doc["server_host"] | "", sizeof(config.server_host));
+    config.server_port = doc["server_port"] | 0;
+    strlcpy(config.server_user, doc["server_user"] | "", sizeof(config.server_user));
+    strlcpy(config.server_pass, doc["server_pass"] | "", sizeof(config.server_pass));
+    strlcpy(config.sim_pin, doc["sim_pin"] | "", sizeof(config.sim_pin));
+    config.sms_per_minute = doc["sms_per_minute"] | SMS_DEFAULT_PER_MINUTE;
+    config.sms_per_hour = doc["sms_per_hour"] | SMS_DEFAULT_PER_HOUR;
+    config.archive_budget_kb = doc["archive_budget_kb"] | ARCHIVE_DEFAULT_BUDGET_KB;
+    strlcpy(config.static_ip, doc["static_ip"] | "", sizeof(config.static_ip));
+    strlcpy(config.static_gateway, doc["static_gateway"] | "", sizeof(config.static_gateway));
+    strlcpy(config.static_subnet, doc["static_subnet"] | "", sizeof(config.static_subnet));
+    strlcpy(config.static_dns, doc["static_dns"] | "", sizeof(config.static_dns));
+    config.wifi_channel = 0; // Imported settings may point to another network
+}
+
+/**
+ * @brief Loads the configuration from the binary image in LittleFS.
+ * @details Falls back to the backup image if the primary one is missing or corrupt.
+ *          A legacy JSON file is only parsed when no valid image exists, and is
+ *          then converted into an image.
  * @return true if configuration was loaded successfully, false otherwise.
  */
 bool loadConfig() {
+    if (readConfigImage(CONFIG_IMAGE_FILE, config)) {
+        LOG_I("Configuration loaded from image.");
+        return true;
+    }
+    if (readConfigImage(CONFIG_IMAGE_BACKUP, config)) {
+        LOG_I("Configuration loaded from backup image.");
+        return true;
+    }
     if (LittleFS.exists(CONFIG_FILE)) {
         File f = LittleFS.open(CONFIG_FILE, "r");
-        if (!f) {
-            Serial.println("Failed to open config file for reading.");
-            return false;
-        }
-        JsonDocument doc;
-        DeserializationError err = deserializeJson(doc, f);
-        f.close();
-        if (err) {
-            Serial.print("Failed to parse config file: ");
-            Serial.println(err.c_str());
-            return false;
+        if (f && importConfigJson(f)) {
+            f.close();
+            LOG_I("Configuration migrated from JSON file.");
+            saveConfig();
+            return true;
         }
-        // Copy data from JSON to config struct
-        strlcpy(config.wifi_ssid, doc["wifi_ssid"] | "", sizeof(config.wifi_ssid));
-        strlcpy(config.wifi_password, doc["wifi_password"] | "", sizeof(config.wifi_password));
-        strlcpy(config.ap_password, doc["ap_password"] | "", sizeof(config.ap_password));
-        strlcpy(config.server_host, doc["server_host"] | "", sizeof(config.server_host));
-        config.server_port = doc["server_port"] | 0;
-        strlcpy(config.server_user, doc["server_user"] | "", sizeof(config.server_user));
-        strlcpy(config.server_pass, doc["server_pass"] | "", sizeof(config.server_pass));
-        strlcpy(config.sim_pin, doc["sim_pin"] | "", sizeof(config.sim_pin));
-        Serial.println("Configuration loaded from file.");
-        return true;
+        if (f) f.close();
     }
-    Serial.println("No configuration file found.");
+    LOG_I("No configuration file found.");
     return false;
 }
 
 /**
- * @brief Saves the current configuration to the JSON file in LittleFS.
+ * @brief Saves the current configuration as a binary image in LittleFS.
+ * @details The image is written to a temporary file first. The current image is
+ *          kept as the backup slot before the new one is renamed into place, so a
+ *          power loss at any point leaves at least one valid image on flash.
  * @return true if the configuration was saved successfully, false otherwise.
  */
 bool saveConfig() {
+    ConfigImageHeader h;
+    h.magic = CONFIG_IMAGE_MAGIC;
+    h.version = CONFIG_IMAGE_VERSION;
+    h.size = sizeof(GatewayConfig);
+    h.crc = crc32(&config, sizeof(GatewayConfig));
+
+    File f = LittleFS.open(CONFIG_IMAGE_TMP, "w");
+    if (!f) {
+        LOG_E("Failed to open config file for writing.");
+        return false;
+    }
+    bool written = f.write((const uint8_t *)&h, sizeof(h)) == sizeof(h) &&
+                   f.write((const uint8_t *)&config, sizeof(GatewayConfig)) == sizeof(GatewayConfig);
+    f.close();
+
+    GatewayConfig check;
+    if (!written || !readConfigImage(CONFIG_IMAGE_TMP, check)) {
+        LittleFS.remove(CONFIG_IMAGE_TMP);
+        LOG_E("Failed to write configuration to file.");
+        return false;
+    }
+
+    if (readConfigImage(CONFIG_IMAGE_FILE, check)) {
+        LittleFS.remove(CONFIG_IMAGE_BACKUP);
+        LittleFS.rename(CONFIG_IMAGE_FILE, CONFIG_IMAGE_BACKUP);
+    } else {
+        LittleFS.remove(CONFIG_IMAGE_FILE); // Corrupt: keep the existing backup instead
+    }
+    if (!LittleFS.rename(CONFIG_IMAGE_TMP, CONFIG_IMAGE_FILE)) {
+        LOG_E("Failed to replace configuration image.");
+        return false;
+    }
+    LOG_I("Configuration saved successfully.");
+    return true;
+}
+
+/**
+ * @brief Imports the configuration from its JSON form.
+ * @details Only updates the config struct; call saveConfig() to persist it.
+ * @param input The JSON text (file or stream).
+ * @return true if the JSON was parsed successfully, false otherwise.
+ */
+bool importConfigJson(Stream &input) {
+    JsonDocument doc;
+    DeserializationError err = deserializeJson(doc, input);
+    if (err) {
+        LOG_E("Failed to parse config file: %s", err.c_str());
+        return false;
+    }
+    configFromJson(doc.as<JsonVariantConst>());
+    return true;
+}
+
+/**
+ * @brief Imports the configuration from a JSON string.
+ * @return true if the JSON was parsed successfully, false otherwise.
+ */
+bool importConfigJson(const String &json) {
+    JsonDocument doc;
+    DeserializationError err = deserializeJson(doc, json);
+    if (err) {
+        LOG_E("Failed to parse config JSON: %s", err.c_str());
+        return false;
+    }
+    configFromJson(doc.as<JsonVariantConst>());
+    return true;
+}
+
+/**
+ * @brief Exports the current configuration in its JSON form.
+ * @param output Receives the serialized JSON.
+ */
+void exportConfigJson(String &output) {
     JsonDocument doc;
     doc["wifi_ssid"] = config.wifi_ssid;
     doc["wifi_password"] = config.wifi_password;
@@ -92,18 +225,12 @@ bool saveConfig() {
     doc["server_user"] = config.server_user;
     doc["server_pass"] = config.server_pass;
     doc["sim_pin"] = config.sim_pin;
-
-    File f = LittleFS.open(CONFIG_FILE, "w");
-    if (!f) {
-        Serial.println("Failed to open config file for writing.");
-        return false;
-    }
-    size_t bytesWritten = serializeJson(doc, f);
-    f.close();
-    if (bytesWritten > 0) {
-        Serial.println("Configuration saved successfully.");
-        return true;
-    }
-    Serial.println("Failed to write configuration to file.");
-    return false;
-}
\ No newline at end of file
+    doc["sms_per_minute"] = config.sms_per_minute;
+    doc["sms_per_hour"] = config.sms_per_hour;
+    doc["archive_budget_kb"] = config.archive_budget_kb;
+    doc["static_ip"] = config.static_ip;
+    doc["static_gateway"] = config.static_gateway;
+    doc["static_subnet"] = config.static_subnet;
+    doc["static_dns"] = config.static_dns;
+    serializeJson(doc, output);
+}
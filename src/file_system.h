@@ -23,8 +23,15 @@
 #ifndef FILE_SYSTEM_H
 #define FILE_SYSTEM_H
 
+#include <Arduino.h>
+
 void initFileSystem();
 bool loadConfig();
 bool saveConfig();
 
+// --- JSON import/export ---
+bool importConfigJson(Stream &input);
+bool importConfigJson(const String &json);
+void exportConfigJson(String &output);
+
 #endif // FILE_SYSTEM_H
\ No newline at end of file
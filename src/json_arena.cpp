@@ -0,0 +1,164 @@
+/**
+ * @file    json_arena.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of the pooled JSON document arenas.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Each arena is a static bump allocator with a fixed size budget.
+ *              Blocks carry a small size header so the most recent block can be
+ *              grown or freed in place; the arena rewinds completely when its last
+ *              live block is freed, which happens at the latest when the document
+ *              is destroyed. A block that does not fit is taken from the heap
+ *              instead, so a large document costs heap but is never truncated.
+ *              Counters record the high-water mark, blocks that spilled to the
+ *              heap (overflows) and leases served from the heap because the pool
+ *              was exhausted.
+ */
+
+
+/**
+ * @file json_arena.cpp
+ * @brief Implementation of the pooled JSON document arenas.
+ */
+
+#include "config.h"
+#include "json_arena.h"
+#include "logger.h"
+
+#define JSON_ARENA_ALIGN 8 // Block alignment (slots may hold doubles)
+
+/**
+ * @class JsonArena
+ * @brief Bump allocator over a fixed buffer.
+ */
+class JsonArena : public ArduinoJson::Allocator {
+public:
+    void *allocate(size_t size) override;
+    void deallocate(void *ptr) override;
+    void *reallocate(void *ptr, size_t newSize) override;
+    bool leased = false;
+
+private:
+    // Header in front of every block: the usable size of the block
+    struct BlockHeader {
+        uint32_t size;
+        uint32_t reserved;
+    };
+    static size_t blockSpan(size_t size) {
+        return sizeof(BlockHeader) + ((size + JSON_ARENA_ALIGN - 1) & ~(size_t)(JSON_ARENA_ALIGN - 1));
+    }
+    BlockHeader *header(void *ptr) { return (BlockHeader *)ptr - 1; }
+    bool owns(void *ptr) const { return ptr >= buffer_ && ptr < buffer_ + JSON_ARENA_SIZE; }
+    bool isLast(void *ptr) { return (uint8_t *)ptr + header(ptr)->size == buffer_ + top_; }
+
+    alignas(JSON_ARENA_ALIGN) uint8_t buffer_[JSON_ARENA_SIZE];
+    size_t top_ = 0;     // Bytes in use, including headers
+    uint16_t live_ = 0;  // Blocks not yet freed
+};
+
+/**
+ * @class JsonHeapAllocator
+ * @brief Heap fallback used when every arena is leased.
+ */
+class JsonHeapAllocator : public ArduinoJson::Allocator {
+public:
+    void *allocate(size_t size) override { return malloc(size); }
+    void deallocate(void *ptr) override { free(ptr); }
+    void *reallocate(void *ptr, size_t newSize) override { return realloc(ptr, newSize); }
+};
+
+static JsonArena arenas[JSON_ARENA_COUNT];
+static JsonHeapAllocator heapAllocator;
+static uint32_t highWater = 0;    // Most bytes ever used in one arena
+static uint32_t overflows = 0;    // Allocations that did not fit and went to the heap
+static uint32_t heapFallbacks = 0; // Leases served from the heap
+static uint8_t leasesPeak = 0;    // Most arenas leased at the same time
+
+void *JsonArena::allocate(size_t size) {
+    size_t span = blockSpan(size);
+    if (top_ + span > JSON_ARENA_SIZE) {
+        overflows++;
+        LOG_D("JSON arena full (%u of %u bytes used, %u requested), using the heap", (unsigned)top_, JSON_ARENA_SIZE, (unsigned)size);
+        return malloc(size);
+    }
+    BlockHeader *h = (BlockHeader *)(buffer_ + top_);
+    h->size = span - sizeof(BlockHeader);
+    top_ += span;
+    live_++;
+    if (top_ > highWater) highWater = top_;
+    return h + 1;
+}
+
+void JsonArena::deallocate(void *ptr) {
+    if (!ptr) return;
+    if (!owns(ptr)) {
+        free(ptr); // Spilled block
+        return;
+    }
+    if (isLast(ptr)) top_ = (uint8_t *)header(ptr) - buffer_; // Give the space back right away
+    if (--live_ == 0) top_ = 0;
+}
+
+void *JsonArena::reallocate(void *ptr, size_t newSize) {
+    if (!ptr) return allocate(newSize);
+    if (!owns(ptr)) return realloc(ptr, newSize);
+    BlockHeader *h = header(ptr);
+    if (newSize <= h->size && !isLast(ptr)) return ptr; // Shrinking a buried block: keep it
+    if (isLast(ptr)) {
+        // Grow or shrink in place
+        size_t start = (uint8_t *)h - buffer_;
+        size_t span = blockSpan(newSize);
+        if (start + span <= JSON_ARENA_SIZE) {
+            h->size = span - sizeof(BlockHeader);
+            top_ = start + span;
+            if (top_ > highWater) highWater = top_;
+            return ptr;
+        }
+    }
+    void *moved = allocate(newSize); // Elsewhere in the arena, or the heap
+    if (!moved) return nullptr;
+    memcpy(moved, ptr, std::min((size_t)h->size, newSize));
+    deallocate(ptr);
+    return moved;
+}
+
+/**
+ * @brief Leases a free arena, or the heap if none is left.
+ */
+JsonArenaLease::JsonArenaLease() : allocator_(&heapAllocator), arena_(-1) {
+    uint8_t leased = 0;
+    for (uint8_t i = 0; i < JSON_ARENA_COUNT; i++) {
+        if (arenas[i].leased) {
+            leased++;
+        } else if (arena_ < 0) {
+            arenas[i].leased = true;
+            arena_ = i;
+            allocator_ = &arenas[i];
+            leased++;
+        }
+    }
+    if (arena_ < 0) heapFallbacks++;
+    if (leased > leasesPeak) leasesPeak = leased;
+}
+
+/**
+ * @brief Returns the arena to the pool; the document has freed its blocks by now.
+ */
+JsonArenaLease::~JsonArenaLease() {
+    if (arena_ >= 0) arenas[arena_].leased = false;
+}
+
+/**
+ * @brief Adds the arena counters to a JSON object.
+ */
+void jsonArenaStatsToJson(JsonObject obj) {
+    obj["size"] = JSON_ARENA_SIZE;
+    obj["high_water"] = highWater;
+    obj["overflows"] = overflows;
+    obj["fallbacks"] = heapFallbacks;
+    obj["peak"] = leasesPeak;
+}
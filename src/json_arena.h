@@ -0,0 +1,61 @@
+/**
+ * @file    json_arena.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Pooled JSON document arenas.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares PooledJsonDocument, a JsonDocument whose memory comes from
+ *              one of JSON_ARENA_COUNT preallocated arenas instead of the heap.
+ *              Events are built and serialized many times a minute; keeping those
+ *              short-lived allocations out of the heap avoids fragmenting it.
+ */
+
+
+/**
+ * @file json_arena.h
+ * @brief Pooled JSON document arenas.
+ */
+
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/**
+ * @class JsonArenaLease
+ * @brief Holds an arena of the pool for the lifetime of a document.
+ * @details Falls back to the heap (and counts it) when every arena is leased.
+ */
+class JsonArenaLease {
+protected:
+    JsonArenaLease();
+    ~JsonArenaLease();
+    ArduinoJson::Allocator *allocator() const { return allocator_; }
+
+private:
+    ArduinoJson::Allocator *allocator_;
+    int8_t arena_; // -1 = heap fallback
+};
+
+/**
+ * @class PooledJsonDocument
+ * @brief A JsonDocument backed by a pooled arena; use for short-lived event documents.
+ * @details The lease is a base constructed before the document and released after it.
+ *          Blocks that do not fit in the arena come from the heap, so the document
+ *          only reports overflowed() when the heap is exhausted too.
+ */
+class PooledJsonDocument : private JsonArenaLease, public JsonDocument {
+public:
+    PooledJsonDocument() : JsonArenaLease(), JsonDocument(allocator()) {}
+    PooledJsonDocument(const PooledJsonDocument &) = delete;
+    PooledJsonDocument &operator=(const PooledJsonDocument &) = delete;
+};
+
+void jsonArenaStatsToJson(JsonObject obj);
+
+#endif // JSON_ARENA_H
@@ -0,0 +1,132 @@
+/**
+ * @file    logger.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of the RAM log buffer.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Formats log messages into a fixed-size ring buffer. The buffer is
+ *              drained to the UART only as far as its TX FIFO has room, so logging
+ *              never waits for the serial line. The most recent LOG_BUFFER_SIZE
+ *              bytes can be read from the /logs endpoint.
+ */
+
+
+/**
+ * @file logger.cpp
+ * @brief Implementation of the RAM log buffer.
+ */
+
+#include "config.h"
+#include "logger.h"
+#include <stdarg.h>
+
+static_assert((LOG_BUFFER_SIZE & (LOG_BUFFER_SIZE - 1)) == 0, "LOG_BUFFER_SIZE must be a power of two");
+
+static char logRing[LOG_BUFFER_SIZE];
+static uint32_t logHead = 0;      // Total bytes ever written (position of the next byte)
+static uint32_t uartTail = 0;     // Total bytes handed to the UART
+static uint32_t droppedBytes = 0; // Overwritten before they reached the UART
+
+/**
+ * @brief (Static) Copies the bytes at ring position pos (absolute) into a buffer.
+ * @details Positions count every byte ever written; the ring index is the position
+ *          modulo the buffer size, so the counters may wrap around freely.
+ */
+static void ringRead(uint32_t pos, char *out, size_t len) {
+    size_t start = pos & (LOG_BUFFER_SIZE - 1);
+    size_t first = std::min(len, (size_t)LOG_BUFFER_SIZE - start);
+    memcpy(out, logRing + start, first);
+    memcpy(out + first, logRing, len - first);
+}
+
+/**
+ * @brief (Static) Appends bytes to the ring, overwriting the oldest ones.
+ */
+static void ringWrite(const char *data, size_t len) {
+    size_t start = logHead & (LOG_BUFFER_SIZE - 1);
+    size_t first = std::min(len, (size_t)LOG_BUFFER_SIZE - start);
+    memcpy(logRing + start, data, first);
+    memcpy(logRing, data + first, len - first);
+    logHead += len;
+    if (logHead - uartTail > LOG_BUFFER_SIZE) {
+        droppedBytes += logHead - uartTail - LOG_BUFFER_SIZE;
+        uartTail = logHead - LOG_BUFFER_SIZE;
+    }
+}
+
+/**
+ * @brief (Static) Writes as much of the buffer to the UART as its TX FIFO accepts.
+ */
+static void drainToUart() {
+    if (droppedBytes > 0 && Serial.availableForWrite() > 32) {
+        Serial.printf("\n[log: %u bytes dropped]\n", droppedBytes);
+        droppedBytes = 0;
+    }
+    while (uartTail != logHead) {
+        size_t room = Serial.availableForWrite();
+        if (room == 0) break;
+        size_t start = uartTail & (LOG_BUFFER_SIZE - 1);
+        size_t chunk = std::min({(size_t)(logHead - uartTail), (size_t)LOG_BUFFER_SIZE - start, room});
+        Serial.write((const uint8_t *)logRing + start, chunk);
+        uartTail += chunk;
+    }
+}
+
+/**
+ * @brief Formats a log message into the ring buffer. Use the LOG_x macros instead.
+ * @param level One of the LOG_LEVEL_* values.
+ * @param format printf-style format string in flash (PSTR).
+ */
+void logPrintf(uint8_t level, PGM_P format, ...) {
+    static const char levelChars[] = "-EWID";
+    char line[LOG_LINE_MAX];
+    int n = snprintf(line, sizeof(line), "%lu %c ", millis(), levelChars[level < 5 ? level : 0]);
+    va_list args;
+    va_start(args, format);
+    vsnprintf_P(line + n, sizeof(line) - n - 1, format, args); // Leave room for the newline
+    va_end(args);
+    size_t len = strlen(line);
+    line[len++] = '\n';
+    ringWrite(line, len);
+    drainToUart();
+}
+
+/**
+ * @brief Main-loop driver: keeps draining the buffer to the UART.
+ */
+void handleLogger() {
+    drainToUart();
+}
+
+/**
+ * @brief Serves the buffered log as plain text (streamed, oldest first).
+ * @details GET /logs[?since=<pos>]. The X-Log-Next header holds the position to pass
+ *          as 'since' on the next request, so a client can tail the log by polling.
+ */
+void handleLogQuery(AsyncWebServerRequest *request) {
+    uint32_t end = logHead;
+    uint32_t oldest = end > LOG_BUFFER_SIZE ? end - LOG_BUFFER_SIZE : 0;
+    auto pos = std::make_shared<uint32_t>(oldest);
+    if (request->hasParam("since")) {
+        uint32_t since = strtoul(request->getParam("since")->value().c_str(), NULL, 10);
+        if (since - oldest <= end - oldest) *pos = since; // Within the buffered window
+    }
+
+    AsyncWebServerResponse *response = request->beginChunkedResponse("text/plain",
+        [pos, end](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            // Skip whatever was overwritten since the previous chunk
+            if (logHead - *pos > LOG_BUFFER_SIZE) *pos = logHead - LOG_BUFFER_SIZE;
+            if (end - *pos > LOG_BUFFER_SIZE) return 0;
+            size_t n = std::min(maxLen, (size_t)(end - *pos));
+            ringRead(*pos, (char *)buffer, n);
+            *pos += n;
+            return n;
+        });
+    response->addHeader("X-Log-Next", String(end));
+    response->addHeader("Cache-Control", "no-store");
+    request->send(response);
+}
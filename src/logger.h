@@ -0,0 +1,66 @@
+/**
+ * @file    logger.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Logging macros and function prototypes for the RAM log buffer.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares the LOG_E/LOG_W/LOG_I/LOG_D macros. Levels above LOG_LEVEL
+ *              compile to nothing, so their arguments are never evaluated. Enabled
+ *              messages are formatted from flash into a RAM ring buffer that is
+ *              drained to the UART without blocking and can be read over HTTP.
+ */
+
+
+/**
+ * @file logger.h
+ * @brief Logging macros and function prototypes for the RAM log buffer.
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "config.h" // For LOG_LEVEL
+
+// Forward declaration to avoid circular dependencies
+class AsyncWebServerRequest;
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+void logPrintf(uint8_t level, PGM_P format, ...) __attribute__((format(printf, 2, 3)));
+void handleLogger();
+void handleLogQuery(AsyncWebServerRequest *request);
+
+// The format string must be a literal; it is kept in flash
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_E(format, ...) logPrintf(LOG_LEVEL_ERROR, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_E(format, ...) do { } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_W(format, ...) logPrintf(LOG_LEVEL_WARN, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_W(format, ...) do { } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_I(format, ...) logPrintf(LOG_LEVEL_INFO, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_I(format, ...) do { } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_D(format, ...) logPrintf(LOG_LEVEL_DEBUG, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_D(format, ...) do { } while (0)
+#endif
+
+#endif // LOGGER_H
@@ -0,0 +1,370 @@
+/**
+ * @file    modem_health.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of the modem health watchdog.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Counts consecutive command timeouts and remembers when the modem last
+ *              answered. When both show the modem is hung, blocking commands are
+ *              short-circuited and a bounded recovery ladder is walked: AT re-sync,
+ *              AT+CFUN=1,1 soft reset, then a PWRKEY power cycle if the pin is wired.
+ *              Once the modem answers, it is re-initialized and the queued work
+ *              resumes. The time from the last good response to recovery is recorded.
+ */
+
+
+/**
+ * @file modem_health.cpp
+ * @brief Implementation of the modem health watchdog.
+ */
+
+#include "config.h"
+#include "modem_health.h"
+#include "logger.h"
+#include "sim_handler.h"  // For modems, modemIdle
+#include "web_server.h"   // For notifyStatus
+#include "modem_state.h"  // For invalidateModemRegisters
+
+/**
+ * @enum ModemHealthState
+ * @brief Steps of the recovery ladder, in escalation order.
+ */
+enum ModemHealthState {
+    HEALTH_OK,
+    HEALTH_RESYNC,     // Probing with AT after clearing a stuck prompt
+    HEALTH_SOFT_RESET, // Waiting for the modem to restart after AT+CFUN=1,1
+    HEALTH_POWER_OFF,  // PWRKEY pulsed, waiting for the modem to power down
+    HEALTH_POWER_ON,   // PWRKEY pulsed again, waiting for the modem to start
+    HEALTH_REINIT,     // The modem answers again, re-running initializeSIM()
+    HEALTH_FAILED      // Every step failed, the ladder restarts after MODEM_RECOVERY_RETRY
+};
+
+static ModemHealthState healthState = HEALTH_OK;
+static unsigned long stepStartedAt = 0;
+static unsigned long settleUntil = 0;
+static uint8_t probesSent = 0;
+static bool probePending = false;
+static unsigned long probeSentAt = 0;
+static bool resetSeen = false;          // RDY / NORMAL POWER DOWN seen during the current step
+static bool reinitRequested = false;    // The modem restarted on its own
+
+static uint8_t consecutiveTimeouts = 0;
+static unsigned long lastGoodResponse = 0;
+static unsigned long outageStart = 0;   // Last good response before the current outage
+static bool recoveryCounted = false;    // false for a re-init after a spontaneous restart
+
+static uint32_t recoveries = 0;
+static uint32_t ladderFailures = 0;
+static unsigned long totalRecoveryTime = 0;
+static unsigned long lastRecoveryTime = 0;
+
+#ifdef MODEM_HANG_SIMULATION
+static bool hangSimulated = false;
+static ModemHealthState hangClearedBy = HEALTH_OK; // HEALTH_OK = never cleared
+#endif
+
+/**
+ * @brief (Static) Returns a human-readable name for the current state.
+ */
+static const char *stateName() {
+    switch (healthState) {
+    case HEALTH_OK: return "OK";
+    case HEALTH_RESYNC: return "Resyncing";
+    case HEALTH_SOFT_RESET: return "Resetting";
+    case HEALTH_POWER_OFF:
+    case HEALTH_POWER_ON: return "Power Cycling";
+    case HEALTH_REINIT: return "Re-initializing";
+    case HEALTH_FAILED: return "Not Responding";
+    }
+    return "Unknown";
+}
+
+/**
+ * @brief (Static) Writes a non-blocking AT probe; the answer arrives via handleSimData().
+ */
+static void sendProbe() {
+    sim900.println(F("AT"));
+    probePending = true;
+    probeSentAt = millis();
+}
+
+#ifdef MODEM_PWRKEY_PIN
+/**
+ * @brief (Static) Pulses the SIM900 PWRKEY, which toggles the modem power.
+ */
+static void pulsePowerKey() {
+    LOG_I("Modem: Pulsing PWRKEY.");
+    digitalWrite(MODEM_PWRKEY_PIN, HIGH);
+    delay(MODEM_PWRKEY_PULSE);
+    digitalWrite(MODEM_PWRKEY_PIN, LOW);
+}
+#endif
+
+/**
+ * @brief (Static) Enters a recovery step and performs its action.
+ * @param state The step to enter.
+ * @param settle Time to wait before the first probe of the step.
+ */
+static void enterStep(ModemHealthState state, unsigned long settle) {
+    healthState = state;
+    stepStartedAt = millis();
+    settleUntil = millis() + settle;
+    probesSent = 0;
+    probePending = false;
+    resetSeen = false;
+    LOG_I("Modem: Recovery step '%s'.", stateName());
+
+#ifdef MODEM_HANG_SIMULATION
+    if (hangSimulated && hangClearedBy != HEALTH_OK && state >= hangClearedBy) {
+        LOG_I("Modem: Simulated hang cleared.");
+        hangSimulated = false;
+    }
+#endif
+
+    switch (state) {
+    case HEALTH_RESYNC:
+        sim900.write(27); // ESC aborts a '>' prompt the modem may be stuck in
+        break;
+    case HEALTH_SOFT_RESET:
+        sim900.write(27);
+        sim900.println(F("AT+CFUN=1,1"));
+        break;
+#ifdef MODEM_PWRKEY_PIN
+    case HEALTH_POWER_OFF:
+        pulsePowerKey();
+        break;
+#endif
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief (Static) Moves on to the next step once the current one has failed.
+ */
+static void escalate() {
+    switch (healthState) {
+    case HEALTH_RESYNC:
+        enterStep(HEALTH_SOFT_RESET, MODEM_RESET_SETTLE);
+        break;
+#ifdef MODEM_PWRKEY_PIN
+    case HEALTH_SOFT_RESET:
+        enterStep(HEALTH_POWER_OFF, MODEM_PWRKEY_OFF_WAIT);
+        break;
+#endif
+    default:
+        ladderFailures++;
+        healthState = HEALTH_FAILED;
+        stepStartedAt = millis();
+        LOG_E("Modem: Recovery failed, retrying in %lu ms.", MODEM_RECOVERY_RETRY);
+        notifyStatus();
+        break;
+    }
+}
+
+/**
+ * @brief (Static) Re-initializes the modem after it answered again and records the
+ *        recovery time.
+ */
+static void finishRecovery() {
+    invalidateModemRegisters(); // The modem may have restarted with default settings
+    modems[PRIMARY_MODEM].initialize();
+    modems[PRIMARY_MODEM].updateStatus();
+    healthState = HEALTH_OK;
+    consecutiveTimeouts = 0;
+
+    if (recoveryCounted) {
+        lastRecoveryTime = millis() - outageStart;
+        totalRecoveryTime += lastRecoveryTime;
+        recoveries++;
+        LOG_I("Modem: Recovered after %lu ms (MTTR %lu ms over %u recoveries).",
+                      lastRecoveryTime, totalRecoveryTime / recoveries, recoveries);
+    }
+    notifyStatus();
+}
+
+/**
+ * @brief Records that the modem answered (any line received from it).
+ */
+void modemResponseReceived() {
+    lastGoodResponse = millis();
+    consecutiveTimeouts = 0;
+}
+
+/**
+ * @brief Records that a command got no answer within its timeout.
+ */
+void modemCommandTimedOut() {
+    if (consecutiveTimeouts < 255) consecutiveTimeouts++;
+}
+
+/**
+ * @brief Handles a modem restart URC (RDY, Call Ready, NORMAL POWER DOWN).
+ * @details During a reset step, the restart ends the settle time early. Outside of
+ *          recovery, the modem restarted on its own and lost its settings, so it is
+ *          re-initialized once it is idle. The watchdog only covers the primary
+ *          modem; another modem that restarted re-initializes itself.
+ * @param modem The modem the URC arrived on.
+ * @param line The full URC line.
+ */
+void handleModemResetUrc(Modem &modem, const String &line) {
+    // The modem restarted: its mode settings are back to defaults
+    LOG_W("Modem %u reset detected, clearing shadow registers.", modem.id());
+    invalidateModemRegisters(modem.id());
+    if (modem.id() != PRIMARY_MODEM) {
+        if (line != "Call Ready") modem.requestReinit();
+        return;
+    }
+
+    switch (healthState) {
+    case HEALTH_OK:
+        if (line != "Call Ready") reinitRequested = true; // Call Ready follows RDY
+        break;
+    case HEALTH_SOFT_RESET:
+    case HEALTH_POWER_ON:
+        if (line == "RDY") settleUntil = millis();
+        break;
+    case HEALTH_POWER_OFF:
+        resetSeen = true;
+        // RDY instead of NORMAL POWER DOWN: the modem was off and the pulse started it,
+        // so it must not be pulsed again
+        if (line == "RDY") enterStep(HEALTH_POWER_ON, 0);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Main-loop driver: detects a hung modem and walks the recovery ladder.
+ * @details The modem counts as hung after MODEM_MAX_TIMEOUTS consecutive timeouts with
+ *          no good response for MODEM_HUNG_AFTER. An idle modem is probed with AT
+ *          every MODEM_LIVENESS_INTERVAL, so a hang is detected without traffic too.
+ */
+void handleModemHealth() {
+    if (probePending && millis() - probeSentAt > MODEM_PROBE_TIMEOUT) {
+        probePending = false;
+        modemCommandTimedOut();
+    }
+
+    switch (healthState) {
+    case HEALTH_OK:
+        if (!modemIdle()) break;
+        if (consecutiveTimeouts >= MODEM_MAX_TIMEOUTS && millis() - lastGoodResponse >= MODEM_HUNG_AFTER) {
+            LOG_W("Modem: Hung (%u timeouts, last answer %lu ms ago), recovering.",
+                          consecutiveTimeouts, millis() - lastGoodResponse);
+            outageStart = lastGoodResponse;
+            recoveryCounted = true;
+            reinitRequested = false;
+            modems[PRIMARY_MODEM].simStatus = F("Modem Not Responding");
+            enterStep(HEALTH_RESYNC, 0);
+            notifyStatus();
+            break;
+        }
+        if (reinitRequested) {
+            LOG_I("Modem: Restarted on its own, re-initializing.");
+            reinitRequested = false;
+            recoveryCounted = false;
+            healthState = HEALTH_REINIT;
+            break;
+        }
+        if (!probePending && millis() - lastGoodResponse >= MODEM_LIVENESS_INTERVAL &&
+            millis() - probeSentAt >= MODEM_LIVENESS_INTERVAL)
+            sendProbe();
+        break;
+
+    case HEALTH_RESYNC:
+    case HEALTH_SOFT_RESET:
+    case HEALTH_POWER_ON:
+        if ((long)(millis() - settleUntil) < 0 || probePending) break;
+        if (probesSent < MODEM_PROBE_ATTEMPTS) {
+            probesSent++;
+            sendProbe();
+            break;
+        }
+        escalate();
+        break;
+
+    case HEALTH_POWER_OFF:
+#ifdef MODEM_PWRKEY_PIN
+        if ((long)(millis() - settleUntil) < 0 && !resetSeen) break;
+        pulsePowerKey(); // Power it back on
+        enterStep(HEALTH_POWER_ON, MODEM_RESET_SETTLE);
+#endif
+        break;
+
+    case HEALTH_REINIT:
+        finishRecovery();
+        break;
+
+    case HEALTH_FAILED:
+        if (millis() - stepStartedAt >= MODEM_RECOVERY_RETRY) enterStep(HEALTH_RESYNC, 0);
+        break;
+    }
+}
+
+/**
+ * @brief Returns true while the modem is considered hung. Blocking commands fail at
+ *        once and no state machine may start a new command.
+ */
+bool modemRecovering() {
+    return healthState != HEALTH_OK && healthState != HEALTH_REINIT;
+}
+
+/**
+ * @brief Returns true while an AT probe is waiting for its answer.
+ */
+bool modemProbePending() {
+    return probePending;
+}
+
+/**
+ * @brief Handles a response line for the pending AT probe.
+ * @param line The received line. OK or any ERROR means the modem is answering.
+ */
+void handleModemProbeLine(const String &line) {
+    if (line != "OK" && line.indexOf("ERROR") == -1) return; // e.g. the echoed "AT"
+    probePending = false;
+    if (modemRecovering()) {
+        LOG_I("Modem: Answering again (step '%s').", stateName());
+        healthState = HEALTH_REINIT;
+    }
+}
+
+/**
+ * @brief Adds the watchdog state and recovery statistics to a JSON object.
+ */
+void modemHealthToJson(JsonObject obj) {
+    obj["state"] = stateName();
+    obj["timeouts"] = consecutiveTimeouts;
+    obj["last_good_ms"] = millis() - lastGoodResponse;
+    obj["recoveries"] = recoveries;
+    obj["failures"] = ladderFailures;
+    obj["mttr_ms"] = recoveries ? totalRecoveryTime / recoveries : 0;
+    obj["last_recovery_ms"] = lastRecoveryTime;
+}
+
+#ifdef MODEM_HANG_SIMULATION
+/**
+ * @brief Simulates a hung modem by discarding everything it sends.
+ * @param clearedBy The recovery step that ends the hang: 1 = AT re-sync,
+ *                  2 = soft reset, 3 = power cycle, anything else = never.
+ */
+void simulateModemHang(uint8_t clearedBy) {
+    static const ModemHealthState steps[] = {HEALTH_OK, HEALTH_RESYNC, HEALTH_SOFT_RESET, HEALTH_POWER_OFF};
+    hangClearedBy = clearedBy < 4 ? steps[clearedBy] : HEALTH_OK;
+    hangSimulated = true;
+    LOG_I("Modem: Simulating a hang (cleared by step %u).", clearedBy);
+}
+
+/**
+ * @brief Returns true while a simulated hang is active.
+ */
+bool modemHangSimulated() {
+    return hangSimulated;
+}
+#endif
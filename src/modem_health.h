@@ -0,0 +1,52 @@
+/**
+ * @file    modem_health.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Function prototypes for the modem health watchdog.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares the watchdog that tracks command timeouts and the last good
+ *              modem response, and walks a bounded recovery ladder (AT re-sync,
+ *              AT+CFUN=1,1 soft reset, optional PWRKEY power cycle) when the modem hangs.
+ */
+
+
+/**
+ * @file modem_health.h
+ * @brief Function prototypes for the modem health watchdog.
+ */
+
+#ifndef MODEM_HEALTH_H
+#define MODEM_HEALTH_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "urc_dispatch.h"
+
+// --- Reporting from the modem drivers ---
+void modemResponseReceived();
+void modemCommandTimedOut();
+void handleModemResetUrc(Modem &modem, const String &line);
+
+// Merged into the URC dispatch table (urc_dispatch.cpp)
+constexpr UrcRoute modemHealthUrcRoutes[] = {
+    {"RDY", handleModemResetUrc, true},
+    {"Call Ready", handleModemResetUrc, true},
+    {"NORMAL POWER DOWN", handleModemResetUrc},
+};
+
+// --- Watchdog ---
+void handleModemHealth();
+bool modemRecovering();
+bool modemProbePending();
+void handleModemProbeLine(const String &line);
+void modemHealthToJson(JsonObject obj);
+
+// --- Testing ---
+void simulateModemHang(uint8_t clearedBy);
+bool modemHangSimulated();
+
+#endif // MODEM_HEALTH_H
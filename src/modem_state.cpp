@@ -0,0 +1,89 @@
+/**
+ * @file    modem_state.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of the modem shadow registers.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Each register holds the value the modem last acknowledged with OK,
+ *              or nothing if it is unknown (after boot, an error, or a detected
+ *              modem reset). Setters that would not change anything are skipped,
+ *              saving a full round-trip at 9600 baud each time.
+ */
+
+
+/**
+ * @file modem_state.cpp
+ * @brief Implementation of the modem shadow registers.
+ */
+
+#include "config.h"
+#include "modem_state.h"
+#include "sim_handler.h" // For Modem::sendATCommand
+
+static const char *const registerNames[MODEM_REG_COUNT] = {"CMGF", "CSCS", "CNMI", "CSMP", "CPMS"};
+static char shadow[MODEM_COUNT][MODEM_REG_COUNT][MODEM_REG_VALUE_LEN]; // Empty = unknown
+static uint32_t roundTripsSaved = 0;
+
+/**
+ * @brief Checks whether a register already holds a value.
+ * @details Counts a saved round-trip when it does, since the caller will skip its setter.
+ * @param reg The register.
+ * @param value The value as written after '=' in the setter (e.g., "1", "\"GSM\"").
+ * @param modem The modem.
+ * @return true if the modem is known to be in that mode.
+ */
+bool modemRegisterIs(ModemRegister reg, const char *value, uint8_t modem) {
+    if (shadow[modem][reg][0] == '\0' || strcmp(shadow[modem][reg], value) != 0)
+        return false;
+    roundTripsSaved++;
+    return true;
+}
+
+/**
+ * @brief Records a value the modem has acknowledged.
+ */
+void modemRegisterSet(ModemRegister reg, const char *value, uint8_t modem) {
+    strlcpy(shadow[modem][reg], value, sizeof(shadow[modem][reg]));
+}
+
+/**
+ * @brief Marks a register as unknown (e.g., after a failed setter).
+ */
+void modemRegisterClear(ModemRegister reg, uint8_t modem) {
+    shadow[modem][reg][0] = '\0';
+}
+
+/**
+ * @brief Sets a register with a blocking AT command unless it already holds the value.
+ * @details Uses sendATCommand(), so only call it from the main loop while no
+ *          state machine owns the modem.
+ * @return true if the modem is in the requested mode afterwards.
+ */
+bool setModemRegister(ModemRegister reg, const char *value, uint8_t modem) {
+    if (modemRegisterIs(reg, value, modem)) return true;
+    String r = modems[modem].sendATCommand(String("AT+") + registerNames[reg] + "=" + value, 1000, "OK", true);
+    if (r.startsWith("OK")) {
+        modemRegisterSet(reg, value, modem);
+        return true;
+    }
+    modemRegisterClear(reg, modem);
+    return false;
+}
+
+/**
+ * @brief Forgets all register values. Call when the modem was reset or power cycled.
+ */
+void invalidateModemRegisters(uint8_t modem) {
+    for (int i = 0; i < MODEM_REG_COUNT; i++) shadow[modem][i][0] = '\0';
+}
+
+/**
+ * @brief Returns the number of setter round-trips skipped since boot.
+ */
+uint32_t modemRoundTripsSaved() {
+    return roundTripsSaved;
+}
@@ -0,0 +1,49 @@
+/**
+ * @file    modem_state.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Function prototypes for the modem shadow registers.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares a cache of the last acknowledged value of the modem's mode
+ *              settings (CMGF, CSCS, CNMI, CSMP, CPMS), used to skip setter commands
+ *              when the desired mode is already active.
+ */
+
+
+/**
+ * @file modem_state.h
+ * @brief Function prototypes for the modem shadow registers.
+ */
+
+#ifndef MODEM_STATE_H
+#define MODEM_STATE_H
+
+#include <Arduino.h>
+#include "config.h" // For PRIMARY_MODEM
+
+/**
+ * @enum ModemRegister
+ * @brief Modem settings mirrored by the shadow registers.
+ */
+enum ModemRegister {
+    MODEM_REG_CMGF,  // Message format (0 = PDU, 1 = text)
+    MODEM_REG_CSCS,  // TE character set
+    MODEM_REG_CNMI,  // New message indications
+    MODEM_REG_CSMP,  // Text-mode SUBMIT parameters
+    MODEM_REG_CPMS,  // Preferred message storage
+    MODEM_REG_COUNT
+};
+
+// Each modem has its own registers; 'modem' is its index in modems[]
+bool modemRegisterIs(ModemRegister reg, const char *value, uint8_t modem = PRIMARY_MODEM);
+void modemRegisterSet(ModemRegister reg, const char *value, uint8_t modem = PRIMARY_MODEM);
+void modemRegisterClear(ModemRegister reg, uint8_t modem = PRIMARY_MODEM);
+bool setModemRegister(ModemRegister reg, const char *value, uint8_t modem = PRIMARY_MODEM);
+void invalidateModemRegisters(uint8_t modem = PRIMARY_MODEM);
+uint32_t modemRoundTripsSaved();
+
+#endif // MODEM_STATE_H
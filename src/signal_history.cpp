@@ -0,0 +1,344 @@
+/**
+ * @file    signal_history.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of the signal quality history.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Samples AT+CSQ whenever the modem is idle, without waiting for the
+ *              answer, and keeps the recent samples in a RAM ring. Once the clock
+ *              is set (NTP), samples are rolled up into min/avg/max buckets at
+ *              minute, hour and day resolution. Each resolution is a fixed-size
+ *              circular section of one binary file, so the file never grows.
+ */
+
+
+/**
+ * @file signal_history.cpp
+ * @brief Implementation of the signal quality history.
+ */
+
+#include "config.h"
+#include "signal_history.h"
+#include "logger.h"
+#include "at_tokenizer.h"
+#include "sim_handler.h" // For modems, modemIdle
+#include "modem_health.h" // For modemCommandTimedOut
+#include <time.h>
+
+#define SIGNAL_FILE_MAGIC 0x51534753 // "SGSQ"
+#define SIGNAL_FILE_VERSION 1
+
+/**
+ * @struct SignalBucket
+ * @brief Min/avg/max of the samples taken in one time slot.
+ */
+struct SignalBucket {
+    uint32_t start;  // Unix time of the slot start (0 = empty)
+    int8_t minDbm;
+    int8_t maxDbm;
+    int8_t avgDbm;
+    uint8_t reserved;
+    uint16_t count;  // Number of samples aggregated
+    uint16_t reserved2;
+};
+
+/**
+ * @struct SignalFileHeader
+ * @brief Header of the signal history file; a mismatch resets the file.
+ */
+struct SignalFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t minuteSlots;
+    uint16_t hourSlots;
+    uint16_t daySlots;
+    uint32_t reserved;
+};
+
+/**
+ * @struct SignalLevel
+ * @brief One roll-up resolution: its slot length, file section, open bucket and the
+ *        closed buckets not yet written to flash.
+ */
+struct SignalLevel {
+    uint32_t seconds;
+    uint16_t slots;
+    uint32_t offset;
+    SignalBucket open;  // Bucket currently being filled
+    int32_t openSum;    // Sum of dBm values in 'open'
+    SignalBucket closed[SIGNAL_CLOSED_BUCKETS]; // Oldest first
+    uint8_t closedCount;
+};
+
+/**
+ * @struct SignalSample
+ * @brief One raw AT+CSQ reading kept in the RAM ring.
+ */
+struct SignalSample {
+    uint32_t at;  // millis() of the reading
+    int8_t dbm;
+};
+
+static SignalLevel levels[3] = {
+    {60, SIGNAL_MINUTE_SLOTS, 0, {}, 0, {}, 0},
+    {3600, SIGNAL_HOUR_SLOTS, 0, {}, 0, {}, 0},
+    {86400, SIGNAL_DAY_SLOTS, 0, {}, 0, {}, 0},
+};
+
+static SignalSample ring[SIGNAL_RING_SIZE];
+static uint8_t ringHead = 0;  // Next slot to write
+static uint8_t ringCount = 0;
+
+static bool samplePending = false;
+static unsigned long lastSampleAt = 0;
+static unsigned long lastFlushAt = 0;
+static bool fileReady = false;
+
+/**
+ * @brief (Static) Returns the current Unix time, or 0 while the clock is not set.
+ */
+static uint32_t nowEpoch() {
+    time_t now = time(nullptr);
+    return now > 1600000000 ? (uint32_t)now : 0;
+}
+
+/**
+ * @brief (Static) Reads the bucket stored in the slot for a given start time.
+ * @return true if the slot holds that very bucket (not an older one).
+ */
+static bool readBucket(File &f, const SignalLevel &lv, uint32_t start, SignalBucket &b) {
+    uint32_t pos = lv.offset + ((start / lv.seconds) % lv.slots) * sizeof(SignalBucket);
+    if (!f.seek(pos, SeekSet) || f.read((uint8_t *)&b, sizeof(b)) != sizeof(b)) return false;
+    return b.start == start && b.count > 0;
+}
+
+/**
+ * @brief (Static) Writes a bucket into its slot of a level.
+ */
+static void writeBucket(File &f, const SignalLevel &lv, const SignalBucket &b) {
+    if (b.count == 0) return;
+    uint32_t pos = lv.offset + ((b.start / lv.seconds) % lv.slots) * sizeof(SignalBucket);
+    if (f.seek(pos, SeekSet)) f.write((const uint8_t *)&b, sizeof(SignalBucket));
+}
+
+/**
+ * @brief (Static) Finds a bucket that is only in RAM so far (open, or closed and not flushed).
+ */
+static bool findUnflushed(const SignalLevel &lv, uint32_t start, SignalBucket &b) {
+    if (lv.open.start == start && lv.open.count > 0) {
+        b = lv.open;
+        return true;
+    }
+    for (uint8_t i = lv.closedCount; i-- > 0;) { // Newest first: a resumed slot may be closed twice
+        if (lv.closed[i].start == start) {
+            b = lv.closed[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief (Static) Writes the closed and open buckets of every level to flash.
+ * @details Runs every SIGNAL_FLUSH_INTERVAL rather than per sample or per closed
+ *          minute, so the file is written 12 times an hour to limit flash wear.
+ */
+static void flushBuckets() {
+    lastFlushAt = millis();
+    if (!fileReady) return;
+    File f = LittleFS.open(SIGNAL_FILE, "r+");
+    if (!f) return;
+    for (SignalLevel &lv : levels) {
+        for (uint8_t i = 0; i < lv.closedCount; i++) writeBucket(f, lv, lv.closed[i]);
+        lv.closedCount = 0;
+        writeBucket(f, lv, lv.open);
+    }
+    f.close();
+}
+
+/**
+ * @brief (Static) Adds a sample to the open bucket of each level.
+ * @details When a sample falls into a new slot the previous bucket is kept in RAM
+ *          until the next flush. A bucket for the current slot that is already on
+ *          flash (e.g., from before a reboot) is resumed rather than overwritten.
+ */
+static void aggregateSample(uint32_t epoch, int8_t dbm) {
+    if (!fileReady) return;
+    File f; // Only opened, read-only, when a slot changes
+    for (SignalLevel &lv : levels) {
+        uint32_t start = epoch - epoch % lv.seconds;
+        if (lv.open.start != start) {
+            if (lv.open.count > 0) {
+                if (lv.closedCount == SIGNAL_CLOSED_BUCKETS) {
+                    if (f) f.close();
+                    flushBuckets(); // Only after a clock jump; the timer normally flushes first
+                }
+                lv.closed[lv.closedCount++] = lv.open;
+            }
+            if (!f) f = LittleFS.open(SIGNAL_FILE, "r");
+            SignalBucket stored;
+            if (findUnflushed(lv, start, stored) || (f && readBucket(f, lv, start, stored))) {
+                lv.open = stored;
+                lv.openSum = (int32_t)stored.avgDbm * stored.count;
+            } else {
+                memset(&lv.open, 0, sizeof(lv.open));
+                lv.open.start = start;
+                lv.open.minDbm = dbm;
+                lv.open.maxDbm = dbm;
+                lv.openSum = 0;
+            }
+        }
+        SignalBucket &b = lv.open;
+        b.minDbm = std::min(b.minDbm, dbm);
+        b.maxDbm = std::max(b.maxDbm, dbm);
+        if (b.count < UINT16_MAX) {
+            b.count++;
+            lv.openSum += dbm;
+        }
+        b.avgDbm = (int8_t)(lv.openSum / (int32_t)b.count);
+    }
+    if (f) f.close();
+}
+
+/**
+ * @brief Opens the history file, creating or resetting it if its layout changed.
+ */
+void initSignalHistory() {
+    uint32_t offset = sizeof(SignalFileHeader);
+    for (SignalLevel &lv : levels) {
+        lv.offset = offset;
+        offset += lv.slots * sizeof(SignalBucket);
+    }
+
+    SignalFileHeader expected = {SIGNAL_FILE_MAGIC, SIGNAL_FILE_VERSION, SIGNAL_MINUTE_SLOTS,
+                                 SIGNAL_HOUR_SLOTS, SIGNAL_DAY_SLOTS, 0};
+    SignalFileHeader h;
+    File f = LittleFS.open(SIGNAL_FILE, "r");
+    bool valid = f && f.read((uint8_t *)&h, sizeof(h)) == sizeof(h) &&
+                 memcmp(&h, &expected, sizeof(h)) == 0 && f.size() == offset;
+    if (f) f.close();
+
+    if (!valid) {
+        LOG_I("Signal: Creating history file.");
+        f = LittleFS.open(SIGNAL_FILE, "w");
+        if (!f) return;
+        f.write((const uint8_t *)&expected, sizeof(expected));
+        SignalBucket empty = {};
+        for (uint32_t pos = sizeof(expected); pos < offset; pos += sizeof(empty))
+            f.write((const uint8_t *)&empty, sizeof(empty));
+        f.close();
+    }
+    fileReady = true;
+}
+
+/**
+ * @brief Main-loop driver: issues an AT+CSQ sample when due and the modem is idle,
+ *        and periodically flushes the open buckets.
+ */
+void handleSignalHistory() {
+    if (samplePending && millis() - lastSampleAt > SIGNAL_SAMPLE_TIMEOUT) {
+        LOG_W("Signal: AT+CSQ timed out.");
+        samplePending = false;
+        modemCommandTimedOut();
+    }
+    if (!samplePending && modems[PRIMARY_MODEM].simPinOk && millis() - lastSampleAt >= SIGNAL_SAMPLE_INTERVAL && modemIdle()) {
+        sim900.println(F("AT+CSQ"));
+        samplePending = true;
+        lastSampleAt = millis();
+    }
+    if (millis() - lastFlushAt >= SIGNAL_FLUSH_INTERVAL)
+        flushBuckets();
+}
+
+/**
+ * @brief Returns true while an AT+CSQ sample is waiting for its answer.
+ */
+bool signalSamplePending() {
+    return samplePending;
+}
+
+/**
+ * @brief Handles a response line for the pending AT+CSQ sample.
+ * @param line The received line (+CSQ: <rssi>,<ber>, OK or ERROR).
+ */
+void handleSignalLine(const String &line) {
+    AtTokenizer tok(line);
+    if (tok.prefix("+CSQ:")) {
+        long rssi;
+        if (!tok.nextInt(rssi) || rssi < 0 || rssi > 31) return; // 99 = not known or not detectable
+        int8_t dbm = -113 + 2 * rssi;
+        modems[PRIMARY_MODEM].signalQuality = String(dbm) + " dBm";
+
+        ring[ringHead].at = millis();
+        ring[ringHead].dbm = dbm;
+        ringHead = (ringHead + 1) % SIGNAL_RING_SIZE;
+        if (ringCount < SIGNAL_RING_SIZE) ringCount++;
+
+        uint32_t epoch = nowEpoch();
+        if (epoch) aggregateSample(epoch, dbm);
+        return;
+    }
+    if (line.startsWith("OK") || line.indexOf("ERROR") != -1)
+        samplePending = false;
+}
+
+/**
+ * @brief Serves GET /api/signal?range=live|1h|24h|7d|90d[&end=<unix time>].
+ * @details 'live' returns the raw samples in RAM as [seconds ago, dBm] pairs; the
+ *          other ranges return [start, min, avg, max] buckets from the history file
+ *          (1h at minute, 24h and 7d at hour, 90d at day resolution). 'end' selects
+ *          an earlier window, e.g. to page back through the minute history.
+ * @param request The incoming HTTP request.
+ */
+void handleSignalQuery(AsyncWebServerRequest *request) {
+    String range = request->hasParam("range") ? request->getParam("range")->value() : String("1h");
+    String out;
+
+    if (range == "live") {
+        out.reserve(32 + ringCount * 12);
+        out = "{\"range\":\"live\",\"samples\":[";
+        for (uint8_t i = 0; i < ringCount; i++) {
+            const SignalSample &s = ring[(ringHead + SIGNAL_RING_SIZE - ringCount + i) % SIGNAL_RING_SIZE];
+            if (i) out += ',';
+            out += "[" + String((millis() - s.at) / 1000) + "," + String(s.dbm) + "]";
+        }
+        out += "]}";
+        request->send(200, "application/json", out);
+        return;
+    }
+
+    int li;
+    uint32_t count;
+    if (range == "24h") { li = 1; count = 24; }
+    else if (range == "7d") { li = 1; count = 168; }
+    else if (range == "90d") { li = 2; count = 90; }
+    else { range = "1h"; li = 0; count = 60; }
+    SignalLevel &lv = levels[li];
+    count = std::min(count, (uint32_t)lv.slots);
+
+    out.reserve(48 + count * 28);
+    out = "{\"range\":\"" + range + "\",\"resolution\":" + String(lv.seconds) + ",\"buckets\":[";
+    uint32_t now = nowEpoch();
+    if (now && request->hasParam("end"))
+        now = std::min(now, (uint32_t)request->getParam("end")->value().toInt());
+    File f = fileReady && now ? LittleFS.open(SIGNAL_FILE, "r") : File();
+    if (f) {
+        bool first = true;
+        uint32_t newest = now - now % lv.seconds;
+        for (uint32_t i = count; i-- > 0;) {
+            uint32_t start = newest - i * lv.seconds;
+            SignalBucket b;
+            if (!findUnflushed(lv, start, b) && !readBucket(f, lv, start, b)) continue;
+            if (!first) out += ',';
+            first = false;
+            out += "[" + String(b.start) + "," + String(b.minDbm) + "," + String(b.avgDbm) + "," + String(b.maxDbm) + "]";
+        }
+        f.close();
+    }
+    out += "]}";
+    request->send(200, "application/json", out);
+}
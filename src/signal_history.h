@@ -0,0 +1,36 @@
+/**
+ * @file    signal_history.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Function prototypes for the signal quality history.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares the periodic AT+CSQ sampler, its RAM ring of recent samples
+ *              and the min/avg/max roll-ups kept on LittleFS at minute, hour and
+ *              day resolution.
+ */
+
+
+/**
+ * @file signal_history.h
+ * @brief Function prototypes for the signal quality history.
+ */
+
+#ifndef SIGNAL_HISTORY_H
+#define SIGNAL_HISTORY_H
+
+#include <Arduino.h>
+
+// Forward declaration to avoid circular dependencies
+class AsyncWebServerRequest;
+
+void initSignalHistory();
+void handleSignalHistory();
+bool signalSamplePending();
+void handleSignalLine(const String &line);
+void handleSignalQuery(AsyncWebServerRequest *request);
+
+#endif // SIGNAL_HISTORY_H
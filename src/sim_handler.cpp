@@ -24,95 +24,126 @@
 
 #include "config.h"
 #include "sim_handler.h"
+#include "logger.h"
+#include "json_arena.h"
+#include "at_tokenizer.h"
 #include "web_server.h" // Needed for notifyClients
+#include "delivery_reports.h"
+#include "sms_scheduler.h"
+#include "sms_archive.h"
+#include "sms_dedup.h"
+#include "sms_rules.h"
+#include "ussd_session.h"
+#include "modem_state.h"
+#include "signal_history.h"
+#include "modem_health.h"
 
 // --- Forward declaration of functions used only within this file ---
-static void handleSmsListLine(const String &line);
-static void handleSmsSendLine(const String &line);
 static String createPDU(const String &number, const String &message);
+static int parseCmsError(const String &line);
+static long parseCregStat(const String &line);
+static const __FlashStringHelper *registrationText(long stat);
 
 
 /**
- * @brief Initializes the SIM module with basic AT commands.
+ * @brief Initializes the modem and its SIM with basic AT commands.
  */
-void initializeSIM()
+void Modem::initialize()
 {
-    Serial.println("Init SIM...");
-    sendATCommand("AT", 1000, "OK", true);
-    sendATCommand("ATE0", 1000, "OK", true);
-    sendATCommand("AT+CLIP=1", 1000, "OK", true);
-    sendATCommand("AT+CMGF=1", 1000, "OK", true);
+    LOG_I("Init SIM %u...", id_);
+    sendATCommand(F("AT"), 1000, "OK", true);
+    sendATCommand(F("ATE0"), 1000, "OK", true);
+    sendATCommand(F("AT+CLIP=1"), 1000, "OK", true);
+    sendATCommand(F("AT+CMEE=1"), 1000, "OK", true); // Numeric +CMS/+CME error codes
+    sendATCommand(F("AT+CREG=2"), 1000, "OK", true); // Registration changes as +CREG URCs
+    setModemRegister(MODEM_REG_CMGF, "1", id_);
+    setModemRegister(MODEM_REG_CSMP, "49,167,0,0", id_);  // Text-mode SUBMIT with status report request
+    setModemRegister(MODEM_REG_CNMI, "2,1,0,1,0", id_);  // +CMTI for new SMS, +CDS for status reports
+    setModemRegister(MODEM_REG_CPMS, "\"SM\",\"SM\",\"SM\"", id_); // The archive sweeps SIM storage
     if (!checkSimPin())
-        Serial.println("SIM init incomplete. Status:" + simStatus);
+        LOG_W("SIM %u init incomplete. Status: %s", id_, simStatus.c_str());
     else
-        Serial.println("SIM Init Ready.");
+    {
+        LOG_I("SIM %u Init Ready.", id_);
+        // The scheduler only sends on registered modems; later changes arrive as URCs
+        String r = sendATCommand(F("AT+CREG?"), 1000, "+CREG:", true);
+        if (r.startsWith("+CREG:"))
+            handleRegistrationUrc(*this, r);
+        requestSimSweep(id_); // Move anything already stored on the SIM into the archive
+    }
 }
 
 /**
  * @brief Checks the SIM card's PIN status and attempts to unlock it if a PIN is saved.
  * @return true if the SIM is ready to use, false otherwise.
  */
-bool checkSimPin()
+bool Modem::checkSimPin()
 {
-    String r = sendATCommand("AT+CPIN?", 8000, "+CPIN:", true);
+    String r = sendATCommand(F("AT+CPIN?"), 8000, "+CPIN:", true);
     if (r.startsWith("+CPIN: READY"))
     {
-        Serial.println("SIM Ready.");
+        LOG_I("SIM Ready.");
         simRequiresPin = false;
         simPinOk = true;
         return true;
     }
     else if (r.startsWith("+CPIN: SIM PIN"))
     {
-        Serial.println("SIM PIN needed.");
+        LOG_I("SIM PIN needed.");
         simRequiresPin = true;
         simPinOk = false;
         if (strlen(config.sim_pin) > 0)
         {
-            Serial.println("Try saved PIN...");
+            LOG_I("Try saved PIN...");
             String pc = "AT+CPIN=" + String(config.sim_pin);
             r = sendATCommand(pc, 5000, "OK", true);
             if (r.startsWith("OK"))
             {
-                Serial.println("PIN OK!");
+                LOG_I("PIN OK!");
                 simPinOk = true;
-                delay(3000);
-                r = sendATCommand("AT+CPIN?", 3000, "+CPIN:", true);
+                // Poll until the SIM reports READY instead of waiting a fixed time
+                unsigned long waitStart = millis();
+                r = sendATCommand(F("AT+CPIN?"), 1000, "+CPIN:", true);
+                while (!r.startsWith("+CPIN: READY") && millis() - waitStart < 5000)
+                {
+                    delay(100);
+                    r = sendATCommand(F("AT+CPIN?"), 1000, "+CPIN:", true);
+                }
                 simRequiresPin = false;
                 return true;
             }
             else
             {
-                Serial.println("PIN Rejected/Err!");
+                LOG_W("PIN Rejected/Err!");
                 simPinOk = false;
                 return false;
             }
         }
         else
         {
-            Serial.println("No PIN saved.");
+            LOG_I("No PIN saved.");
             return false;
         }
     }
     else if (r.startsWith("+CPIN: SIM PUK"))
     {
-        Serial.println("PUK needed! Blocked.");
+        LOG_W("PUK needed! Blocked.");
         simRequiresPin = true;
         simPinOk = false;
-        simStatus = "PUK Required";
+        simStatus = F("PUK Required");
         return false;
     }
     else if (r.indexOf("SIM not inserted") != -1)
     {
-        Serial.println("No SIM.");
+        LOG_W("No SIM.");
         simRequiresPin = false;
         simPinOk = false;
-        simStatus = "SIM Not Inserted";
+        simStatus = F("SIM Not Inserted");
         return false;
     }
     else
     {
-        Serial.println("Unk PIN status/Err. Resp:" + r);
+        LOG_W("Unk PIN status/Err. Resp: %s", r.c_str());
         simRequiresPin = false;
         simPinOk = false;
         return false;
@@ -127,28 +158,33 @@ bool checkSimPin()
  * @param silent If true, does not print the command to the Serial monitor.
  * @return The relevant response line from the module, or "TIMEOUT".
  */
-String sendATCommand(const String &cmd, unsigned long timeout, const char *expectedResponsePrefix, bool silent)
+String Modem::sendATCommand(const String &cmd, unsigned long timeout, const char *expectedResponsePrefix, bool silent)
 {
-    while (sim900.available() > 0)
+    if (id_ == PRIMARY_MODEM && modemRecovering())
+        return "TIMEOUT"; // Don't block the loop on a hung modem
+    while (serial_.available() > 0)
     {
-        sim900.read();
+        serial_.read();
         yield();
     }
     if (!silent)
     {
-        Serial.print("SIM TX: ");
-        Serial.println(cmd);
+        LOG_D("SIM TX[%u]: %s", id_, cmd.c_str());
     }
-    sim900.println(cmd);
+    serial_.println(cmd);
     unsigned long startWait = millis();
     String responseBuffer = "";
     String relevantLine = "";
     bool commandFinished = false;
     while (millis() - startWait < timeout)
     {
-        while (sim900.available() > 0)
+        while (serial_.available() > 0)
         {
-            char c = sim900.read();
+            char c = serial_.read();
+#ifdef MODEM_HANG_SIMULATION
+            if (id_ == PRIMARY_MODEM && modemHangSimulated())
+                continue;
+#endif
             if (isPrintable(c) || c == '\r' || c == '\n')
                 responseBuffer += c;
         }
@@ -160,6 +196,7 @@ String sendATCommand(const String &cmd, unsigned long timeout, const char *expec
             line.trim();
             if (line.length() > 0)
             {
+                responseReceived();
                 if (expectedResponsePrefix && line.startsWith(expectedResponsePrefix))
                 {
                     relevantLine = line;
@@ -190,230 +227,298 @@ end_wait_buffered:
     if (!commandFinished)
     {
         relevantLine = "TIMEOUT";
+        commandTimedOut();
     }
     return relevantLine;
 }
 
 /**
- * @brief Handles all incoming serial data from the SIM900 module.
+ * @brief Handles all incoming serial data from the modem.
  * @details This is a critical function that acts as a dispatcher. It parses each line,
  *          determines if it's an Unsolicited Result Code (URC) or a response to a command,
  *          and calls the appropriate handler.
  */
-void handleSimData()
+void Modem::handleData()
 {
+    // Re-initialize a modem that restarted on its own (the watchdog handles the primary)
+    if (reinitRequested_ && idle())
+    {
+        reinitRequested_ = false;
+        initialize();
+        statusRefreshRequested_ = true;
+    }
+
+    // Re-read operator and signal after a registration change, once the modem is free
+    if (statusRefreshRequested_ && idle())
+    {
+        statusRefreshRequested_ = false;
+        updateStatus();
+        notifyStatus();
+    }
+
+    // A silent secondary modem is probed until it answers again; any line counts
+    if (id_ != PRIMARY_MODEM && !healthy() && idle() && millis() - lastProbe_ >= MODEM_LIVENESS_INTERVAL)
+    {
+        lastProbe_ = millis();
+        serial_.println(F("AT"));
+    }
+
     // Check for timeouts in state machines first
-    if (smsListState == SMS_LIST_RUNNING && millis() - smsListStartTime > 20000)
+    if (smsListState_ == SMS_LIST_RUNNING && millis() - smsListStartTime_ > 20000)
     {
-        Serial.println("ERROR: Timed out waiting for SMS list 'OK'.");
-        notifyClients("sms_list_finished", "{\"status\":\"timeout\"}");
-        smsListState = SMS_LIST_IDLE;
+        LOG_E("Timed out waiting for SMS list 'OK' (modem %u).", id_);
+        smsListState_ = SMS_LIST_IDLE;
+        commandTimedOut();
     }
-    if (smsSendState != SMS_SEND_IDLE && millis() - smsSendStartTime > 30000)
+    if (smsSendState_ != SMS_SEND_IDLE && millis() - smsSendStartTime_ > 30000)
     {
-        Serial.println("ERROR: Timed out while sending SMS.");
-        notifyClients("sms_sent", "{\"status\":\"ERROR\",\"message\":\"TIMEOUT\"}");
-        smsSendState = SMS_SEND_IDLE;
+        LOG_E("Timed out while sending SMS (modem %u).", id_);
+        commandTimedOut();
+        // Nothing was submitted before the final stage, so the job can safely run again
+        if (smsSendState_ != SMS_SEND_WAITING_FINAL_OK && smsSchedulerRequeue(id_))
+            LOG_I("SMS re-queued until a modem answers again.");
+        else
+            notifySmsSent("ERROR", "timeout");
+        smsSendState_ = SMS_SEND_IDLE;
     }
 
     // Now, process incoming data from the modem
-    while (sim900.available() > 0)
+    while (serial_.available() > 0)
     {
-        char c = sim900.read();
+        char c = serial_.read();
+#ifdef MODEM_HANG_SIMULATION
+        if (id_ == PRIMARY_MODEM && modemHangSimulated())
+            continue;
+#endif
 
         // Special case for SMS prompt
-        if (c == '>' && smsSendState == SMS_SEND_WAITING_PROMPT)
+        if (c == '>' && smsSendState_ == SMS_SEND_WAITING_PROMPT)
         {
-            Serial.println("SIM RX: > (Prompt)");
-            smsSendStartTime = millis();
+            LOG_D("SIM RX[%u]: > (Prompt)", id_);
+            smsSendStartTime_ = millis();
 
-            if (smsIsUnicode)
+            if (smsIsUnicode_)
             {
-                String pdu = createPDU(smsNumberToSend, smsMessageToSend);
-                sim900.print(pdu);
-                Serial.println("INFO: Sending PDU for Unicode text: " + pdu);
+                String pdu = createPDU(smsNumberToSend_, smsMessageToSend_);
+                serial_.print(pdu);
+                LOG_D("Sending PDU for Unicode text: %s", pdu.c_str());
             }
             else
             {
-                sim900.print(smsMessageToSend);
-                Serial.println("INFO: Sending plain text: " + smsMessageToSend);
+                serial_.print(smsMessageToSend_);
+                LOG_D("Sending plain text: %s", smsMessageToSend_.c_str());
             }
 
             delay(100);
-            sim900.write(26); // Ctrl+Z
-            Serial.println("INFO: Message content sent. Awaiting final confirmation.");
-            smsSendState = SMS_SEND_WAITING_FINAL_OK;
+            serial_.write(26); // Ctrl+Z
+            LOG_I("Message content sent. Awaiting final confirmation.");
+            smsSendState_ = SMS_SEND_WAITING_FINAL_OK;
             return; // Exit immediately to avoid processing '>' as part of a line
         }
 
         // Process full lines ending with newline
         if (c == '\n')
         {
-            simResponseBuffer.trim();
-            if (simResponseBuffer.length() > 0)
+            responseBuffer_.trim();
+            if (responseBuffer_.length() > 0)
+                responseReceived();
+            if (responseBuffer_.length() > 0 && consumeDeliveryPduLine(id_, responseBuffer_))
+            {
+                // The line was the PDU body of a preceding "+CDS: <length>" report
+            }
+            else if (responseBuffer_.length() > 0)
             {
                 // --- INTELLIGENT DISPATCHER LOGIC ---
-                bool isUrc = simResponseBuffer.startsWith("+CMTI:") ||
-                             simResponseBuffer.startsWith("+CUSD:") ||
-                             simResponseBuffer.startsWith("RING") ||
-                             simResponseBuffer.startsWith("+CLIP:") ||
-                             simResponseBuffer.startsWith("NO CARRIER");
-
-                if (isUrc)
+                if (dispatchUrc(*this, responseBuffer_))
                 {
-                    Serial.print("URC RX: ");
-                    Serial.println(simResponseBuffer);
-                    JsonDocument dataDoc;
-
-                    if (simResponseBuffer.startsWith("+CMTI:"))
-                    {
-                        int c1 = simResponseBuffer.indexOf(',');
-                        if (c1 != -1)
-                        {
-                            int i = simResponseBuffer.substring(c1 + 1).toInt();
-                            if (i > 0)
-                            {
-                                dataDoc.clear();
-                                dataDoc["index"] = i;
-                                String s;
-                                serializeJson(dataDoc, s);
-                                notifyClients("sms_received_indication", s);
-                            }
-                        }
-                    }
-                    else if (simResponseBuffer.startsWith("+CUSD:"))
-                    {
-                        String raw = simResponseBuffer;
-                        int colonPos = raw.indexOf(':');
-                        int firstComma = raw.indexOf(',', colonPos + 1);
-                        String ussdMsg = "";
-                        int responseType = -1;
-                        int dcs = -1;
-
-                        if (colonPos != -1)
-                        {
-                            String typeStr = (firstComma != -1) ? raw.substring(colonPos + 1, firstComma) : raw.substring(colonPos + 1);
-                            typeStr.trim();
-                            if (typeStr.length())
-                                responseType = typeStr.toInt();
-
-                            if (firstComma != -1)
-                            {
-                                int quoteStart = raw.indexOf('"', firstComma);
-                                int quoteEnd = (quoteStart != -1) ? raw.indexOf('"', quoteStart + 1) : -1;
-                                if (quoteStart != -1 && quoteEnd != -1)
-                                {
-                                    ussdMsg = raw.substring(quoteStart + 1, quoteEnd);
-                                }
-                                else
-                                {
-                                    int lastComma = raw.lastIndexOf(',');
-                                    ussdMsg = (lastComma > firstComma) ? raw.substring(firstComma + 1, lastComma) : raw.substring(firstComma + 1);
-                                }
-                                ussdMsg.trim();
-
-                                int lastComma = raw.lastIndexOf(',');
-                                if (lastComma > firstComma)
-                                {
-                                    String dcsStr = raw.substring(lastComma + 1);
-                                    dcsStr.trim();
-                                    if (dcsStr.length())
-                                        dcs = dcsStr.toInt();
-                                }
-                            }
-                        }
-
-                        String decoded = decodeUcs2(ussdMsg);
-                        if (decoded != ussdMsg)
-                        {
-                            ussdMsg = decoded;
-                        }
-
-                        dataDoc.clear();
-                        dataDoc["type"] = responseType;
-                        dataDoc["message"] = ussdMsg;
-                        if (dcs != -1)
-                            dataDoc["dcs"] = dcs;
-                        String out;
-                        serializeJson(dataDoc, out);
-                        notifyClients("ussd_response", out);
-                    }
-                    else if (simResponseBuffer.startsWith("RING"))
-                    {
-                        notifyClients("call_incoming", "RING");
-                    }
-                    else if (simResponseBuffer.startsWith("NO CARRIER"))
-                    {
-                        notifyClients("call_status", "NO CARRIER");
-                    }
-                    else if (simResponseBuffer.startsWith("+CLIP:"))
-                    {
-                        int q1 = simResponseBuffer.indexOf('"');
-                        int q2 = simResponseBuffer.indexOf('"', q1 + 1);
-                        if (q1 != -1 && q2 != -1)
-                        {
-                            String cid = simResponseBuffer.substring(q1 + 1, q2);
-                            dataDoc.clear();
-                            dataDoc["caller_id"] = cid;
-                            String s;
-                            serializeJson(dataDoc, s);
-                            notifyClients("caller_id", s);
-                        }
-                    }
+                    // A URC, handled by the module registered for its prefix (urc_dispatch.cpp)
                 }
                 // If it's NOT a URC, then it must be a response to a command
-                else if (smsListState == SMS_LIST_RUNNING)
+                else if (id_ == PRIMARY_MODEM && modemProbePending())
+                {
+                    handleModemProbeLine(responseBuffer_);
+                }
+                else if (smsListState_ == SMS_LIST_RUNNING)
                 {
-                    handleSmsListLine(simResponseBuffer);
+                    handleSmsListLine(responseBuffer_);
                 }
-                else if (smsSendState != SMS_SEND_IDLE)
+                else if (smsSendState_ != SMS_SEND_IDLE)
                 {
-                    handleSmsSendLine(simResponseBuffer);
+                    handleSmsSendLine(responseBuffer_);
+                }
+                else if (id_ == PRIMARY_MODEM && ussdCommandPending())
+                {
+                    handleUssdLine(responseBuffer_);
+                }
+                else if (id_ == PRIMARY_MODEM && signalSamplePending())
+                {
+                    handleSignalLine(responseBuffer_);
                 }
                 else
                 {
                     // It's a normal, non-URC response
-                    Serial.print("GENERIC RX: ");
-                    Serial.println(simResponseBuffer);
+                    LOG_D("GENERIC RX[%u]: %s", id_, responseBuffer_.c_str());
                 }
             }
-            simResponseBuffer = ""; // Reset buffer for the next line
+            responseBuffer_ = ""; // Reset buffer for the next line
         }
         else if (c != '\r')
         {
-            simResponseBuffer += c;
+            responseBuffer_ += c;
         }
     }
 }
 
 /**
- * @brief Sends an SMS message. Switches between Text and PDU mode automatically for Unicode.
+ * @brief Returns true if no state machine is waiting for a response of this modem and
+ *        it is not being recovered, so a new command (blocking or not) may be sent.
+ */
+bool Modem::idle() const
+{
+    if (smsListState_ != SMS_LIST_IDLE || smsSendState_ != SMS_SEND_IDLE)
+        return false;
+    if (id_ != PRIMARY_MODEM)
+        return true;
+    return !ussdCommandPending() && !signalSamplePending() &&
+           !modemProbePending() && !modemRecovering();
+}
+
+/**
+ * @brief Returns true if the modem answers commands.
+ * @details The primary modem is judged by the health watchdog; the others count as
+ *          unhealthy after MODEM_MAX_TIMEOUTS commands in a row went unanswered.
+ */
+bool Modem::healthy() const
+{
+    if (id_ == PRIMARY_MODEM)
+        return !modemRecovering();
+    return timeouts_ < MODEM_MAX_TIMEOUTS;
+}
+
+/**
+ * @brief Returns true if the modem can take an outbound SMS: it is healthy, its SIM is
+ *        unlocked and it is registered (home or roaming).
+ */
+bool Modem::ready() const
+{
+    return healthy() && simPinOk && simStatus.startsWith("Registered");
+}
+
+/**
+ * @brief Notes an answer from the modem.
+ */
+void Modem::responseReceived()
+{
+    timeouts_ = 0;
+    if (id_ == PRIMARY_MODEM)
+        modemResponseReceived();
+}
+
+/**
+ * @brief Notes a command the modem did not answer in time.
+ */
+void Modem::commandTimedOut()
+{
+    if (timeouts_ < 255)
+        timeouts_++;
+    if (id_ == PRIMARY_MODEM)
+        modemCommandTimedOut();
+}
+
+/**
+ * @brief Adds the modem's status to a JSON object (one entry of the status 'modems' list).
+ */
+void Modem::statusToJson(JsonObject obj) const
+{
+    obj["id"] = id_;
+    obj["sim_status"] = simStatus;
+    obj["signal_quality"] = signalQuality;
+    obj["network_operator"] = networkOperator;
+    obj["ready"] = ready();
+    obj["busy"] = smsSendState_ != SMS_SEND_IDLE;
+}
+
+/**
+ * @brief Initializes every modem.
+ */
+void initializeSIM()
+{
+    for (Modem &modem : modems)
+        modem.initialize();
+}
+
+/**
+ * @brief Asks every modem to re-poll its status once it is idle.
+ * @details The poll is blocking and drains the serial buffer, so it must not run
+ *          while a sweep, send, USSD or probe is waiting for its answer; each modem
+ *          runs it from handleData() and broadcasts the new status afterwards.
+ */
+void requestStatusRefresh()
+{
+    for (Modem &modem : modems)
+        modem.requestStatusRefresh();
+}
+
+/**
+ * @brief Main-loop driver: handles the incoming data and state machines of every modem.
+ */
+void handleSimData()
+{
+    for (Modem &modem : modems)
+        modem.handleData();
+}
+
+/**
+ * @brief Returns true if the primary modem is idle (see Modem::idle()).
+ * @details USSD, the signal sampler and the watchdog use the primary modem only.
+ */
+bool modemIdle()
+{
+    return modems[PRIMARY_MODEM].idle();
+}
+
+/**
+ * @brief Queues an SMS message for sending. The send scheduler releases it to the
+ *        modem as soon as the rate limits allow.
  * @param number The destination phone number.
  * @param message The message content.
  */
 void sendSMS(const String &number, const String &message)
 {
-    if (smsListState != SMS_LIST_IDLE || smsSendState != SMS_SEND_IDLE)
+    if (message.length() == 0)
     {
-        notifyClients("error", "System is busy, please try again.");
+        notifyClients("error", "empty_message");
         return;
     }
 
-    if (message.length() == 0)
+    if (enqueueSms(number, message) == 0)
     {
-        notifyClients("error", "Empty message");
-        return;
+        notifyClients("error", "sms_queue_full");
     }
+}
+
+/**
+ * @brief Starts sending a queued SMS. Switches between Text and PDU mode automatically for Unicode.
+ * @details Called by the send scheduler once the modem is idle and ready.
+ * @param jobId The scheduler's job id for this message.
+ * @param number The destination phone number.
+ * @param message The message content.
+ */
+void Modem::startSmsJob(uint32_t jobId, const String &number, const String &message)
+{
+    smsJobId_ = jobId;
+    smsMessageRef_ = -1;
+    smsCmsError_ = -1;
 
     if (!simPinOk)
     {
-        notifyClients("sms_sent", R"({"status":"ERROR","message":"SIM not ready","ar_message":"الشريحة غير جاهزة"})");
+        notifySmsSent("ERROR", "sim_not_ready");
         return;
     }
 
-    smsNumberToSend = number;
-    smsMessageToSend = message;
-    smsIsUnicode = false;
+    smsNumberToSend_ = number;
+    smsMessageToSend_ = message;
+    smsIsUnicode_ = false;
 
     // Check for non-ASCII characters
     for (unsigned int i = 0; i < message.length(); i++)
@@ -421,177 +526,89 @@ void sendSMS(const String &number, const String &message)
         unsigned char c = (unsigned char)message[i];
         if (c > 127)
         {
-            smsIsUnicode = true;
-            Serial.println("INFO: Unicode text detected - will use PDU mode.");
+            smsIsUnicode_ = true;
+            LOG_I("Unicode text detected - will use PDU mode.");
             break;
         }
     }
 
     // Clear pending serial data
-    while (sim900.available() > 0)
+    while (serial_.available() > 0)
     {
-        sim900.read();
+        serial_.read();
         yield();
     }
 
-    smsSendState = SMS_SEND_SETTING_CHARSET;
-    smsSendStartTime = millis();
+    smsSendStartTime_ = millis();
 
-    if (smsIsUnicode)
+    if (modemRegisterIs(MODEM_REG_CMGF, smsIsUnicode_ ? "0" : "1", id_))
     {
-        Serial.println("INFO: Setting PDU mode for Unicode text.");
-        sim900.println("AT+CMGF=0"); // PDU mode
-    }
-    else
-    {
-        Serial.println("INFO: Setting Text mode for plain text.");
-        sim900.println("AT+CMGF=1"); // Text mode
+        sendCmgsCommand(); // Already in the right message format
+        return;
     }
-}
-
-/**
- * @brief Sends a USSD code.
- * @param code The USSD code to send (e.g., "*100#").
- */
-void sendUSSD(const String &code)
-{
-    notifyClients("ussd_response", "{\"type\":-1,\"message\":\"Sending USSD...\"}");
-    // Switch the modem character set to GSM, wait for the OK synchronously (handled by sendATCommand)
-    sendATCommand("AT+CSCS=\"GSM\"", 1500, "OK", false);
-    // IMPORTANT: never use delay() inside callbacks (e.g., HTTP/WS handlers) on ESPAsyncWebServer,
-    // it can lead to watchdog resets and Exception(9) crashes. The call above already waits
-    // synchronously for the modem response, so an extra delay isn’t necessary.
-    delay(100);
-    sim900.println("AT+CUSD=1,\"" + code + "\",15");
-}
-
-/**
- * @brief Sends a reply to an interactive USSD session.
- * @param reply The reply string.
- */
-void sendUSSDReply(const String &reply)
-{
-    // Same rationale as sendUSSD(): avoid delay() inside potential web-server callbacks.
-    sendATCommand("AT+CSCS=\"GSM\"", 1500, "OK", false);
-    delay(100);
-    sim900.println("AT+CUSD=1,\"" + reply + "\",15");
-}
 
-/**
- * @brief Reads a specific SMS message from storage.
- * @param index The storage index of the SMS to read.
- */
-void readSMS(int index)
-{
-    if (index <= 0)
-        return;
-    String cmd = "AT+CMGR=" + String(index);
-    while (sim900.available())
-        sim900.read();
-    sim900.println(cmd);
-    String header = "", body = "";
-    bool headerFound = false;
-    unsigned long startTime = millis();
-    while (millis() - startTime < 5000)
-    {
-        if (sim900.available())
-        {
-            String line = sim900.readStringUntil('\n');
-            line.trim();
-            if (line.length() == 0)
-                continue;
-            if (line.startsWith("+CMGR:"))
-            {
-                headerFound = true;
-                header = line;
-            }
-            else if (headerFound && !line.startsWith("OK"))
-            {
-                body += line;
-            }
-            else if (line.startsWith("OK"))
-                break;
-            else if (line.indexOf("ERROR") != -1)
-            {
-                headerFound = false;
-                break;
-            }
-        }
-        yield();
+    smsSendState_ = SMS_SEND_SETTING_CHARSET;
+    if (smsIsUnicode_)
+    {
+        LOG_I("Setting PDU mode for Unicode text (modem %u).", id_);
+        serial_.println(F("AT+CMGF=0")); // PDU mode
     }
-    if (!headerFound)
+    else
     {
-        notifyClients("sms_content", "{\"error\":\"Failed to read SMS\"}");
-        return;
+        LOG_I("Setting Text mode for plain text (modem %u).", id_);
+        serial_.println(F("AT+CMGF=1")); // Text mode
     }
-    JsonDocument doc;
-    doc["index"] = index;
-    body.trim();
-    String decodedBody = decodeUcs2(body);
-    doc["body"] = decodedBody;
-    if (decodedBody != body)
-        doc["body_hex"] = body;
-    String jsonOutput;
-    serializeJson(doc, jsonOutput);
-    notifyClients("sms_content", jsonOutput);
-}
-
-/**
- * @brief Deletes a specific SMS message from storage.
- * @param index The storage index of the SMS to delete.
- */
-void deleteSMS(int index)
-{
-    if (index <= 0)
-        return;
-    String response = sendATCommand("AT+CMGD=" + String(index), 5000, "OK", false);
-    JsonDocument doc;
-    doc["index"] = index;
-    doc["success"] = response.startsWith("OK");
-    if (!doc["success"])
-        doc["message"] = response;
-    String jsonOutput;
-    serializeJson(doc, jsonOutput);
-    notifyClients("sms_deleted", jsonOutput);
 }
 
 /**
  * @brief Fetches and updates the current network status.
- * @details Updates global variables for SIM status, signal quality, operator, etc.
+ * @details Updates the cached SIM status, signal quality, operator, etc.
  */
-void updateStatus()
+void Modem::updateStatus()
 {
+    if (!healthy())
+        return; // Keep the last known values until the modem answers again
     if (!checkSimPin())
     {
         if (simStatus != "PUK Required" && simStatus != "SIM Not Inserted")
-            simStatus = "SIM Not Ready";
-        signalQuality = "N/A";
-        networkOperator = "N/A";
-        simPhoneNumber = "N/A";
+            simStatus = F("SIM Not Ready");
+        signalQuality = F("N/A");
+        networkOperator = F("N/A");
+        simPhoneNumber = F("N/A");
         return;
     }
-    String copsLine = sendATCommand("AT+COPS?", 8000, "+COPS:", true);
-    if (copsLine.startsWith("+COPS:"))
+    // Same mapping as the +CREG URCs; a missing answer keeps the last known state
+    long stat = parseCregStat(sendATCommand(F("AT+CREG?"), 1000, "+CREG:", true));
+    if (stat >= 0)
+        simStatus = registrationText(stat);
+    if (!simStatus.startsWith("Registered"))
     {
-        int q1 = copsLine.indexOf('"');
-        int q2 = copsLine.indexOf('"', q1 + 1);
-        if (q1 != -1 && q2 != -1)
-            networkOperator = copsLine.substring(q1 + 1, q2);
+        networkOperator = F("N/A");
+        signalQuality = F("N/A");
+        return;
     }
-    String csqLine = sendATCommand("AT+CSQ", 3000, "+CSQ:", true);
-    if (csqLine.startsWith("+CSQ:"))
+    String copsLine = sendATCommand(F("AT+COPS?"), 8000, "+COPS:", true);
+    AtTokenizer cops(copsLine);
+    if (cops.prefix("+COPS:"))
     {
-        int cPos = csqLine.indexOf(',');
-        if (cPos != -1)
+        // +COPS: <mode>[,<format>,"<oper>"]
+        AtField oper;
+        if (cops.skip(2) && cops.next(oper) && oper.quoted)
+            networkOperator = oper.toString();
+    }
+    String csqLine = sendATCommand(F("AT+CSQ"), 3000, "+CSQ:", true);
+    AtTokenizer csq(csqLine);
+    if (csq.prefix("+CSQ:"))
+    {
+        long rssi;
+        if (csq.nextInt(rssi))
         {
-            int rssi = csqLine.substring(csqLine.indexOf(':') + 2, cPos).toInt();
             if (rssi >= 0 && rssi <= 31)
                 signalQuality = String(-113 + (2 * rssi)) + " dBm";
             else
-                signalQuality = "N/A";
+                signalQuality = F("N/A");
         }
     }
-    simStatus = (copsLine.startsWith("+COPS:")) ? "Registered" : "Not Registered";
 }
 
 /**
@@ -685,91 +702,118 @@ String encodeUcs2(const String &utf8Str)
         hexStr += hex;
     }
 
-    Serial.println("DEBUG: UTF-8 '" + utf8Str + "' -> UCS2 '" + hexStr + "'");
+    LOG_D("UTF-8 '%s' -> UCS2 '%s'", utf8Str.c_str(), hexStr.c_str());
     return hexStr;
 }
 
 /**
- * @brief Starts the non-blocking process of retrieving the list of all SMS messages.
+ * @brief Starts the non-blocking sweep that moves all SMS from SIM storage into the archive.
+ * @details Each listed message is archived and its SIM slot queued for deletion.
+ *          Must be called from the main loop (not from a web callback), since it sets
+ *          text mode with the blocking sendATCommand().
  */
-void startGetSmsList()
+void Modem::startSimSweep()
 {
-    if (smsListState != SMS_LIST_IDLE)
+    if (smsListState_ != SMS_LIST_IDLE)
     {
-        Serial.println("WARN: getSMSList already running.");
+        LOG_W("SIM sweep already running (modem %u).", id_);
         return;
     }
-    Serial.println("INFO: Starting non-blocking SMS list retrieval.");
-    while (sim900.available())
-        sim900.read();
+    LOG_I("Starting non-blocking SIM storage sweep (modem %u).", id_);
+    setModemRegister(MODEM_REG_CMGF, "1", id_); // The listing is parsed in text mode
+    while (serial_.available())
+        serial_.read();
 
-    smsListState = SMS_LIST_RUNNING;
-    smsListStartTime = millis(); // Start the timeout timer
-    smsWaitingForContent = false;
+    smsListState_ = SMS_LIST_RUNNING;
+    smsListStartTime_ = millis(); // Start the timeout timer
+    smsWaitingForContent_ = false;
 
-    notifyClients("sms_list_started", "{}");
-    sim900.println("AT+CMGL=\"ALL\"");
-    Serial.println("SIM TX: AT+CMGL=\"ALL\"");
+    serial_.println(F("AT+CMGL=\"ALL\""));
+    LOG_D("SIM TX[%u]: AT+CMGL=\"ALL\"", id_);
 }
 
 /**
- * @brief (Static) Handles a line of response during the SMS listing process.
+ * @brief Handles a line of response during the SIM storage sweep.
  * @param line The line received from the modem.
  */
-static void handleSmsListLine(const String &line)
+void Modem::handleSmsListLine(const String &line)
 {
-    smsListStartTime = millis(); // Reset timeout timer on each relevant line received
-
-    if (line.startsWith("+CMGL:"))
-    {
-        currentSmsJson.clear();
-        int indexStart = line.indexOf(':') + 1;
-        int indexEnd = line.indexOf(',', indexStart);
-        currentSmsJson["index"] = line.substring(indexStart, indexEnd).toInt();
-        int statusStart = line.indexOf('"', indexEnd) + 1;
-        int statusEnd = line.indexOf('"', statusStart);
-        currentSmsJson["status"] = line.substring(statusStart, statusEnd);
-        int senderStart = line.indexOf('"', statusEnd + 1) + 1;
-        int senderEnd = line.indexOf('"', senderStart);
-        currentSmsJson["sender"] = line.substring(senderStart, senderEnd);
-        int tsStart = line.indexOf('"', senderEnd + 1);
-        tsStart = line.indexOf('"', tsStart + 1) + 1;
-        int tsEnd = line.indexOf('"', tsStart);
-        if (tsStart > 0 && tsEnd > -1)
-        {
-            currentSmsJson["timestamp"] = line.substring(tsStart, tsEnd);
-        }
-        else
-        {
-            currentSmsJson["timestamp"] = "";
-        }
-        smsWaitingForContent = true;
+    smsListStartTime_ = millis(); // Reset timeout timer on each relevant line received
+
+    AtTokenizer tok(line);
+    if (tok.prefix("+CMGL:"))
+    {
+        // +CMGL: <index>,"<stat>","<oa>",["<alpha>"],["<scts>"]
+        AtField field;
+        long index = 0;
+        tok.nextInt(index);
+        currentSmsEntry_.index = index;
+        currentSmsEntry_.status[0] = '\0';
+        currentSmsEntry_.sender[0] = '\0';
+        currentSmsEntry_.timestamp[0] = '\0';
+        if (tok.next(field))
+            field.copyTo(currentSmsEntry_.status, sizeof(currentSmsEntry_.status));
+        if (tok.next(field))
+            field.copyTo(currentSmsEntry_.sender, sizeof(currentSmsEntry_.sender));
+        if (tok.skip() && tok.next(field))
+            field.copyTo(currentSmsEntry_.timestamp, sizeof(currentSmsEntry_.timestamp));
+        smsWaitingForContent_ = true;
     }
-    else if (smsWaitingForContent)
+    else if (smsWaitingForContent_)
     {
-        String body = line;
-        String decodedBody = decodeUcs2(body);
-        currentSmsJson["body"] = decodedBody;
-        if (decodedBody != body)
+        smsWaitingForContent_ = false;
+        String status = currentSmsEntry_.status;
+        if (!status.startsWith("REC"))
+            return; // Only received messages are archived
+
+        String sender = currentSmsEntry_.sender;
+        String timestamp = currentSmsEntry_.timestamp;
+        String body = decodeUcs2(line);
+        uint32_t fingerprint = smsFingerprint(sender, timestamp, body);
+        if (isDuplicateSms(fingerprint))
         {
-            currentSmsJson["body_hex"] = body;
+            // Already delivered (re-read after a reset, or sent again by the network)
+            LOG_I("Duplicate SMS from %s suppressed (modem %u).", sender.c_str(), id_);
+            queueSimSlotDelete(id_, currentSmsEntry_.index);
+            return;
         }
+        int32_t id = archiveMessage(sender, timestamp, body);
+        if (id < 0)
+        {
+            LOG_E("Archiving failed, SMS kept on SIM.");
+            return;
+        }
+        rememberSms(fingerprint, timestamp);
+        queueSimSlotDelete(id_, currentSmsEntry_.index);
+
+        PooledJsonDocument item;
+        item["index"] = id;
+        item["status"] = status;
+        item["sender"] = sender;
+        item["timestamp"] = timestamp;
+        item["body"] = body;
+        item["modem"] = id_;
+        applySmsRules(sender, body, item.as<JsonObject>()); // Auto-reply, forward, USSD, tags
         String jsonOutput;
-        serializeJson(currentSmsJson, jsonOutput);
+        serializeJson(item, jsonOutput);
         notifyClients("sms_item", jsonOutput);
-        smsWaitingForContent = false;
+        item.clear();
+        item["index"] = id;
+        item["sender"] = sender;
+        item["modem"] = id_;
+        jsonOutput = "";
+        serializeJson(item, jsonOutput);
+        notifyClients("sms_received_indication", jsonOutput);
     }
     else if (line.startsWith("OK"))
     {
-        Serial.println("INFO: SMS list retrieval finished successfully.");
-        notifyClients("sms_list_finished", "{\"status\":\"complete\"}");
-        smsListState = SMS_LIST_IDLE; // Reset the state machine
+        LOG_I("SIM sweep finished successfully.");
+        smsListState_ = SMS_LIST_IDLE; // Reset the state machine
     }
     else if (line.indexOf("ERROR") != -1)
     {
-        Serial.println("ERROR: Failed to retrieve SMS list.");
-        notifyClients("sms_list_finished", "{\"status\":\"error\"}");
-        smsListState = SMS_LIST_IDLE; // Reset the state machine
+        LOG_E("Failed to list SIM storage.");
+        smsListState_ = SMS_LIST_IDLE; // Reset the state machine
     }
     else{
 
@@ -777,106 +821,97 @@ static void handleSmsListLine(const String &line)
         // If the received line is not any of the above (not a message header, not a content,
         // not "OK" or "ERROR"), it is most likely an unexpected response (such as +CMT).
         // We print it and ignore it, allowing the operation to continue rather than failing.
-        Serial.print("SMS List: Ignoring unexpected line: ");
-        Serial.println(line);
+        LOG_W("SIM Sweep: Ignoring unexpected line: %s", line.c_str());
     }
 }
 
 /**
- * @brief (Static) Handles a line of response during the SMS sending process.
+ * @brief Handles a line of response during the SMS sending process.
  * @param line The line received from the modem.
  */
-static void handleSmsSendLine(const String &line)
+void Modem::handleSmsSendLine(const String &line)
 {
-    Serial.print("SMS Send RX: ");
-    Serial.println(line);
-    smsSendStartTime = millis();
+    LOG_D("SMS Send RX[%u]: %s", id_, line.c_str());
+    smsSendStartTime_ = millis();
 
-    switch (smsSendState)
+    switch (smsSendState_)
     {
     case SMS_SEND_IDLE:
-        Serial.println("WARNING: Received response while SMS send state is IDLE");
+        LOG_W("Received response while SMS send state is IDLE");
         break;
 
     case SMS_SEND_SETTING_CHARSET:
         if (line.startsWith("OK"))
         {
-            smsSendState = SMS_SEND_WAITING_PROMPT;
-            smsSendStartTime = millis();
-
-            if (smsIsUnicode)
-            {
-                String pdu = createPDU(smsNumberToSend, smsMessageToSend);
-                int pduLengthWithoutSMSC = (pdu.length() - 2) / 2;
-                sim900.print("AT+CMGS=");
-                sim900.println(pduLengthWithoutSMSC);
-                Serial.println("SIM TX: AT+CMGS=" + String(pduLengthWithoutSMSC));
-            }
-            else
-            {
-                sim900.print("AT+CMGS=\"");
-                sim900.print(smsNumberToSend);
-                sim900.println("\"");
-                Serial.println("SIM TX: AT+CMGS=\"" + smsNumberToSend + "\"");
-            }
+            modemRegisterSet(MODEM_REG_CMGF, smsIsUnicode_ ? "0" : "1", id_);
+            sendCmgsCommand();
         }
         else if (line.indexOf("ERROR") != -1)
         {
-            Serial.println("ERROR: Failed to set SMS send mode");
-            notifyClients("sms_sent", R"({"status":"ERROR","message":"Failed to set SMS mode","ar_message":"فشل في إعداد وضع الإرسال"})");
-            smsSendState = SMS_SEND_IDLE;
+            modemRegisterClear(MODEM_REG_CMGF, id_);
+            LOG_E("Failed to set SMS send mode");
+            notifySmsSent("ERROR", "sms_mode_failed");
+            smsSendState_ = SMS_SEND_IDLE;
         }
         break;
 
     case SMS_SEND_WAITING_PROMPT:
         if (line.indexOf("ERROR") != -1)
         {
-             if (smsIsUnicode)
+            smsCmsError_ = parseCmsError(line);
+             if (smsIsUnicode_)
             {
-                Serial.println("ERROR: Failed to start Arabic SMS send - PDU length or number error");
-                notifyClients("sms_sent", R"({"status":"ERROR","message":"Arabic PDU length error or invalid number","ar_message":"خطأ في طول PDU العربي أو رقم غير صالح"})");
+                LOG_E("Failed to start Arabic SMS send - PDU length or number error");
+                notifySmsSent("ERROR", "sms_pdu_rejected");
             }
             else
             {
-                Serial.println("ERROR: Failed to start English SMS send");
-                notifyClients("sms_sent", R"({"status":"ERROR","message":"Failed to send English SMS","ar_message":"فشل في إرسال الرسالة الإنجليزية"})");
+                LOG_E("Failed to start English SMS send");
+                notifySmsSent("ERROR", "sms_rejected");
             }
-            smsSendState = SMS_SEND_IDLE;
+            smsSendState_ = SMS_SEND_IDLE;
         }
         break;
 
     case SMS_SEND_WAITING_FINAL_OK:
-        if (line.startsWith("+CMGS:"))
+        AtTokenizer tok(line);
+        if (tok.prefix("+CMGS:"))
         {
+            // Keep the TP-MR so the status report can be matched to this job
+            long mr;
+            smsMessageRef_ = tok.nextInt(mr) ? mr : -1;
             return;
         }
         else if (line.startsWith("OK"))
         {
-            if (smsIsUnicode)
+            if (smsMessageRef_ >= 0)
+                trackDeliveryReport(id_, (uint8_t)smsMessageRef_, smsJobId_, smsNumberToSend_);
+            if (smsIsUnicode_)
             {
-                Serial.println("INFO: Arabic SMS sent successfully!");
-                notifyClients("sms_sent", R"({"status":"OK","message":"Arabic SMS sent successfully","ar_message":"تم إرسال الرسالة العربية بنجاح"})");
+                LOG_I("Arabic SMS sent successfully!");
+                notifySmsSent("OK", "sms_sent_unicode");
             }
             else
             {
-                Serial.println("INFO: English SMS sent successfully!");
-                notifyClients("sms_sent", R"({"status":"OK","message":"English SMS sent successfully","ar_message":"تم إرسال الرسالة الإنجليزية بنجاح"})");
+                LOG_I("English SMS sent successfully!");
+                notifySmsSent("OK", "sms_sent_text");
             }
-            smsSendState = SMS_SEND_IDLE;
+            smsSendState_ = SMS_SEND_IDLE;
         }
         else if (line.indexOf("ERROR") != -1)
         {
-            if (smsIsUnicode)
+            smsCmsError_ = parseCmsError(line);
+            if (smsIsUnicode_)
             {
-                Serial.println("ERROR: Arabic SMS failed to send - network or PDU error.");
-                notifyClients("sms_sent", R"({"status":"ERROR","message":"Arabic SMS network error or PDU format error","ar_message":"خطأ في الشبكة أو تنسيق PDU العربي"})");
+                LOG_E("Arabic SMS failed to send - network or PDU error.");
+                notifySmsSent("ERROR", "sms_failed_unicode");
             }
             else
             {
-                Serial.println("ERROR: English SMS failed to send.");
-                notifyClients("sms_sent", R"({"status":"ERROR","message":"English SMS failed","ar_message":"فشل في إرسال الرسالة الإنجليزية"})");
+                LOG_E("English SMS failed to send.");
+                notifySmsSent("ERROR", "sms_failed_text");
             }
-            smsSendState = SMS_SEND_IDLE;
+            smsSendState_ = SMS_SEND_IDLE;
         }
         break;
     }
@@ -891,7 +926,7 @@ static void handleSmsSendLine(const String &line)
 static String createPDU(const String &number, const String &message)
 {
     String pdu = "00";          // 1- SMSC length = 0 (use default SMSC)
-    pdu += "11";                // 2- TP-Mti=01 (SUBMIT) + VPF=10 (Relative)
+    pdu += "31";                // 2- TP-Mti=01 (SUBMIT) + VPF=10 (Relative) + SRR (status report)
     pdu += "00";                // 3- TP-MR (Message Reference = 0)
 
     // 4-A LEN (in digits)
@@ -924,4 +959,216 @@ static String createPDU(const String &number, const String &message)
     pdu += ud;
 
     return pdu;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Notifies the clients of the outcome of the current SMS job.
+ * @param status "OK" or "ERROR".
+ * @param code The message code; the UI translates it with the msg_<code> key of the lang files.
+ */
+void Modem::notifySmsSent(const char *status, const char *code)
+{
+    bool ok = strcmp(status, "OK") == 0;
+    if (smsSchedulerOnResult(id_, ok, ok ? -1 : smsCmsError_))
+    {
+        LOG_I("SMS re-queued by the scheduler.");
+        return;
+    }
+
+    PooledJsonDocument doc;
+    doc["status"] = status;
+    doc["code"] = code;
+    doc["job"] = smsJobId_;
+    doc["modem"] = id_;
+    if (smsMessageRef_ >= 0)
+        doc["mr"] = smsMessageRef_;
+    if (!ok && smsCmsError_ >= 0)
+        doc["cms_error"] = smsCmsError_;
+    String s;
+    serializeJson(doc, s);
+    notifyClients("sms_sent", s);
+}
+
+/**
+ * @brief (Static) Extracts the numeric code from a "+CMS ERROR: <n>" line.
+ * @param line The received line.
+ * @return The error code, or -1 if the line carries no numeric +CMS ERROR.
+ */
+static int parseCmsError(const String &line)
+{
+    int p = line.indexOf("+CMS ERROR:");
+    if (p == -1)
+        return -1;
+    AtTokenizer tok(line.c_str() + p, line.length() - p);
+    long code;
+    return tok.prefix("+CMS ERROR:") && tok.nextInt(code) && code >= 0 ? code : -1;
+}
+
+/**
+ * @brief Issues AT+CMGS for the current job once the message format is set.
+ */
+void Modem::sendCmgsCommand()
+{
+    smsSendState_ = SMS_SEND_WAITING_PROMPT;
+    smsSendStartTime_ = millis();
+
+    if (smsIsUnicode_)
+    {
+        String pdu = createPDU(smsNumberToSend_, smsMessageToSend_);
+        int pduLengthWithoutSMSC = (pdu.length() - 2) / 2;
+        serial_.print(F("AT+CMGS="));
+        serial_.println(pduLengthWithoutSMSC);
+        LOG_D("SIM TX[%u]: AT+CMGS=%d", id_, pduLengthWithoutSMSC);
+    }
+    else
+    {
+        serial_.print(F("AT+CMGS=\""));
+        serial_.print(smsNumberToSend_);
+        serial_.println('"');
+        LOG_D("SIM TX[%u]: AT+CMGS=\"%s\"", id_, smsNumberToSend_.c_str());
+    }
+}
+
+/**
+ * @brief Handles call URCs (RING, NO CARRIER, +CLIP).
+ * @param modem The modem the URC arrived on.
+ * @param line The full URC line.
+ */
+void handleCallUrc(Modem &modem, const String &line)
+{
+    if (line.startsWith("RING"))
+    {
+        notifyClients("call_incoming", "RING");
+    }
+    else if (line.startsWith("NO CARRIER"))
+    {
+        notifyClients("call_status", "NO CARRIER");
+    }
+    else
+    {
+        // +CLIP: "<number>",<type>[,...]
+        AtTokenizer tok(line);
+        AtField cid;
+        if (tok.prefix("+CLIP:") && tok.next(cid) && cid.quoted)
+        {
+            PooledJsonDocument dataDoc;
+            dataDoc["caller_id"] = cid.toString();
+            dataDoc["modem"] = modem.id();
+            String s;
+            serializeJson(dataDoc, s);
+            notifyClients("caller_id", s);
+        }
+    }
+}
+
+/**
+ * @brief (Static) Extracts the registration status code from a +CREG line.
+ * @details Unsolicited: +CREG: <stat>[,<lac>,<ci>]; solicited: +CREG: <n>,<stat>[,...]
+ * @return The <stat> code, or -1 if the line carries none.
+ */
+static long parseCregStat(const String &line)
+{
+    AtTokenizer tok(line);
+    AtField first, second;
+    long stat = -1;
+    if (!tok.prefix("+CREG:") || !tok.next(first))
+        return -1;
+    if (tok.next(second) && !second.quoted)
+        second.toInt(stat);
+    else
+        first.toInt(stat);
+    return stat;
+}
+
+/**
+ * @brief (Static) Maps a +CREG <stat> code to the status text shown to the clients.
+ */
+static const __FlashStringHelper *registrationText(long stat)
+{
+    switch (stat)
+    {
+    case 1:
+        return F("Registered");
+    case 5:
+        return F("Registered (Roaming)");
+    case 2:
+        return F("Searching");
+    case 3:
+        return F("Registration Denied");
+    default:
+        return F("Not Registered");
+    }
+}
+
+/**
+ * @brief Handles registration, SIM and radio state URCs (+CREG, +CPIN, +CFUN).
+ * @details Updates the cached status and pushes it to the clients at once, so the
+ *          periodic status poll is only a fallback.
+ * @param modem The modem the URC arrived on.
+ * @param line The full URC line.
+ */
+void handleRegistrationUrc(Modem &modem, const String &line)
+{
+    String statusBefore = modem.simStatus;
+    bool pinBefore = modem.simPinOk;
+
+    AtTokenizer tok(line);
+    if (tok.prefix("+CREG:"))
+    {
+        long stat = parseCregStat(line);
+        modem.simStatus = registrationText(stat);
+        if ((stat == 1 || stat == 5) && !statusBefore.startsWith("Registered"))
+            modem.requestStatusRefresh(); // Operator name and signal have changed
+        if (stat != 1 && stat != 5)
+        {
+            modem.networkOperator = F("N/A");
+            modem.signalQuality = F("N/A");
+        }
+    }
+    else if (line.startsWith("+CPIN:"))
+    {
+        if (line.startsWith("+CPIN: READY"))
+        {
+            modem.simPinOk = true;
+        }
+        else
+        {
+            modem.simPinOk = false;
+            if (line.indexOf("PUK") != -1)
+            {
+                modem.simRequiresPin = true;
+                modem.simStatus = F("PUK Required");
+            }
+            else if (line.indexOf("PIN") != -1)
+            {
+                modem.simRequiresPin = true;
+                modem.simStatus = F("SIM Not Ready");
+            }
+            else if (line.indexOf("NOT INSERTED") != -1)
+            {
+                modem.simStatus = F("SIM Not Inserted");
+            }
+            else
+            {
+                modem.simStatus = F("SIM Not Ready"); // e.g. "+CPIN: NOT READY" when the SIM is removed
+            }
+        }
+    }
+    else if (tok.prefix("+CFUN:"))
+    {
+        long fun = 0;
+        tok.nextInt(fun);
+        if (fun != 1)
+        {
+            modem.simStatus = F("Radio Off");
+            modem.networkOperator = F("N/A");
+            modem.signalQuality = F("N/A");
+        }
+    }
+
+    if (modem.simStatus != statusBefore || modem.simPinOk != pinBefore)
+    {
+        LOG_I("Modem %u status changed to '%s'.", modem.id(), modem.simStatus.c_str());
+        notifyStatus();
+    }
+}
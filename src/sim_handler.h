@@ -23,23 +23,108 @@
 #define SIM_HANDLER_H
 
 #include <Arduino.h>
+#include <ArduinoJson.h>
+#include "config.h"
+#include "urc_dispatch.h"
 
-// --- Initialization and Status ---
-void initializeSIM();
-bool checkSimPin();
-void updateStatus();
+/**
+ * @class Modem
+ * @brief Driver of one SIM900 on its own serial port: AT commands, the SMS send and
+ *        SIM sweep state machines, and the cached SIM/network status.
+ * @details modems[PRIMARY_MODEM] also carries USSD, the signal history and the
+ *          health watchdog; the other modems send and receive SMS.
+ */
+class Modem {
+public:
+    Modem(uint8_t id, Stream &serial) : id_(id), serial_(serial) {}
+
+    // --- Initialization and Status ---
+    void initialize();
+    bool checkSimPin();
+    void updateStatus();
+    void requestStatusRefresh() { statusRefreshRequested_ = true; }
+    void requestReinit() { reinitRequested_ = true; }
+    void statusToJson(JsonObject obj) const;
+
+    // --- Core Communication ---
+    String sendATCommand(const String &cmd, unsigned long timeout, const char *expectedResponsePrefix, bool silent = false);
+    void handleData();
+    bool idle() const;
+    bool healthy() const;
+    bool ready() const;
+
+    // --- SIM Actions ---
+    void startSmsJob(uint32_t jobId, const String &number, const String &message);
+    void startSimSweep();
+
+    uint8_t id() const { return id_; }
+    Stream &serial() { return serial_; }
+
+    // --- Cached SIM and network status ---
+    String simStatus = "Initializing...";
+    String signalQuality = "N/A";
+    String networkOperator = "N/A";
+    String simPhoneNumber = "N/A";
+    bool simRequiresPin = false;
+    bool simPinOk = false;
 
-// --- Core Communication ---
-String sendATCommand(const String &cmd, unsigned long timeout, const char *expectedResponsePrefix, bool silent = false);
+private:
+    void handleSmsListLine(const String &line);
+    void handleSmsSendLine(const String &line);
+    void notifySmsSent(const char *status, const char *code);
+    void sendCmgsCommand();
+    void responseReceived();
+    void commandTimedOut();
+
+    uint8_t id_;
+    Stream &serial_;
+    String responseBuffer_;
+    bool statusRefreshRequested_ = false; // Operator/signal must be re-read (e.g. newly registered)
+    bool reinitRequested_ = false;        // The modem restarted on its own
+    uint8_t timeouts_ = 0;                // Consecutive commands without an answer
+    unsigned long lastProbe_ = 0;
+
+    // SIM sweep (AT+CMGL) state machine
+    SmsListState smsListState_ = SMS_LIST_IDLE;
+    unsigned long smsListStartTime_ = 0;
+    bool smsWaitingForContent_ = false;
+    SmsListEntry currentSmsEntry_;
+
+    // SMS send state machine
+    SmsSendState smsSendState_ = SMS_SEND_IDLE;
+    unsigned long smsSendStartTime_ = 0;
+    String smsNumberToSend_;
+    String smsMessageToSend_;
+    bool smsIsUnicode_ = false;
+    uint32_t smsJobId_ = 0;
+    int smsMessageRef_ = -1;
+    int smsCmsError_ = -1; // Numeric +CMS ERROR of the current job, -1 if none
+};
+
+extern Modem modems[MODEM_COUNT];
+
+// --- All modems ---
+void initializeSIM();
+void requestStatusRefresh();
 void handleSimData();
+bool modemIdle();
 
 // --- SIM Actions ---
 void sendSMS(const String &number, const String &message);
-void sendUSSD(const String &code);
-void sendUSSDReply(const String &reply);
-void readSMS(int index);
-void deleteSMS(int index);
-void startGetSmsList();
+
+// --- URC Handlers ---
+void handleCallUrc(Modem &modem, const String &line);
+void handleRegistrationUrc(Modem &modem, const String &line);
+
+// Merged into the URC dispatch table (urc_dispatch.cpp)
+constexpr UrcRoute simUrcRoutes[] = {
+    {"RING", handleCallUrc},
+    {"NO CARRIER", handleCallUrc},
+    {"+CLIP:", handleCallUrc},
+    {"+CREG:", handleRegistrationUrc},
+    {"+CPIN:", handleRegistrationUrc},
+    {"+CFUN:", handleRegistrationUrc},
+};
 
 // --- Helper Functions ---
 String decodeUcs2(const String &hexStr);
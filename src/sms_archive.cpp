@@ -0,0 +1,857 @@
+/**
+ * @file    sms_archive.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of the persistent SMS archive.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Stores every incoming SMS in an append-only log on LittleFS with a
+ *              fixed-size index next to it, then frees the SIM slot with AT+CMGD.
+ *              When the log outgrows its flash budget the oldest and deleted
+ *              messages are dropped by rewriting both files (compaction).
+ */
+
+
+/**
+ * @file sms_archive.cpp
+ * @brief Implementation of the persistent SMS archive.
+ */
+
+#include "config.h"
+#include "sms_archive.h"
+#include "logger.h"
+#include "json_arena.h"
+#include "sim_handler.h" // For modems
+#include "web_server.h"  // For notifyClients
+#include <memory>
+
+#define ARCHIVE_RECORD_MAGIC 0xA55A
+
+/**
+ * @struct ArchiveRecordHeader
+ * @brief Header stored in front of each message in the log file.
+ * @details The record is self-describing, so the index can be rebuilt from the log.
+ */
+struct ArchiveRecordHeader {
+    uint16_t magic;
+    uint8_t senderLen;
+    uint8_t sctsLen;
+    uint32_t id;
+    uint32_t timestamp;
+    uint16_t bodyLen;
+    uint16_t reserved;
+};
+
+static uint32_t entryCount = 0; // Number of entries in the index file (including deleted)
+static uint32_t liveCount = 0;  // Number of entries not marked as deleted
+static uint32_t nextId = 1;
+static uint32_t logSize = 0;
+
+static uint32_t archiveGeneration = 0; // Bumped whenever index or sender index positions change
+
+// --- Sender index: (senderHash, position) pairs sorted by hash, then position ---
+static uint32_t senderHashes[SENDER_INDEX_CAPACITY];
+static uint16_t senderPositions[SENDER_INDEX_CAPACITY];
+static uint16_t senderIndexCount = 0;
+static uint32_t senderIndexFloor = 0; // Index positions below this are not covered
+
+/**
+ * @struct SimDeleteQueue
+ * @brief SIM slots of one modem waiting for AT+CMGD.
+ */
+struct SimDeleteQueue {
+    int slots[SIM_DELETE_QUEUE_SIZE];
+    uint8_t count;
+};
+
+static bool simSweepRequested[MODEM_COUNT];
+static SimDeleteQueue simDeletes[MODEM_COUNT];
+
+/**
+ * @brief (Static) 32-bit FNV-1a hash of a string.
+ */
+static uint32_t fnv1a(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Converts a service centre timestamp to Unix time.
+ * @param scts The timestamp as reported by the modem ("yy/MM/dd,hh:mm:ss+zz").
+ * @return Seconds since 1970-01-01 UTC, or 0 if the timestamp cannot be parsed.
+ */
+uint32_t sctsToEpoch(const String &scts) {
+    int yy, mo, dd, hh, mi, ss, tz = 0;
+    char sign = '+';
+    if (sscanf(scts.c_str(), "%d/%d/%d,%d:%d:%d%c%d", &yy, &mo, &dd, &hh, &mi, &ss, &sign, &tz) < 6)
+        return 0;
+    // Days from civil date (proleptic Gregorian calendar)
+    int y = 2000 + yy - (mo <= 2 ? 1 : 0);
+    int era = y / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (mo + (mo > 2 ? -3 : 9)) + 2) / 5 + dd - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long days = (long)era * 146097 + doe - 719468;
+    long offset = (long)tz * 15 * 60; // Time zone is given in quarter hours
+    if (sign == '-') offset = -offset;
+    return (uint32_t)(days * 86400L + hh * 3600L + mi * 60L + ss - offset);
+}
+
+/**
+ * @brief (Static) Reads the index entry at a given position.
+ * @return true if the entry was read completely.
+ */
+static bool readEntry(File &idx, uint32_t pos, ArchiveIndexEntry &e) {
+    if (!idx.seek(pos * sizeof(ArchiveIndexEntry), SeekSet)) return false;
+    return idx.read((uint8_t *)&e, sizeof(e)) == sizeof(e);
+}
+
+/**
+ * @brief (Static) Finds an index entry by message id (ids are stored in ascending order).
+ * @param id The message id.
+ * @param e Receives the entry.
+ * @return The entry position, or -1 if not found.
+ */
+static long findEntry(File &idx, uint32_t id, ArchiveIndexEntry &e) {
+    long lo = 0, hi = (long)entryCount - 1;
+    while (lo <= hi) {
+        long mid = (lo + hi) / 2;
+        if (!readEntry(idx, mid, e)) return -1;
+        if (e.id == id) return mid;
+        if (e.id < id) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief (Static) Returns the number of index entries with an id below the given one.
+ */
+static uint32_t positionOfId(File &idx, uint32_t id) {
+    uint32_t lo = 0, hi = entryCount;
+    ArchiveIndexEntry e;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (!readEntry(idx, mid, e)) return lo;
+        if (e.id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * @brief (Static) Finds the first sender index slot not less than (hash, pos).
+ */
+static uint16_t senderLowerBound(uint32_t hash, uint32_t pos) {
+    uint16_t lo = 0, hi = senderIndexCount;
+    while (lo < hi) {
+        uint16_t mid = (lo + hi) / 2;
+        if (senderHashes[mid] < hash || (senderHashes[mid] == hash && senderPositions[mid] < pos))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * @brief (Static) Adds an index position to the sender index.
+ * @details When the index is full the oldest position is dropped and the floor
+ *          raised; queries scan the positions below the floor instead.
+ */
+static void senderIndexInsert(uint32_t hash, uint32_t pos) {
+    if (senderIndexCount >= SENDER_INDEX_CAPACITY) {
+        uint16_t oldest = 0;
+        for (uint16_t i = 1; i < senderIndexCount; i++) {
+            if (senderPositions[i] < senderPositions[oldest]) oldest = i;
+        }
+        senderIndexFloor = senderPositions[oldest] + 1;
+        senderIndexCount--;
+        memmove(&senderHashes[oldest], &senderHashes[oldest + 1], (senderIndexCount - oldest) * sizeof(uint32_t));
+        memmove(&senderPositions[oldest], &senderPositions[oldest + 1], (senderIndexCount - oldest) * sizeof(uint16_t));
+    }
+    uint16_t i = senderLowerBound(hash, pos);
+    memmove(&senderHashes[i + 1], &senderHashes[i], (senderIndexCount - i) * sizeof(uint32_t));
+    memmove(&senderPositions[i + 1], &senderPositions[i], (senderIndexCount - i) * sizeof(uint16_t));
+    senderHashes[i] = hash;
+    senderPositions[i] = pos;
+    senderIndexCount++;
+    archiveGeneration++; // Slots of in-flight sender queries have moved
+}
+
+/**
+ * @brief (Static) Removes an index position from the sender index.
+ */
+static void senderIndexRemove(uint32_t hash, uint32_t pos) {
+    uint16_t i = senderLowerBound(hash, pos);
+    if (i >= senderIndexCount || senderHashes[i] != hash || senderPositions[i] != pos) return;
+    senderIndexCount--;
+    memmove(&senderHashes[i], &senderHashes[i + 1], (senderIndexCount - i) * sizeof(uint32_t));
+    memmove(&senderPositions[i], &senderPositions[i + 1], (senderIndexCount - i) * sizeof(uint16_t));
+    archiveGeneration++;
+}
+
+/**
+ * @brief (Static) Rebuilds the sender index from the index file, newest messages first.
+ */
+static void buildSenderIndex() {
+    senderIndexCount = 0;
+    senderIndexFloor = 0;
+    archiveGeneration++;
+    File idx = LittleFS.open(SMS_INDEX_FILE, "r");
+    if (!idx) return;
+    ArchiveIndexEntry e;
+    for (long i = (long)entryCount - 1; i >= 0; i--) {
+        if (!readEntry(idx, i, e)) break;
+        if (e.flags & ARCHIVE_FLAG_DELETED) continue;
+        if (senderIndexCount >= SENDER_INDEX_CAPACITY) {
+            senderIndexFloor = i + 1;
+            break;
+        }
+        senderIndexInsert(e.senderHash, i);
+    }
+    idx.close();
+}
+
+/**
+ * @brief (Static) Checks that an index entry points at the start of its own record.
+ */
+static bool recordMatches(File &log, const ArchiveIndexEntry &e) {
+    ArchiveRecordHeader h;
+    if (!log.seek(e.offset, SeekSet) || log.read((uint8_t *)&h, sizeof(h)) != sizeof(h))
+        return false;
+    return h.magic == ARCHIVE_RECORD_MAGIC && h.id == e.id &&
+           sizeof(h) + h.senderLen + h.sctsLen + h.bodyLen == e.length;
+}
+
+/**
+ * @brief (Static) Reads a message record from the log file.
+ * @return true if the record header matches the index entry and was read completely.
+ */
+static bool readRecord(File &log, const ArchiveIndexEntry &e, String &sender, String &scts, String &body) {
+    ArchiveRecordHeader h;
+    if (!log.seek(e.offset, SeekSet) || log.read((uint8_t *)&h, sizeof(h)) != sizeof(h))
+        return false;
+    if (h.magic != ARCHIVE_RECORD_MAGIC || h.id != e.id)
+        return false;
+    char buf[256];
+    if (log.read((uint8_t *)buf, h.senderLen) != h.senderLen) return false;
+    buf[h.senderLen] = '\0';
+    sender = buf;
+    if (log.read((uint8_t *)buf, h.sctsLen) != h.sctsLen) return false;
+    buf[h.sctsLen] = '\0';
+    scts = buf;
+    body = "";
+    body.reserve(h.bodyLen);
+    uint16_t remaining = h.bodyLen;
+    while (remaining > 0) {
+        size_t chunk = std::min((size_t)remaining, sizeof(buf) - 1);
+        if (log.read((uint8_t *)buf, chunk) != chunk) return false;
+        buf[chunk] = '\0';
+        body += buf;
+        remaining -= chunk;
+    }
+    return true;
+}
+
+/**
+ * @brief (Static) Cuts an unindexed tail (e.g. a record torn by a reset) off the log.
+ */
+static void trimLog(uint32_t size) {
+    File log = LittleFS.open(SMS_LOG_FILE, "r+");
+    if (!log) return;
+    if (log.size() > size) {
+        LOG_W("Archive: Dropping %u unindexed bytes at the end of the log.", (unsigned)(log.size() - size));
+        log.truncate(size);
+    }
+    log.close();
+}
+
+/**
+ * @brief (Static) Rebuilds the index file by scanning the log.
+ * @details Used when the index does not match the log (e.g. power loss during
+ *          compaction). Read/deleted flags are lost in that case.
+ */
+static void rebuildIndex() {
+    LOG_I("Archive: Index does not match log, rebuilding...");
+    File log = LittleFS.open(SMS_LOG_FILE, "r");
+    File idx = LittleFS.open(SMS_INDEX_FILE, "w");
+    entryCount = liveCount = 0;
+    nextId = 1;
+    if (!log || !idx) return;
+    uint32_t pos = 0;
+    ArchiveRecordHeader h;
+    while (log.seek(pos, SeekSet) && log.read((uint8_t *)&h, sizeof(h)) == sizeof(h)) {
+        if (h.magic != ARCHIVE_RECORD_MAGIC) break;
+        uint16_t len = sizeof(h) + h.senderLen + h.sctsLen + h.bodyLen;
+        if (pos + len > log.size()) break;
+        char sender[256];
+        log.read((uint8_t *)sender, h.senderLen);
+        sender[h.senderLen] = '\0';
+        ArchiveIndexEntry e = {h.id, pos, h.timestamp, fnv1a(sender), len, 0, 0};
+        idx.write((const uint8_t *)&e, sizeof(e));
+        entryCount++;
+        liveCount++;
+        nextId = h.id + 1;
+        pos += len;
+    }
+    logSize = pos;
+    log.close();
+    idx.close();
+    trimLog(logSize);
+}
+
+/**
+ * @brief (Static) Drops deleted and oldest messages until the log fits a byte target.
+ * @details Both files are rewritten to temporary files and renamed over the originals,
+ *          the log first. The new index is only renamed once the new log is in place,
+ *          so a leftover index .tmp without a log .tmp means the compaction was
+ *          interrupted between the renames; initSmsArchive() then finishes it.
+ * @param targetBytes The maximum log size after compaction.
+ * @return true on success.
+ */
+static bool compactArchive(uint32_t targetBytes) {
+    File idx = LittleFS.open(SMS_INDEX_FILE, "r");
+    File log = LittleFS.open(SMS_LOG_FILE, "r");
+    if (!idx || !log) return false;
+
+    // Pass 1: walk from the newest entry backwards to find how much history fits.
+    ArchiveIndexEntry e;
+    uint32_t keepBytes = 0;
+    long firstKept = entryCount;
+    for (long i = (long)entryCount - 1; i >= 0; i--) {
+        if (!readEntry(idx, i, e)) break;
+        if (e.flags & ARCHIVE_FLAG_DELETED) continue;
+        if (keepBytes + e.length > targetBytes) break;
+        keepBytes += e.length;
+        firstKept = i;
+    }
+
+    // Pass 2: copy the surviving records to fresh files.
+    File newLog = LittleFS.open(SMS_LOG_FILE ".tmp", "w");
+    File newIdx = LittleFS.open(SMS_INDEX_FILE ".tmp", "w");
+    if (!newLog || !newIdx) {
+        idx.close();
+        log.close();
+        return false;
+    }
+    uint32_t newCount = 0, newLive = 0, newSize = 0;
+    uint8_t buf[128];
+    for (uint32_t i = firstKept; i < entryCount; i++) {
+        if (!readEntry(idx, i, e) || (e.flags & ARCHIVE_FLAG_DELETED)) continue;
+        log.seek(e.offset, SeekSet);
+        uint32_t remaining = e.length;
+        while (remaining > 0) {
+            size_t chunk = std::min((size_t)remaining, sizeof(buf));
+            log.read(buf, chunk);
+            newLog.write(buf, chunk);
+            remaining -= chunk;
+        }
+        e.offset = newSize;
+        newSize += e.length;
+        newIdx.write((const uint8_t *)&e, sizeof(e));
+        newCount++;
+        newLive++;
+    }
+    idx.close();
+    log.close();
+    newLog.close();
+    newIdx.close();
+
+    if (!LittleFS.rename(SMS_LOG_FILE ".tmp", SMS_LOG_FILE)) {
+        LOG_E("Archive: Compaction rename failed!");
+        LittleFS.remove(SMS_LOG_FILE ".tmp");
+        LittleFS.remove(SMS_INDEX_FILE ".tmp");
+        return false;
+    }
+    if (!LittleFS.rename(SMS_INDEX_FILE ".tmp", SMS_INDEX_FILE)) {
+        LOG_E("Archive: Compaction rename failed!");
+        rebuildIndex(); // The old index no longer describes the new log
+        buildSenderIndex();
+        return false;
+    }
+    LOG_I("Archive: Compacted %u -> %u bytes, %u messages kept.", logSize, newSize, newLive);
+    entryCount = newCount;
+    liveCount = newLive;
+    logSize = newSize;
+    buildSenderIndex();
+    return true;
+}
+
+/**
+ * @brief (Static) Returns the flash budget of the log file in bytes.
+ */
+static uint32_t archiveBudget() {
+    int kb = config.archive_budget_kb > 0 ? config.archive_budget_kb : ARCHIVE_DEFAULT_BUDGET_KB;
+    return (uint32_t)kb * 1024;
+}
+
+/**
+ * @brief (Static) Builds the client-facing JSON for an archived message.
+ */
+static void buildSmsJson(JsonDocument &doc, const ArchiveIndexEntry &e, const String &sender, const String &scts, const String &body) {
+    doc["index"] = e.id;
+    doc["status"] = (e.flags & ARCHIVE_FLAG_READ) ? "REC READ" : "REC UNREAD";
+    doc["sender"] = sender;
+    doc["timestamp"] = scts;
+    doc["epoch"] = e.timestamp;
+    doc["body"] = body;
+}
+
+/**
+ * @brief Opens the archive and validates the index against the log.
+ */
+void initSmsArchive() {
+    // Finish or discard a compaction that was interrupted by a reset
+    if (LittleFS.exists(SMS_LOG_FILE ".tmp")) {
+        LittleFS.remove(SMS_LOG_FILE ".tmp");
+        LittleFS.remove(SMS_INDEX_FILE ".tmp");
+    } else if (LittleFS.exists(SMS_INDEX_FILE ".tmp")) {
+        LOG_I("Archive: Completing interrupted compaction.");
+        LittleFS.remove(SMS_INDEX_FILE);
+        LittleFS.rename(SMS_INDEX_FILE ".tmp", SMS_INDEX_FILE);
+    }
+
+    File log = LittleFS.open(SMS_LOG_FILE, "r");
+    logSize = log ? log.size() : 0;
+
+    File idx = LittleFS.open(SMS_INDEX_FILE, "r");
+    entryCount = idx ? idx.size() / sizeof(ArchiveIndexEntry) : 0;
+    liveCount = 0;
+    nextId = 1;
+    bool consistent = true;
+    uint32_t indexedEnd = 0;
+    if (idx) {
+        // Every entry must point at its own record: a stale index (e.g. a reset
+        // during compaction) may still have offsets inside the log
+        ArchiveIndexEntry e;
+        for (uint32_t i = 0; i < entryCount && readEntry(idx, i, e); i++) {
+            if (!(e.flags & ARCHIVE_FLAG_DELETED)) liveCount++;
+            if (consistent && (e.offset + e.length > logSize || !recordMatches(log, e))) consistent = false;
+            indexedEnd = std::max(indexedEnd, e.offset + e.length);
+            nextId = e.id + 1;
+        }
+        idx.close();
+    }
+    if (log) log.close();
+    if (!consistent || (entryCount == 0 && logSize > 0)) {
+        rebuildIndex();
+    } else if (logSize > indexedEnd) {
+        trimLog(indexedEnd);
+        logSize = indexedEnd;
+    }
+    buildSenderIndex();
+    LOG_I("Archive: %u messages, %u bytes of %u budget.", liveCount, logSize, archiveBudget());
+}
+
+/**
+ * @brief Appends a message to the archive.
+ * @param sender The sender number.
+ * @param scts The service centre timestamp as reported by the modem.
+ * @param body The decoded (UTF-8) message body.
+ * @return The new message id, or -1 on failure.
+ */
+int32_t archiveMessage(const String &sender, const String &scts, const String &body) {
+    ArchiveRecordHeader h;
+    h.magic = ARCHIVE_RECORD_MAGIC;
+    h.senderLen = std::min(sender.length(), 64u);
+    h.sctsLen = std::min(scts.length(), 32u);
+    h.id = nextId;
+    h.timestamp = sctsToEpoch(scts);
+    h.bodyLen = std::min(body.length(), (unsigned int)ARCHIVE_MAX_BODY);
+    h.reserved = 0;
+    uint16_t len = sizeof(h) + h.senderLen + h.sctsLen + h.bodyLen;
+
+    if (logSize + len > archiveBudget())
+        compactArchive(archiveBudget() * 3 / 4);
+
+    File log = LittleFS.open(SMS_LOG_FILE, "a");
+    if (!log) {
+        LOG_E("Archive: Failed to open log for writing.");
+        return -1;
+    }
+    // The record goes where the file really ends, not where logSize thinks it does
+    uint32_t offset = log.size();
+    size_t written = log.write((const uint8_t *)&h, sizeof(h));
+    written += log.write((const uint8_t *)sender.c_str(), h.senderLen);
+    written += log.write((const uint8_t *)scts.c_str(), h.sctsLen);
+    written += log.write((const uint8_t *)body.c_str(), h.bodyLen);
+    if (written != len) {
+        LOG_E("Archive: Short write to log (flash full?).");
+        log.truncate(offset);
+        log.close();
+        return -1;
+    }
+
+    ArchiveIndexEntry e = {h.id, offset, h.timestamp, fnv1a(sender.c_str()), len, 0, 0};
+    File idx = LittleFS.open(SMS_INDEX_FILE, "a");
+    if (!idx || idx.write((const uint8_t *)&e, sizeof(e)) != sizeof(e)) {
+        LOG_E("Archive: Failed to write index entry.");
+        if (idx) {
+            idx.truncate(entryCount * sizeof(ArchiveIndexEntry));
+            idx.close();
+        }
+        log.truncate(offset);
+        log.close();
+        return -1;
+    }
+    idx.close();
+    log.close();
+
+    senderIndexInsert(e.senderHash, entryCount);
+    logSize = offset + len;
+    entryCount++;
+    liveCount++;
+    nextId++;
+    return (int32_t)e.id;
+}
+
+/**
+ * @brief Streams the newest archived messages to the clients as 'sms_item' events.
+ * @details Sends up to ARCHIVE_LIST_LIMIT messages, oldest first, framed by
+ *          'sms_list_started' and 'sms_list_finished'.
+ */
+void sendArchiveList() {
+    notifyClients("sms_list_started", "{}");
+    File idx = LittleFS.open(SMS_INDEX_FILE, "r");
+    File log = LittleFS.open(SMS_LOG_FILE, "r");
+    if (idx && log) {
+        // Find the oldest entry that is still within the newest ARCHIVE_LIST_LIMIT
+        ArchiveIndexEntry e;
+        long start = entryCount;
+        uint32_t found = 0;
+        while (start > 0 && found < ARCHIVE_LIST_LIMIT) {
+            start--;
+            if (readEntry(idx, start, e) && !(e.flags & ARCHIVE_FLAG_DELETED)) found++;
+        }
+        String sender, scts, body;
+        for (uint32_t i = start; i < entryCount; i++) {
+            if (!readEntry(idx, i, e) || (e.flags & ARCHIVE_FLAG_DELETED)) continue;
+            if (!readRecord(log, e, sender, scts, body)) continue;
+            PooledJsonDocument doc;
+            buildSmsJson(doc, e, sender, scts, body);
+            String s;
+            serializeJson(doc, s);
+            notifyClients("sms_item", s);
+            yield();
+        }
+    }
+    if (idx) idx.close();
+    if (log) log.close();
+    notifyClients("sms_list_finished", "{\"status\":\"complete\"}");
+}
+
+/**
+ * @brief Sends one archived message to the clients and marks it as read.
+ * @param id The archive message id.
+ */
+void readArchivedSms(uint32_t id) {
+    File idx = LittleFS.open(SMS_INDEX_FILE, "r+");
+    File log = LittleFS.open(SMS_LOG_FILE, "r");
+    ArchiveIndexEntry e;
+    String sender, scts, body;
+    long pos = (idx && log) ? findEntry(idx, id, e) : -1;
+    if (pos < 0 || (e.flags & ARCHIVE_FLAG_DELETED) || !readRecord(log, e, sender, scts, body)) {
+        if (idx) idx.close();
+        if (log) log.close();
+        notifyClients("sms_content", "{\"error\":\"sms_read_failed\"}");
+        return;
+    }
+    log.close();
+    if (!(e.flags & ARCHIVE_FLAG_READ)) {
+        e.flags |= ARCHIVE_FLAG_READ;
+        idx.seek(pos * sizeof(e), SeekSet);
+        idx.write((const uint8_t *)&e, sizeof(e));
+    }
+    idx.close();
+
+    PooledJsonDocument doc;
+    buildSmsJson(doc, e, sender, scts, body);
+    String s;
+    serializeJson(doc, s);
+    notifyClients("sms_content", s);
+}
+
+/**
+ * @brief Marks an archived message as deleted. Space is reclaimed on compaction.
+ * @param id The archive message id.
+ */
+void deleteArchivedSms(uint32_t id) {
+    File idx = LittleFS.open(SMS_INDEX_FILE, "r+");
+    ArchiveIndexEntry e;
+    long pos = idx ? findEntry(idx, id, e) : -1;
+    bool ok = pos >= 0 && !(e.flags & ARCHIVE_FLAG_DELETED);
+    if (ok) {
+        e.flags |= ARCHIVE_FLAG_DELETED;
+        idx.seek(pos * sizeof(e), SeekSet);
+        ok = idx.write((const uint8_t *)&e, sizeof(e)) == sizeof(e);
+        if (ok) {
+            liveCount--;
+            senderIndexRemove(e.senderHash, pos);
+        }
+    }
+    if (idx) idx.close();
+
+    PooledJsonDocument doc;
+    doc["index"] = id;
+    doc["success"] = ok;
+    if (!ok)
+        doc["code"] = "sms_not_found";
+    String s;
+    serializeJson(doc, s);
+    notifyClients("sms_deleted", s);
+}
+
+/**
+ * @struct InboxQuery
+ * @brief Iteration state of one streamed /api/inbox response.
+ */
+struct InboxQuery {
+    File idx;
+    File log;
+    uint32_t generation;
+    uint32_t offset;
+    uint32_t limit;
+    uint32_t before;     // Cursor: only ids below this are left (UINT32_MAX = from the newest)
+    uint32_t skip;       // Matches still to skip before the page starts
+    uint32_t remaining;  // Items still to emit on this page
+    uint16_t visits;     // Index entries the current chunk may still visit
+    bool bySender;
+    String sender;
+    uint32_t senderHash;
+    uint32_t since;
+    long rangeLo;        // Sender index slots still to visit: [rangeLo, rangeHi)
+    long rangeHi;
+    long scanPos;        // Next index position to scan linearly (descending)
+    uint8_t stage;       // 0 = header, 1 = items, 2 = trailer, 3 = done
+    bool first;
+    bool more;
+    String pending;      // Serialized text not yet handed to the TCP stack
+    size_t pendingPos;
+};
+
+enum InboxMatch { INBOX_MATCH, INBOX_END, INBOX_YIELD };
+
+/**
+ * @brief (Static) Positions the query just below its cursor id.
+ * @details Ids grow with the index position and survive compaction, so this also
+ *          resumes a query after the index or the sender index changed under it.
+ */
+static void positionInboxQuery(InboxQuery &q) {
+    q.generation = archiveGeneration;
+    q.rangeLo = q.rangeHi = 0;
+    q.scanPos = -1;
+    if (!q.idx || !q.log) return;
+    uint32_t end = q.before == UINT32_MAX ? entryCount : positionOfId(q.idx, q.before);
+    if (q.bySender) {
+        q.rangeLo = senderLowerBound(q.senderHash, 0);
+        q.rangeHi = senderLowerBound(q.senderHash, end);
+        q.scanPos = (long)std::min(senderIndexFloor, end) - 1;
+    } else {
+        q.scanPos = (long)end - 1;
+    }
+}
+
+/**
+ * @brief (Static) Finds the next message matching the query, newest first.
+ * @details Sender queries walk the sender index range and then scan only the
+ *          positions below the index floor; other queries scan the whole index.
+ *          While skipping, matches are judged from the index entry alone (sender
+ *          hash, no record read). Gives up after q.visits entries so one chunk
+ *          never holds the TCP task for long.
+ */
+static InboxMatch nextInboxMatch(InboxQuery &q, bool skipping, ArchiveIndexEntry &e, String &sender, String &scts, String &body) {
+    if (q.generation != archiveGeneration) positionInboxQuery(q);
+    while (true) {
+        if (q.visits == 0) return INBOX_YIELD;
+        long pos;
+        if (q.rangeHi > q.rangeLo) pos = senderPositions[--q.rangeHi];
+        else if (q.scanPos >= 0) pos = q.scanPos--;
+        else return INBOX_END;
+        q.visits--;
+
+        if (!readEntry(q.idx, pos, e)) return INBOX_END;
+        if (e.flags & ARCHIVE_FLAG_DELETED) continue;
+        if (q.bySender && e.senderHash != q.senderHash) continue;
+        if (e.timestamp < q.since) continue;
+        if (skipping) return INBOX_MATCH;
+        if (!readRecord(q.log, e, sender, scts, body)) continue;
+        if (q.bySender && sender != q.sender) continue; // Hash collision
+        return INBOX_MATCH;
+    }
+}
+
+/**
+ * @brief (Static) Serializes the next piece of the inbox response into q.pending.
+ * @return false once the response is complete.
+ */
+static bool produceInboxChunk(InboxQuery &q) {
+    q.pending = "";
+    q.pendingPos = 0;
+    switch (q.stage) {
+    case 0:
+        q.pending = "{\"offset\":" + String(q.offset) + ",\"limit\":" + String(q.limit) + ",\"items\":[";
+        q.stage = 1;
+        return true;
+    case 1: {
+        ArchiveIndexEntry e;
+        String sender, scts, body;
+        InboxMatch m = INBOX_MATCH;
+        while (q.skip > 0 && (m = nextInboxMatch(q, true, e, sender, scts, body)) == INBOX_MATCH) {
+            q.before = e.id;
+            q.skip--;
+        }
+        if (m == INBOX_MATCH) m = nextInboxMatch(q, false, e, sender, scts, body);
+        if (m == INBOX_YIELD) {
+            q.pending = " "; // JSON whitespace keeps the response going until the next chunk
+            return true;
+        }
+        if (m == INBOX_END) {
+            q.stage = 2;
+            return true;
+        }
+        if (q.remaining == 0) {
+            q.more = true; // One more match exists beyond this page
+            q.stage = 2;
+            return true;
+        }
+        q.before = e.id;
+        PooledJsonDocument doc;
+        buildSmsJson(doc, e, sender, scts, body);
+        if (!q.first) q.pending = ",";
+        serializeJson(doc, q.pending);
+        q.first = false;
+        q.remaining--;
+        return true;
+    }
+    case 2:
+        q.pending = "],\"next\":" + (q.more ? String(q.before) : String("null")) + "}";
+        q.stage = 3;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Serves GET /api/inbox?before=&offset=&limit=&sender=&since= from the archive.
+ * @details The response is chunked and produced one message at a time while the
+ *          TCP stack asks for data, so the full page never sits in RAM.
+ *          Results are ordered newest first; 'since' is a Unix timestamp. 'next'
+ *          is the cursor for the following page, passed back as 'before'; it stays
+ *          valid while messages arrive or the archive is compacted.
+ * @param request The incoming HTTP request.
+ */
+void handleInboxQuery(AsyncWebServerRequest *request) {
+    auto q = std::make_shared<InboxQuery>();
+    long offset = request->hasParam("offset") ? request->getParam("offset")->value().toInt() : 0;
+    q->offset = offset > 0 ? std::min((uint32_t)offset, liveCount) : 0;
+    long before = request->hasParam("before") ? request->getParam("before")->value().toInt() : 0;
+    q->before = before > 0 ? (uint32_t)before : UINT32_MAX;
+    q->limit = request->hasParam("limit") ? request->getParam("limit")->value().toInt() : ARCHIVE_LIST_LIMIT;
+    q->limit = constrain(q->limit, (uint32_t)1, (uint32_t)ARCHIVE_LIST_LIMIT);
+    q->since = request->hasParam("since") ? request->getParam("since")->value().toInt() : 0;
+    q->sender = request->hasParam("sender") ? request->getParam("sender")->value() : String("");
+    q->bySender = q->sender.length() > 0;
+    q->senderHash = fnv1a(q->sender.c_str());
+    q->skip = q->offset;
+    q->remaining = q->limit;
+    q->stage = 0;
+    q->first = true;
+    q->more = false;
+    q->pendingPos = 0;
+    q->idx = LittleFS.open(SMS_INDEX_FILE, "r");
+    q->log = LittleFS.open(SMS_LOG_FILE, "r");
+    positionInboxQuery(*q);
+
+    AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+        [q](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            size_t n = 0;
+            q->visits = ARCHIVE_QUERY_VISITS;
+            while (n < maxLen) {
+                if (q->pendingPos < q->pending.length()) {
+                    size_t chunk = std::min(maxLen - n, (size_t)(q->pending.length() - q->pendingPos));
+                    memcpy(buffer + n, q->pending.c_str() + q->pendingPos, chunk);
+                    q->pendingPos += chunk;
+                    n += chunk;
+                } else if ((q->visits == 0 && q->stage == 1) || !produceInboxChunk(*q)) {
+                    break; // Done, or the visit budget of this chunk is used up
+                }
+            }
+            return n;
+        });
+    request->send(response);
+}
+
+/**
+ * @brief Returns the number of messages in the archive (excluding deleted ones).
+ */
+uint32_t archivedMessageCount() {
+    return liveCount;
+}
+
+/**
+ * @brief Requests that all messages in a modem's SIM storage be moved into the archive.
+ * @details The sweep itself starts from handleSmsArchive() once the modem is idle.
+ * @param modem The modem whose SIM is swept.
+ */
+void requestSimSweep(uint8_t modem) {
+    simSweepRequested[modem] = true;
+}
+
+/**
+ * @brief Handles a +CMTI URC: a new message was stored on the SIM.
+ * @details The message is moved into the archive by a sweep; clients are notified
+ *          once it has been archived.
+ * @param modem The modem the message arrived on.
+ * @param line The full URC line (the storage index is not needed by the sweep).
+ */
+void handleNewSmsUrc(Modem &modem, const String &line) {
+    (void)line;
+    requestSimSweep(modem.id());
+}
+
+/**
+ * @brief Queues a SIM storage slot to be freed with AT+CMGD.
+ * @param modem The modem holding the SIM.
+ * @param simIndex The SIM storage index of an already archived message.
+ */
+void queueSimSlotDelete(uint8_t modem, int simIndex) {
+    SimDeleteQueue &q = simDeletes[modem];
+    if (q.count < SIM_DELETE_QUEUE_SIZE)
+        q.slots[q.count++] = simIndex;
+}
+
+/**
+ * @brief Main-loop task: frees archived SIM slots and starts requested sweeps.
+ * @details Only acts on modems no SMS state machine owns. One AT+CMGD is issued
+ *          per modem and call to keep each loop iteration short.
+ */
+void handleSmsArchive() {
+    for (Modem &modem : modems) {
+        uint8_t id = modem.id();
+        if (!modem.idle() || !modem.simPinOk)
+            continue;
+
+        SimDeleteQueue &q = simDeletes[id];
+        if (q.count > 0) {
+            int simIndex = q.slots[--q.count];
+            String r = modem.sendATCommand("AT+CMGD=" + String(simIndex), 5000, "OK", true);
+            if (!r.startsWith("OK"))
+                LOG_E("Archive: Failed to free SIM slot %d of modem %u: %s", simIndex, id, r.c_str());
+            continue;
+        }
+
+        if (simSweepRequested[id]) {
+            simSweepRequested[id] = false;
+            modem.startSimSweep();
+        }
+    }
+}
@@ -0,0 +1,68 @@
+/**
+ * @file    sms_archive.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Function prototypes for the persistent SMS archive.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares the interface of the append-only SMS archive on LittleFS.
+ *              Incoming messages are moved from the SIM storage into the archive,
+ *              and the web inbox is served from it.
+ */
+
+
+/**
+ * @file sms_archive.h
+ * @brief Function prototypes for the persistent SMS archive.
+ */
+
+#ifndef SMS_ARCHIVE_H
+#define SMS_ARCHIVE_H
+
+#include <Arduino.h>
+#include "urc_dispatch.h"
+
+// Forward declaration to avoid circular dependencies
+class AsyncWebServerRequest;
+
+/**
+ * @struct ArchiveIndexEntry
+ * @brief Fixed-size index record describing one archived message.
+ */
+struct ArchiveIndexEntry {
+    uint32_t id;         ///< Archive message id (monotonic, never reused)
+    uint32_t offset;     ///< Offset of the record in the log file
+    uint32_t timestamp;  ///< Service centre timestamp (Unix time, UTC)
+    uint32_t senderHash; ///< FNV-1a hash of the sender number
+    uint16_t length;     ///< Record length in the log file
+    uint8_t flags;       ///< ARCHIVE_FLAG_* bits
+    uint8_t reserved;
+};
+
+#define ARCHIVE_FLAG_READ 0x01
+#define ARCHIVE_FLAG_DELETED 0x02
+
+void initSmsArchive();
+int32_t archiveMessage(const String &sender, const String &scts, const String &body);
+void sendArchiveList();
+void readArchivedSms(uint32_t id);
+void deleteArchivedSms(uint32_t id);
+uint32_t archivedMessageCount();
+void handleInboxQuery(AsyncWebServerRequest *request);
+uint32_t sctsToEpoch(const String &scts);
+
+// --- SIM storage reclamation ---
+void requestSimSweep(uint8_t modem);
+void handleNewSmsUrc(Modem &modem, const String &line);
+
+// Merged into the URC dispatch table (urc_dispatch.cpp)
+constexpr UrcRoute smsArchiveUrcRoutes[] = {
+    {"+CMTI:", handleNewSmsUrc},
+};
+void queueSimSlotDelete(uint8_t modem, int simIndex);
+void handleSmsArchive();
+
+#endif // SMS_ARCHIVE_H
@@ -0,0 +1,215 @@
+/**
+ * @file    sms_dedup.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of duplicate suppression for incoming SMS.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description A message is identified by a 32-bit FNV-1a fingerprint of sender,
+ *              service centre timestamp and body. Fingerprints live in two
+ *              generations of an open-addressing hash set of SMS_DEDUP_SLOTS each.
+ *              When the current generation is 3/4 full, or SMS_DEDUP_WINDOW of SC
+ *              time has passed since it started, the older one is cleared and
+ *              becomes current. A message is therefore remembered for at least the
+ *              window (unless more than SLOTS * 3/4 newer messages arrive first),
+ *              in fixed memory. The file mirrors both generations, and an insert
+ *              rewrites only its own 4-byte slot, so the store survives reboots
+ *              at little flash wear.
+ */
+
+
+/**
+ * @file sms_dedup.cpp
+ * @brief Implementation of duplicate suppression for incoming SMS.
+ */
+
+#include "config.h"
+#include "sms_dedup.h"
+#include "logger.h"
+#include "sms_archive.h" // For sctsToEpoch
+
+#define DEDUP_FILE_MAGIC 0x50554447 // "GDUP"
+#define DEDUP_FILE_VERSION 1
+#define DEDUP_GENERATION_LIMIT (SMS_DEDUP_SLOTS * 3 / 4) // Keeps probe chains short
+
+static_assert((SMS_DEDUP_SLOTS & (SMS_DEDUP_SLOTS - 1)) == 0, "SMS_DEDUP_SLOTS must be a power of two");
+
+/**
+ * @struct DedupFileHeader
+ * @brief Header of the fingerprint file; a size mismatch resets the file.
+ */
+struct DedupFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t slots;
+    uint8_t current;      // Generation receiving new fingerprints
+    uint8_t reserved[3];
+    uint32_t startedAt[2]; // SC time of the first message of each generation (0 = empty)
+};
+
+static uint32_t generations[2][SMS_DEDUP_SLOTS]; // 0 = empty slot
+static uint16_t generationCount[2];
+static DedupFileHeader header;
+static bool fileReady = false;
+static uint32_t suppressedCount = 0;
+
+/**
+ * @brief (Static) Continues an FNV-1a hash over a string and its terminating NUL.
+ * @details Hashing the NUL separates the fields, so "ab"+"c" and "a"+"bc" differ.
+ */
+static uint32_t fnv1aAppend(uint32_t h, const String &s) {
+    const char *p = s.c_str();
+    for (unsigned int i = 0; i <= s.length(); i++) {
+        h ^= (uint8_t)p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief (Static) Finds the slot holding a fingerprint, or the empty slot ending its probe chain.
+ */
+static uint16_t probe(const uint32_t *table, uint32_t fingerprint) {
+    uint16_t i = fingerprint & (SMS_DEDUP_SLOTS - 1);
+    while (table[i] != 0 && table[i] != fingerprint)
+        i = (i + 1) & (SMS_DEDUP_SLOTS - 1);
+    return i;
+}
+
+/**
+ * @brief (Static) Returns the file offset of a slot of a generation.
+ */
+static uint32_t slotOffset(uint8_t generation, uint16_t slot) {
+    return sizeof(DedupFileHeader) + ((uint32_t)generation * SMS_DEDUP_SLOTS + slot) * sizeof(uint32_t);
+}
+
+/**
+ * @brief (Static) Writes the header and one whole generation to the file.
+ */
+static void writeGeneration(uint8_t generation) {
+    if (!fileReady) return;
+    File f = LittleFS.open(SMS_DEDUP_FILE, "r+");
+    if (!f) return;
+    f.write((const uint8_t *)&header, sizeof(header));
+    if (f.seek(slotOffset(generation, 0), SeekSet))
+        f.write((const uint8_t *)generations[generation], sizeof(generations[generation]));
+    f.close();
+}
+
+/**
+ * @brief (Static) Clears the older generation and makes it the current one.
+ */
+static void rotate(uint32_t epoch) {
+    uint8_t next = header.current ^ 1;
+    memset(generations[next], 0, sizeof(generations[next]));
+    generationCount[next] = 0;
+    header.current = next;
+    header.startedAt[next] = epoch;
+    writeGeneration(next);
+    LOG_I("Dedup: New generation, %u fingerprints kept from the last one.", generationCount[next ^ 1]);
+}
+
+/**
+ * @brief Loads the fingerprint store from flash, creating the file if needed.
+ */
+void initSmsDedup() {
+    DedupFileHeader expected = {DEDUP_FILE_MAGIC, DEDUP_FILE_VERSION, SMS_DEDUP_SLOTS, 0, {}, {}};
+    uint32_t fileSize = slotOffset(2, 0);
+    File f = LittleFS.open(SMS_DEDUP_FILE, "r");
+    bool valid = f && f.size() == fileSize && f.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+                 header.magic == expected.magic && header.version == expected.version &&
+                 header.slots == expected.slots && header.current <= 1 &&
+                 f.read((uint8_t *)generations, sizeof(generations)) == sizeof(generations);
+    if (f) f.close();
+
+    if (!valid) {
+        LOG_I("Dedup: Creating fingerprint file.");
+        header = expected;
+        memset(generations, 0, sizeof(generations));
+        f = LittleFS.open(SMS_DEDUP_FILE, "w");
+        if (!f) return;
+        f.write((const uint8_t *)&header, sizeof(header));
+        f.write((const uint8_t *)generations, sizeof(generations));
+        f.close();
+    }
+    for (uint8_t g = 0; g < 2; g++) {
+        generationCount[g] = 0;
+        for (uint32_t fp : generations[g])
+            if (fp != 0) generationCount[g]++;
+    }
+    fileReady = true;
+    LOG_I("Dedup: %u fingerprints loaded.", generationCount[0] + generationCount[1]);
+}
+
+/**
+ * @brief Computes the fingerprint of a received message.
+ * @param sender The originating address.
+ * @param scts The service centre timestamp as reported by the modem.
+ * @param body The decoded message text.
+ * @return A non-zero 32-bit fingerprint.
+ */
+uint32_t smsFingerprint(const String &sender, const String &scts, const String &body) {
+    uint32_t h = 2166136261u;
+    h = fnv1aAppend(h, sender);
+    h = fnv1aAppend(h, scts);
+    h = fnv1aAppend(h, body);
+    return h != 0 ? h : 1; // 0 marks an empty slot
+}
+
+/**
+ * @brief Checks whether a message was already delivered, counting it if so.
+ * @param fingerprint The message fingerprint from smsFingerprint().
+ * @return true if the message should be suppressed.
+ */
+bool isDuplicateSms(uint32_t fingerprint) {
+    for (uint8_t g = 0; g < 2; g++) {
+        if (generations[g][probe(generations[g], fingerprint)] == fingerprint) {
+            suppressedCount++;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Records a delivered message so later copies are suppressed.
+ * @param fingerprint The message fingerprint from smsFingerprint().
+ * @param scts The service centre timestamp, which also ages the generations.
+ */
+void rememberSms(uint32_t fingerprint, const String &scts) {
+    uint32_t epoch = sctsToEpoch(scts);
+    uint8_t g = header.current;
+    bool expired = header.startedAt[g] != 0 && epoch > header.startedAt[g] &&
+                   epoch - header.startedAt[g] >= SMS_DEDUP_WINDOW;
+    if (generationCount[g] >= DEDUP_GENERATION_LIMIT || expired) {
+        rotate(epoch);
+        g = header.current;
+    }
+
+    uint16_t slot = probe(generations[g], fingerprint);
+    if (generations[g][slot] == fingerprint) return;
+    generations[g][slot] = fingerprint;
+    generationCount[g]++;
+    bool started = header.startedAt[g] == 0 && epoch != 0;
+    if (started) header.startedAt[g] = epoch;
+
+    if (!fileReady) return;
+    File f = LittleFS.open(SMS_DEDUP_FILE, "r+");
+    if (!f) return;
+    if (started) f.write((const uint8_t *)&header, sizeof(header));
+    if (f.seek(slotOffset(g, slot), SeekSet))
+        f.write((const uint8_t *)&fingerprint, sizeof(fingerprint));
+    f.close();
+}
+
+/**
+ * @brief Writes the suppression statistics into a JSON object.
+ */
+void smsDedupStatsToJson(JsonObject obj) {
+    obj["suppressed"] = suppressedCount;
+    obj["entries"] = generationCount[0] + generationCount[1];
+    obj["size"] = 2 * DEDUP_GENERATION_LIMIT;
+}
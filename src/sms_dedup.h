@@ -0,0 +1,35 @@
+/**
+ * @file    sms_dedup.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Duplicate suppression for incoming SMS.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares the fingerprint store consulted before a received message
+ *              is archived and published. A message that was already delivered
+ *              (re-read after a reset, retransmitted by the network) is dropped
+ *              from the SIM without reaching the clients a second time.
+ */
+
+
+/**
+ * @file sms_dedup.h
+ * @brief Duplicate suppression for incoming SMS.
+ */
+
+#ifndef SMS_DEDUP_H
+#define SMS_DEDUP_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+void initSmsDedup();
+uint32_t smsFingerprint(const String &sender, const String &scts, const String &body);
+bool isDuplicateSms(uint32_t fingerprint);
+void rememberSms(uint32_t fingerprint, const String &scts);
+void smsDedupStatsToJson(JsonObject obj);
+
+#endif // SMS_DEDUP_H
@@ -0,0 +1,416 @@
+/**
+ * @file    sms_rules.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of the SMS rule engine.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description All rule conditions are compiled at load time into one Aho-Corasick
+ *              automaton, so matching a message is a single pass over its sender
+ *              and body, however many rules there are. The scanned text is
+ *              SENDER_MARK + sender + BODY_MARK + body: a sender condition is the
+ *              pattern SENDER_MARK + prefix, which can only match at the start,
+ *              and keyword hits are only counted inside the body. Each condition
+ *              owns one bit of a 32-bit mask (two per rule), propagated along the
+ *              failure links when the automaton is built.
+ */
+
+
+/**
+ * @file sms_rules.cpp
+ * @brief Implementation of the SMS rule engine.
+ */
+
+#include "config.h"
+#include "sms_rules.h"
+#include "logger.h"
+#include "sim_handler.h"  // For sendSMS
+#include "ussd_session.h" // For requestUssd
+
+#define SENDER_MARK '\x01'
+#define BODY_MARK '\x02'
+#define KEYWORD_BIT(rule) (1UL << (2 * (rule)))
+#define SENDER_BIT(rule) (1UL << (2 * (rule) + 1))
+#define SENDER_BITS ((uint32_t)0xAAAAAAAAUL) // Every SENDER_BIT()
+
+static_assert(SMS_RULES_MAX <= 16, "Two condition bits per rule must fit in 32 bits");
+static_assert(SMS_RULES_MAX_NODES <= 65535, "Node links are 16 bits");
+
+enum SmsRuleAction : uint8_t { RULE_REPLY, RULE_FORWARD, RULE_USSD, RULE_TAG };
+
+/**
+ * @struct SmsRule
+ * @brief One loaded rule: the condition bits it needs and what it does.
+ */
+struct SmsRule {
+    uint32_t required;
+    SmsRuleAction action;
+    String value;
+};
+
+/**
+ * @struct AcNode
+ * @brief Automaton state; its children form a sibling list (0 = none, the root is never a child).
+ */
+struct AcNode {
+    uint16_t fail;
+    uint16_t child;
+    uint16_t sibling;
+    uint8_t ch;
+};
+
+static const char *const actionNames[] = {"reply", "forward", "ussd", "tag"};
+
+static SmsRule rules[SMS_RULES_MAX];
+static uint8_t ruleCount = 0;
+static AcNode nodes[SMS_RULES_MAX_NODES];
+static uint32_t nodeOutput[SMS_RULES_MAX_NODES]; // Condition bits of the patterns ending here
+static uint16_t nodeCount = 0;
+static uint32_t rulesFired = 0;
+static String pendingRules;        // Uploaded rules waiting for the main loop
+static bool rulesPending = false;
+
+/**
+ * @struct RecentAction
+ * @brief A rule that sent an SMS or USSD for a sender, to stop loops with other robots.
+ */
+struct RecentAction {
+    uint32_t key; // Hash of the rule number and the sender
+    unsigned long at;
+};
+static RecentAction recentActions[8];
+
+/**
+ * @brief (Static) Folds ASCII letters to lower case; other bytes (e.g. UTF-8) are kept.
+ */
+static uint8_t fold(uint8_t c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+/**
+ * @brief (Static) Returns the child of a state for a byte, or 0 if there is none.
+ */
+static uint16_t childOf(uint16_t state, uint8_t c) {
+    for (uint16_t n = nodes[state].child; n != 0; n = nodes[n].sibling) {
+        if (nodes[n].ch == c) return n;
+    }
+    return 0;
+}
+
+/**
+ * @brief (Static) Follows the automaton from a state over one byte.
+ */
+static uint16_t step(uint16_t state, uint8_t c) {
+    for (;;) {
+        uint16_t next = childOf(state, c);
+        if (next != 0) return next;
+        if (state == 0) return 0;
+        state = nodes[state].fail;
+    }
+}
+
+/**
+ * @brief (Static) Adds a pattern to the trie.
+ * @param prefix An optional leading byte (SENDER_MARK), or 0.
+ * @return false if the automaton is out of nodes.
+ */
+static bool addPattern(char prefix, const char *pattern, uint32_t bit) {
+    uint16_t state = 0;
+    for (const char *p = pattern; prefix != 0 || *p != '\0';) {
+        uint8_t c = prefix != 0 ? (uint8_t)prefix : fold(*p++);
+        prefix = 0;
+        uint16_t next = childOf(state, c);
+        if (next == 0) {
+            if (nodeCount >= SMS_RULES_MAX_NODES) return false;
+            next = nodeCount++;
+            nodes[next] = {0, 0, nodes[state].child, c};
+            nodeOutput[next] = 0;
+            nodes[state].child = next;
+        }
+        state = next;
+    }
+    nodeOutput[state] |= bit;
+    return true;
+}
+
+/**
+ * @brief (Static) Computes the failure links breadth-first and merges the outputs along them.
+ */
+static void buildFailureLinks() {
+    uint16_t queue[SMS_RULES_MAX_NODES];
+    uint16_t head = 0, tail = 0;
+    for (uint16_t n = nodes[0].child; n != 0; n = nodes[n].sibling) {
+        nodes[n].fail = 0;
+        queue[tail++] = n;
+    }
+    while (head < tail) {
+        uint16_t u = queue[head++];
+        for (uint16_t v = nodes[u].child; v != 0; v = nodes[v].sibling) {
+            nodes[v].fail = step(nodes[u].fail, nodes[v].ch);
+            nodeOutput[v] |= nodeOutput[nodes[v].fail];
+            queue[tail++] = v;
+        }
+    }
+}
+
+/**
+ * @brief (Static) Compiles a JSON rules array into the rule table and automaton.
+ * @return false if the JSON is invalid; the engine is then left without rules.
+ */
+static bool compileRules(const String &json) {
+    ruleCount = 0;
+    nodeCount = 1;
+    nodes[0] = {0, 0, 0, 0};
+    nodeOutput[0] = 0;
+
+    JsonDocument doc;
+    DeserializationError err = deserializeJson(doc, json);
+    if (err || !doc.is<JsonArrayConst>()) {
+        LOG_E("Rules: Invalid rules file (%s).", err ? err.c_str() : "not an array");
+        return false;
+    }
+
+    uint8_t position = 0;
+    for (JsonObjectConst r : doc.as<JsonArrayConst>()) {
+        position++;
+        if (ruleCount >= SMS_RULES_MAX) {
+            LOG_W("Rules: Only the first %d rules are used.", SMS_RULES_MAX);
+            break;
+        }
+        const char *keyword = r["keyword"] | "";
+        const char *sender = r["sender"] | "";
+        const char *action = r["action"] | "";
+        SmsRule &rule = rules[ruleCount];
+        uint8_t a = 0;
+        while (a < 4 && strcmp(action, actionNames[a]) != 0) a++;
+        if (a == 4 || (keyword[0] == '\0' && sender[0] == '\0')) {
+            LOG_W("Rules: Skipping rule %u (needs an action and a keyword or sender).", position);
+            continue;
+        }
+        rule.action = (SmsRuleAction)a;
+        rule.value = r["value"] | "";
+        rule.required = 0;
+        bool added = true;
+        if (keyword[0] != '\0') {
+            rule.required |= KEYWORD_BIT(ruleCount);
+            added = addPattern(0, keyword, KEYWORD_BIT(ruleCount));
+        }
+        if (sender[0] != '\0' && added) {
+            rule.required |= SENDER_BIT(ruleCount);
+            added = addPattern(SENDER_MARK, sender, SENDER_BIT(ruleCount));
+        }
+        if (!added) {
+            LOG_W("Rules: Patterns too long, only the first %u rules are used.", ruleCount);
+            for (uint16_t n = 0; n < nodeCount; n++)
+                nodeOutput[n] &= KEYWORD_BIT(ruleCount) - 1; // Drop the partly added rule
+            break;
+        }
+        ruleCount++;
+    }
+    buildFailureLinks();
+    LOG_I("Rules: %u rules, %u automaton states.", ruleCount, nodeCount);
+    return true;
+}
+
+/**
+ * @brief (Static) Feeds text into the automaton and collects the condition bits it hits.
+ * @details A marker byte inside the text only returns the automaton to its root, so
+ *          a sender or body cannot start a sender pattern of its own.
+ */
+static void scan(uint16_t &state, const String &text, uint32_t mask, uint32_t &matched) {
+    const char *p = text.c_str();
+    for (unsigned int i = 0; i < text.length(); i++) {
+        uint8_t c = fold(p[i]);
+        if (c == SENDER_MARK || c == BODY_MARK) {
+            state = 0;
+            continue;
+        }
+        state = step(state, c);
+        matched |= nodeOutput[state] & mask;
+    }
+}
+
+/**
+ * @brief (Static) Returns true if a rule acted on the sender recently; records it otherwise.
+ * @details Every paid action (reply, forward, USSD) goes through here, so a rule
+ *          that answers another gateway or robot fires once per cooldown, not per SMS.
+ */
+static bool actionCoolingDown(uint8_t rule, const String &sender) {
+    uint32_t h = 2166136261u ^ rule;
+    h *= 16777619u;
+    for (unsigned int i = 0; i < sender.length(); i++) {
+        h ^= (uint8_t)sender.charAt(i);
+        h *= 16777619u;
+    }
+    RecentAction *oldest = &recentActions[0];
+    for (RecentAction &r : recentActions) {
+        if (r.at != 0 && r.key == h && millis() - r.at < SMS_RULES_ACTION_COOLDOWN) return true;
+        if (millis() - r.at > millis() - oldest->at) oldest = &r;
+    }
+    oldest->key = h;
+    oldest->at = millis() | 1; // 0 marks an unused entry
+    return false;
+}
+
+/**
+ * @brief (Static) Returns true if two phone numbers are the same subscriber.
+ * @details Compares the last 9 digits, so "+963912345678" and "0912345678" match.
+ */
+static bool sameNumber(const String &a, const String &b) {
+    int i = a.length() - 1, j = b.length() - 1, compared = 0;
+    while (compared < 9) {
+        while (i >= 0 && !isDigit(a.charAt(i))) i--;
+        while (j >= 0 && !isDigit(b.charAt(j))) j--;
+        if (i < 0 || j < 0) return i < 0 && j < 0 && compared > 0;
+        if (a.charAt(i--) != b.charAt(j--)) return false;
+        compared++;
+    }
+    return true;
+}
+
+/**
+ * @brief (Static) Cuts a text to what fits in one SMS (160 GSM or 70 UCS-2 characters).
+ */
+static String fitOneSms(const String &text) {
+    bool ascii = true;
+    for (unsigned int i = 0; i < text.length() && ascii; i++) ascii = (uint8_t)text.charAt(i) < 0x80;
+    unsigned int limit = ascii ? 160 : 70, chars = 0, i = 0;
+    for (; i < text.length(); i++) {
+        if (((uint8_t)text.charAt(i) & 0xC0) != 0x80 && ++chars > limit) break; // UTF-8 lead byte
+    }
+    return text.substring(0, i);
+}
+
+/**
+ * @brief Loads and compiles the rules file. Called once at boot.
+ */
+void initSmsRules() {
+    File f = LittleFS.open(SMS_RULES_FILE, "r");
+    if (!f || f.size() == 0) {
+        if (f) f.close();
+        LOG_I("Rules: No rules file.");
+        ruleCount = 0;
+        return;
+    }
+    if (f.size() > SMS_RULES_MAX_FILE) {
+        LOG_E("Rules: Rules file is larger than %d bytes.", SMS_RULES_MAX_FILE);
+        f.close();
+        ruleCount = 0;
+        return;
+    }
+    String json = f.readString();
+    f.close();
+    compileRules(json);
+}
+
+/**
+ * @brief (Static) Replaces the rules with a new JSON rules array and saves it.
+ * @details On any failure the saved rules are loaded again, so the rules in
+ *          effect always match the rules file.
+ */
+static void importSmsRules(const String &json) {
+    if (json.length() > SMS_RULES_MAX_FILE || !compileRules(json)) {
+        LOG_W("Rules: Uploaded rules are invalid, the previous rules stay in effect.");
+        initSmsRules();
+        return;
+    }
+    File f = LittleFS.open(SMS_RULES_FILE, "w");
+    size_t written = f ? f.print(json) : 0;
+    if (f) f.close();
+    if (written != json.length()) {
+        LOG_E("Rules: Failed to save the uploaded rules, reloading the saved ones.");
+        initSmsRules();
+        return;
+    }
+    LOG_I("Rules: Uploaded rules saved.");
+}
+
+/**
+ * @brief Hands an uploaded rules array to the main loop, which compiles and saves it.
+ * @details Called from the HTTP callback, which must not parse or write flash.
+ * @return false if the upload is too large or the previous one is still pending.
+ */
+bool queueSmsRules(const String &json) {
+    if (rulesPending || json.length() > SMS_RULES_MAX_FILE) return false;
+    pendingRules = json;
+    rulesPending = true;
+    return true;
+}
+
+/**
+ * @brief Main-loop task: applies rules queued by queueSmsRules().
+ */
+void handleSmsRules() {
+    if (!rulesPending) return;
+    importSmsRules(pendingRules);
+    pendingRules = String();
+    rulesPending = false;
+}
+
+/**
+ * @brief Reads the saved rules file (an empty array if there is none).
+ */
+void exportSmsRules(String &out) {
+    File f = LittleFS.open(SMS_RULES_FILE, "r");
+    out = f ? f.readString() : String("[]");
+    if (f) f.close();
+}
+
+/**
+ * @brief Runs the rules against a received message.
+ * @details Actions are queued (SMS through the send scheduler, USSD as a session
+ *          without an owning client), so this never blocks the receive path.
+ * @param sender The originating address.
+ * @param body The decoded message text.
+ * @param item The message event being built; matching "tag" rules add to its "tags".
+ */
+void applySmsRules(const String &sender, const String &body, JsonObject item) {
+    if (ruleCount == 0) return;
+
+    uint16_t state = step(0, SENDER_MARK);
+    uint32_t matched = nodeOutput[state] & SENDER_BITS;
+    scan(state, sender, SENDER_BITS, matched);
+    state = step(state, BODY_MARK);
+    scan(state, body, ~SENDER_BITS, matched); // Sender conditions only count in the sender
+    if (matched == 0) return;
+
+    for (uint8_t i = 0; i < ruleCount; i++) {
+        const SmsRule &rule = rules[i];
+        if ((matched & rule.required) != rule.required) continue;
+        rulesFired++;
+        LOG_I("Rules: Rule %u (%s) matched SMS from %s.", i + 1, actionNames[rule.action], sender.c_str());
+        switch (rule.action) {
+        case RULE_REPLY:
+            // Alphanumeric senders (e.g. operator notices) cannot be answered
+            if (sender.length() > 0 && (sender.charAt(0) == '+' || isDigit(sender.charAt(0))) &&
+                !actionCoolingDown(i, sender))
+                sendSMS(sender, rule.value);
+            break;
+        case RULE_FORWARD:
+            // Never back to where it came from, which would forward it again
+            if (!sameNumber(sender, rule.value) && !actionCoolingDown(i, sender))
+                sendSMS(rule.value, fitOneSms(sender + ": " + body));
+            break;
+        case RULE_USSD:
+            if (!actionCoolingDown(i, sender))
+                requestUssd(USSD_NO_OWNER, rule.value);
+            break;
+        case RULE_TAG:
+            if (!item["tags"].is<JsonArray>()) item["tags"].to<JsonArray>();
+            item["tags"].add(rule.value);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Writes the rule engine statistics into a JSON object.
+ */
+void smsRulesStatsToJson(JsonObject obj) {
+    obj["rules"] = ruleCount;
+    obj["states"] = nodeCount;
+    obj["fired"] = rulesFired;
+}
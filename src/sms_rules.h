@@ -0,0 +1,42 @@
+/**
+ * @file    sms_rules.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Keyword and sender rules for incoming SMS.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares the rule engine that reacts to received messages on the
+ *              gateway itself: auto-reply to the sender, forward to a number, run
+ *              a USSD code, or tag the message for the clients. Rules are read from
+ *              SMS_RULES_FILE, a JSON array such as
+ *              [{"keyword":"balance","action":"ussd","value":"*150#"},
+ *               {"sender":"+9639","keyword":"stop","action":"reply","value":"Bye"}]
+ *              A rule fires when all of its conditions match: "keyword" anywhere
+ *              in the body (ASCII case-insensitive), "sender" as a number prefix.
+ *              Rules are read and replaced through /api/rules in AP mode only,
+ *              since a "forward" rule can send every incoming SMS elsewhere.
+ */
+
+
+/**
+ * @file sms_rules.h
+ * @brief Keyword and sender rules for incoming SMS.
+ */
+
+#ifndef SMS_RULES_H
+#define SMS_RULES_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+void initSmsRules();
+bool queueSmsRules(const String &json);
+void handleSmsRules();
+void exportSmsRules(String &out);
+void applySmsRules(const String &sender, const String &body, JsonObject item);
+void smsRulesStatsToJson(JsonObject obj);
+
+#endif // SMS_RULES_H
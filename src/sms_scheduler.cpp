@@ -0,0 +1,323 @@
+/**
+ * @file    sms_scheduler.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of the outbound SMS send scheduler.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Queues outbound SMS and releases them to the modems' send state
+ *              machines. Every modem has its own lane with two token buckets
+ *              (per-minute and per-hour, since operators limit each SIM), and each job
+ *              goes to the least loaded lane whose modem is registered and healthy.
+ *              Congestion-type +CMS ERROR codes halve a lane's pace and pause it with
+ *              an exponential back-off; successful sends ramp the pace back up.
+ */
+
+
+/**
+ * @file sms_scheduler.cpp
+ * @brief Implementation of the outbound SMS send scheduler.
+ */
+
+#include "config.h"
+#include "sms_scheduler.h"
+#include "logger.h"
+#include "json_arena.h"
+#include "sim_handler.h" // For modems
+#include "web_server.h"  // For notifyClients
+
+/**
+ * @struct SmsJob
+ * @brief An outbound SMS waiting in the queue.
+ */
+struct SmsJob {
+    uint32_t id;
+    uint8_t attempts;
+    String number;
+    String message;
+};
+
+/**
+ * @struct TokenBucket
+ * @brief A token bucket refilled continuously up to its capacity.
+ */
+struct TokenBucket {
+    float tokens;
+    float capacity;
+    float refillPerMs;
+};
+
+/**
+ * @struct SmsLane
+ * @brief Send state of one modem: its rate limits, pace, back-off and current job.
+ */
+struct SmsLane {
+    TokenBucket minuteBucket;
+    TokenBucket hourBucket;
+    float sendPace;              // Fraction of the configured rate currently allowed
+    bool backingOff;
+    unsigned long backoffUntil;
+    unsigned long backoffDelay;
+    uint8_t successStreak;
+    SmsJob inFlightJob;
+    bool jobInFlight;
+    uint32_t jobsStarted;
+};
+
+static SmsJob smsQueue[SMS_QUEUE_SIZE];
+static uint8_t queueHead = 0;
+static uint8_t queueCount = 0;
+static uint32_t lastJobId = 0;
+
+static SmsLane lanes[MODEM_COUNT];
+static unsigned long lastRefill = 0;
+
+/**
+ * @brief (Static) Returns true for +CMS ERROR codes that indicate network congestion
+ *        or throttling, where retrying later is expected to succeed.
+ */
+static bool isCongestionError(int cmsError) {
+    switch (cmsError) {
+    case 38:  // Network out of order
+    case 41:  // Temporary failure
+    case 42:  // Congestion
+    case 47:  // Resources unavailable
+    case 331: // No network service
+    case 332: // Network timeout
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief (Static) Adds the tokens earned since the last refill to the buckets of every lane.
+ */
+static void refillBuckets() {
+    unsigned long now = millis();
+    unsigned long elapsed = now - lastRefill;
+    lastRefill = now;
+    for (SmsLane &lane : lanes) {
+        TokenBucket &m = lane.minuteBucket;
+        TokenBucket &h = lane.hourBucket;
+        m.tokens = std::min(m.capacity, m.tokens + elapsed * m.refillPerMs * lane.sendPace);
+        h.tokens = std::min(h.capacity, h.tokens + elapsed * h.refillPerMs * lane.sendPace);
+    }
+}
+
+/**
+ * @brief (Static) Picks the modem for the next job: the least loaded lane whose modem
+ *        is ready and idle and which is not backing off and holds tokens.
+ * @details Load is the share of the per-minute budget used recently; ties go to the
+ *          modem that has started fewer jobs.
+ * @return The modem index, or -1 if no modem can take a job now.
+ */
+static int pickLane() {
+    int best = -1;
+    float bestLoad = 0;
+    for (uint8_t i = 0; i < MODEM_COUNT; i++) {
+        SmsLane &lane = lanes[i];
+        if (lane.jobInFlight || !modems[i].ready() || !modems[i].idle()) continue;
+        if (lane.backingOff) {
+            if ((long)(millis() - lane.backoffUntil) < 0) continue;
+            lane.backingOff = false;
+            LOG_I("SMS scheduler: Back-off of modem %u finished, resuming.", i);
+        }
+        if (lane.minuteBucket.tokens < 1.0f || lane.hourBucket.tokens < 1.0f) continue;
+        float load = 1.0f - lane.minuteBucket.tokens / lane.minuteBucket.capacity;
+        if (best < 0 || load < bestLoad || (load == bestLoad && lane.jobsStarted < lanes[best].jobsStarted)) {
+            best = i;
+            bestLoad = load;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief (Static) Inserts a job at the front of the queue (used for retries).
+ * @return true on success, false if the queue is full.
+ */
+static bool pushFront(const SmsJob &job) {
+    if (queueCount >= SMS_QUEUE_SIZE) return false;
+    queueHead = (queueHead + SMS_QUEUE_SIZE - 1) % SMS_QUEUE_SIZE;
+    smsQueue[queueHead] = job;
+    queueCount++;
+    return true;
+}
+
+/**
+ * @brief (Static) Notifies the clients that a job is waiting in the queue.
+ */
+static void notifyQueued(const SmsJob &job, uint8_t position) {
+    PooledJsonDocument doc;
+    doc["job"] = job.id;
+    doc["position"] = position;
+    doc["queue_depth"] = queueCount;
+    if (job.attempts > 0) doc["retry"] = job.attempts;
+    String s;
+    serializeJson(doc, s);
+    notifyClients("sms_queued", s);
+}
+
+/**
+ * @brief Initializes the token buckets from the configured send limits.
+ */
+void initSmsScheduler() {
+    int perMinute = config.sms_per_minute > 0 ? config.sms_per_minute : SMS_DEFAULT_PER_MINUTE;
+    int perHour = config.sms_per_hour > 0 ? config.sms_per_hour : SMS_DEFAULT_PER_HOUR;
+    for (SmsLane &lane : lanes) {
+        lane.minuteBucket.capacity = perMinute;
+        lane.minuteBucket.refillPerMs = perMinute / 60000.0f;
+        lane.minuteBucket.tokens = lane.minuteBucket.capacity;
+        lane.hourBucket.capacity = perHour;
+        lane.hourBucket.refillPerMs = perHour / 3600000.0f;
+        lane.hourBucket.tokens = lane.hourBucket.capacity;
+        lane.sendPace = 1.0f;
+        lane.backoffDelay = SMS_BACKOFF_BASE;
+    }
+    lastRefill = millis();
+    LOG_I("SMS scheduler: %d/min, %d/hour per modem, %d modem(s).", perMinute, perHour, MODEM_COUNT);
+}
+
+/**
+ * @brief Adds an SMS to the send queue.
+ * @param number The destination phone number.
+ * @param message The message content.
+ * @return The job id, or 0 if the queue is full.
+ */
+uint32_t enqueueSms(const String &number, const String &message) {
+    if (queueCount >= SMS_QUEUE_SIZE) {
+        LOG_W("SMS queue full, rejecting job.");
+        return 0;
+    }
+    SmsJob &job = smsQueue[(queueHead + queueCount) % SMS_QUEUE_SIZE];
+    job.id = ++lastJobId;
+    job.attempts = 0;
+    job.number = number;
+    job.message = message;
+    queueCount++;
+    notifyQueued(job, queueCount);
+    return job.id;
+}
+
+/**
+ * @brief Releases queued SMS to the modems when the rates allow.
+ * @details Called from the main loop. Each job goes to the least loaded modem that is
+ *          ready, idle and not backing off, and whose token buckets hold a token.
+ */
+void handleSmsScheduler() {
+    refillBuckets();
+    while (queueCount > 0) {
+        int i = pickLane();
+        if (i < 0) return;
+        SmsLane &lane = lanes[i];
+        lane.minuteBucket.tokens -= 1.0f;
+        lane.hourBucket.tokens -= 1.0f;
+        lane.inFlightJob = smsQueue[queueHead];
+        smsQueue[queueHead].number = "";
+        smsQueue[queueHead].message = "";
+        queueHead = (queueHead + 1) % SMS_QUEUE_SIZE;
+        queueCount--;
+        lane.inFlightJob.attempts++;
+        lane.jobInFlight = true;
+        lane.jobsStarted++;
+        modems[i].startSmsJob(lane.inFlightJob.id, lane.inFlightJob.number, lane.inFlightJob.message);
+    }
+}
+
+/**
+ * @brief Reports the outcome of the job a modem was given by the scheduler.
+ * @details Congestion errors slow that modem's pace down (multiplicative decrease) and
+ *          pause it; successes ramp it back up (additive increase).
+ * @param modem The modem that ran the job.
+ * @param ok true if the modem confirmed the send.
+ * @param cmsError The numeric +CMS ERROR code, or -1 if there was none.
+ * @return true if the job was re-queued for another attempt and should not be
+ *         reported as failed yet.
+ */
+bool smsSchedulerOnResult(uint8_t modem, bool ok, int cmsError) {
+    SmsLane &lane = lanes[modem];
+    if (!lane.jobInFlight) return false;
+    lane.jobInFlight = false;
+
+    if (ok) {
+        if (lane.sendPace < 1.0f) {
+            lane.sendPace = std::min(1.0f, lane.sendPace + SMS_PACE_STEP);
+            LOG_I("SMS scheduler: Pace of modem %u raised to %.2f.", modem, lane.sendPace);
+        }
+        if (++lane.successStreak >= 3) lane.backoffDelay = SMS_BACKOFF_BASE;
+        lane.inFlightJob.number = "";
+        lane.inFlightJob.message = "";
+        return false;
+    }
+
+    lane.successStreak = 0;
+    if (!isCongestionError(cmsError)) return false;
+
+    lane.sendPace = std::max(SMS_PACE_MIN, lane.sendPace / 2.0f);
+    lane.minuteBucket.tokens = 0;
+    lane.backingOff = true;
+    lane.backoffUntil = millis() + lane.backoffDelay;
+    LOG_W("SMS scheduler: +CMS ERROR %d on modem %u, pace %.2f, backing off %lu ms.", cmsError, modem,
+          lane.sendPace, lane.backoffDelay);
+    lane.backoffDelay = std::min(lane.backoffDelay * 2, SMS_BACKOFF_MAX);
+
+    // The retry may go out on another modem that is not congested
+    if (lane.inFlightJob.attempts < SMS_MAX_ATTEMPTS && pushFront(lane.inFlightJob)) {
+        notifyQueued(lane.inFlightJob, 1);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Puts the job a modem was given back at the front of the queue.
+ * @details Used when the modem stopped answering before the message was submitted,
+ *          so the job is sent again by a modem that answers.
+ * @param modem The modem that was running the job.
+ * @return true if the job was re-queued, false if it has used up its attempts
+ *         (it should then be reported as failed).
+ */
+bool smsSchedulerRequeue(uint8_t modem) {
+    SmsLane &lane = lanes[modem];
+    if (!lane.jobInFlight) return false;
+    if (lane.inFlightJob.attempts >= SMS_MAX_ATTEMPTS) return false;
+    if (!pushFront(lane.inFlightJob)) return false;
+    lane.jobInFlight = false;
+    notifyQueued(lane.inFlightJob, 1);
+    return true;
+}
+
+/**
+ * @brief Returns the number of SMS waiting in the queue.
+ */
+uint8_t smsQueueDepth() {
+    return queueCount;
+}
+
+/**
+ * @brief Returns the currently allowed sustained send rate of all modems, in SMS per minute.
+ */
+float smsSendRate() {
+    float rate = 0;
+    for (const SmsLane &lane : lanes)
+        rate += std::min(lane.minuteBucket.capacity, lane.hourBucket.capacity / 60.0f) * lane.sendPace;
+    return rate;
+}
+
+/**
+ * @brief Returns the time until a backing-off modem may send again, in milliseconds
+ *        (0 if any modem is not backing off).
+ */
+unsigned long smsBackoffRemaining() {
+    unsigned long remaining = 0;
+    for (const SmsLane &lane : lanes) {
+        if (!lane.backingOff || (long)(millis() - lane.backoffUntil) >= 0) return 0;
+        unsigned long left = lane.backoffUntil - millis();
+        if (remaining == 0 || left < remaining) remaining = left;
+    }
+    return remaining;
+}
@@ -0,0 +1,38 @@
+/**
+ * @file    sms_scheduler.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Function prototypes for the outbound SMS send scheduler.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares the queue and token-bucket rate limiter that sits in front of
+ *              the SMS send state machine, including the adaptive back-off applied
+ *              when the operator answers with congestion-type +CMS ERROR codes.
+ */
+
+
+/**
+ * @file sms_scheduler.h
+ * @brief Function prototypes for the outbound SMS send scheduler.
+ */
+
+#ifndef SMS_SCHEDULER_H
+#define SMS_SCHEDULER_H
+
+#include <Arduino.h>
+
+void initSmsScheduler();
+uint32_t enqueueSms(const String &number, const String &message);
+void handleSmsScheduler();
+bool smsSchedulerOnResult(uint8_t modem, bool ok, int cmsError);
+bool smsSchedulerRequeue(uint8_t modem);
+
+// --- Statistics ---
+uint8_t smsQueueDepth();
+float smsSendRate();
+unsigned long smsBackoffRemaining();
+
+#endif // SMS_SCHEDULER_H
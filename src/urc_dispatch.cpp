@@ -0,0 +1,130 @@
+/**
+ * @file    urc_dispatch.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of the URC dispatch table.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description The route arrays of the modules are concatenated and sorted by
+ *              prefix at compile time. The build fails if two prefixes collide or
+ *              one is a prefix of another; in such a prefix-free sorted table the
+ *              only route that can match a line is the last one sorting at or
+ *              before it, so a line is routed with one binary search and a single
+ *              prefix comparison instead of a chain of startsWith() calls.
+ */
+
+
+/**
+ * @file urc_dispatch.cpp
+ * @brief Implementation of the URC dispatch table.
+ */
+
+#include "config.h"
+#include "urc_dispatch.h"
+#include "logger.h"
+#include "sim_handler.h"      // Calls and registration
+#include "sms_archive.h"      // New messages
+#include "ussd_session.h"     // USSD
+#include "delivery_reports.h" // Status reports
+#include "modem_health.h"     // Modem restarts
+
+/**
+ * @struct UrcTable
+ * @brief Fixed-size route table built at compile time.
+ */
+template <size_t N>
+struct UrcTable {
+    UrcRoute routes[N];
+    static constexpr size_t size = N;
+};
+
+/**
+ * @brief (Static) strcmp() usable in constant expressions.
+ */
+static constexpr int comparePrefix(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+/**
+ * @brief (Static) Checks whether text starts with prefix; usable in constant expressions.
+ */
+static constexpr bool startsWithPrefix(const char *text, const char *prefix) {
+    while (*prefix) {
+        if (*text++ != *prefix++) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief (Static) Appends a module's routes to the table being built.
+ */
+template <size_t N, size_t M>
+static constexpr void appendRoutes(UrcTable<N> &table, size_t &count, const UrcRoute (&routes)[M]) {
+    for (size_t i = 0; i < M; i++) table.routes[count++] = routes[i];
+}
+
+/**
+ * @brief (Static) Concatenates the route arrays and sorts them by prefix.
+ */
+template <size_t... M>
+static constexpr UrcTable<(M + ...)> buildUrcTable(const UrcRoute (&...routes)[M]) {
+    UrcTable<(M + ...)> table{};
+    size_t count = 0;
+    (appendRoutes(table, count, routes), ...);
+    for (size_t i = 1; i < count; i++) {
+        UrcRoute route = table.routes[i];
+        size_t j = i;
+        for (; j > 0 && comparePrefix(table.routes[j - 1].prefix, route.prefix) > 0; j--)
+            table.routes[j] = table.routes[j - 1];
+        table.routes[j] = route;
+    }
+    return table;
+}
+
+/**
+ * @brief (Static) Checks that the sorted table is prefix-free and fully populated.
+ * @details Adjacent entries suffice: if A were a prefix of a later C, every entry
+ *          between them would start with A as well.
+ */
+template <size_t N>
+static constexpr bool urcTableValid(const UrcTable<N> &table) {
+    for (size_t i = 0; i < N; i++) {
+        if (!table.routes[i].prefix || !table.routes[i].prefix[0] || !table.routes[i].handler) return false;
+        if (i > 0 && startsWithPrefix(table.routes[i].prefix, table.routes[i - 1].prefix)) return false;
+    }
+    return true;
+}
+
+static constexpr auto urcTable = buildUrcTable(simUrcRoutes, smsArchiveUrcRoutes, ussdUrcRoutes,
+                                               deliveryUrcRoutes, modemHealthUrcRoutes);
+static_assert(urcTableValid(urcTable), "URC prefixes must be unique and none may start with another");
+
+/**
+ * @brief Routes a line to the module handling its URC.
+ * @param modem The modem the line arrived on.
+ * @param line The received line, trimmed.
+ * @return true if the line was a URC (and has been handled), false otherwise.
+ */
+bool dispatchUrc(Modem &modem, const String &line) {
+    const char *text = line.c_str();
+    size_t lo = 0, hi = urcTable.size;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (strcmp(urcTable.routes[mid].prefix, text) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return false;
+    const UrcRoute &route = urcTable.routes[lo - 1];
+    if (route.exact ? strcmp(route.prefix, text) != 0 : !startsWithPrefix(text, route.prefix)) return false;
+
+    LOG_D("URC RX[%u]: %s", modem.id(), text);
+    route.handler(modem, line);
+    return true;
+}
@@ -0,0 +1,44 @@
+/**
+ * @file    urc_dispatch.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Prefix table routing unsolicited result codes to their modules.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares UrcRoute. Each module lists the URCs it handles in a
+ *              constexpr route array in its own header; urc_dispatch.cpp merges
+ *              those arrays into one sorted table at compile time, so adding a URC
+ *              never touches the serial reader.
+ */
+
+
+/**
+ * @file urc_dispatch.h
+ * @brief Prefix table routing unsolicited result codes to their modules.
+ */
+
+#ifndef URC_DISPATCH_H
+#define URC_DISPATCH_H
+
+#include <Arduino.h>
+
+class Modem;
+
+typedef void (*UrcHandler)(Modem &modem, const String &line);
+
+/**
+ * @struct UrcRoute
+ * @brief Routes the lines starting with a prefix to a handler.
+ */
+struct UrcRoute {
+    const char *prefix;  ///< Line prefix, including the colon for "+XXX:" codes
+    UrcHandler handler;  ///< Called with the modem and the full (trimmed) line
+    bool exact = false;  ///< The line must equal the prefix
+};
+
+bool dispatchUrc(Modem &modem, const String &line);
+
+#endif // URC_DISPATCH_H
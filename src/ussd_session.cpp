@@ -0,0 +1,327 @@
+/**
+ * @file    ussd_session.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of the USSD session manager.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description The modem supports one USSD session at a time. The session is owned
+ *              by the WebSocket client that started it; requests from other clients
+ *              wait in a FIFO. Commands are written without waiting and their
+ *              results are picked up by handleSimData(), so no USSD step blocks the
+ *              main loop. Sessions time out and can be cancelled with AT+CUSD=2.
+ */
+
+
+/**
+ * @file ussd_session.cpp
+ * @brief Implementation of the USSD session manager.
+ */
+
+#include "config.h"
+#include "ussd_session.h"
+#include "logger.h"
+#include "json_arena.h"
+#include "at_tokenizer.h"
+#include "sim_handler.h" // For decodeUcs2, modemIdle
+#include "web_server.h"  // For notifyClient, notifyClients
+#include "modem_state.h" // For the CSCS shadow register
+#include "modem_health.h" // For modemCommandTimedOut
+
+/**
+ * @enum UssdState
+ * @brief States of the USSD session.
+ */
+enum UssdState {
+    USSD_IDLE,
+    USSD_STARTING,           // Text ready, waiting for the modem to be free
+    USSD_SETTING_CHARSET,    // AT+CSCS="GSM" sent, waiting for OK
+    USSD_AWAITING_NETWORK,   // AT+CUSD=1 sent, waiting for +CUSD
+    USSD_AWAITING_USER,      // Network asked for a reply, waiting for the owner
+    USSD_CANCEL_PENDING,     // Cancel requested, waiting for the modem to be free
+    USSD_CANCELLING          // AT+CUSD=2 sent, waiting for OK
+};
+
+/**
+ * @struct UssdRequest
+ * @brief A USSD request waiting for the session to become free.
+ */
+struct UssdRequest {
+    uint8_t client;
+    String code;
+};
+
+static UssdState ussdState = USSD_IDLE;
+static uint8_t ussdOwner = 0;
+static String ussdText = "";          // Code or reply to send next
+static bool ussdCmdPending = false;   // A USSD command is waiting for OK/ERROR
+static unsigned long ussdStateSince = 0;
+static bool ussdInSession = false;    // The network is holding a session open for us
+
+static UssdRequest ussdQueue[USSD_QUEUE_SIZE];
+static uint8_t ussdQueueHead = 0;
+static uint8_t ussdQueueCount = 0;
+
+/**
+ * @brief (Static) Moves the session to a new state and restarts its timer.
+ */
+static void setState(UssdState s) {
+    if (s == USSD_IDLE || s == USSD_CANCELLING) ussdInSession = false;
+    if (s == USSD_AWAITING_USER) ussdInSession = true;
+    ussdState = s;
+    ussdStateSince = millis();
+}
+
+/**
+ * @brief (Static) Sends a ussd_response event to the session owner.
+ * @param type The +CUSD-style result type (-1 = in progress).
+ * @param code The message code; the UI translates it with the msg_<code> key of the lang files.
+ * @param detail Optional untranslated detail (e.g. the modem's error line).
+ */
+static void notifyOwner(int type, const char *code, const String &detail = String()) {
+    PooledJsonDocument doc;
+    doc["type"] = type;
+    doc["code"] = code;
+    if (detail.length() > 0) doc["detail"] = detail;
+    String s;
+    serializeJson(doc, s);
+    notifyClient(ussdOwner, "ussd_response", s);
+}
+
+/**
+ * @brief (Static) Removes all queued requests of a client.
+ */
+static void dropQueued(uint8_t client) {
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < ussdQueueCount; i++) {
+        UssdRequest &r = ussdQueue[(ussdQueueHead + i) % USSD_QUEUE_SIZE];
+        if (r.client != client) {
+            ussdQueue[(ussdQueueHead + kept) % USSD_QUEUE_SIZE] = r;
+            kept++;
+        }
+    }
+    for (uint8_t i = kept; i < ussdQueueCount; i++)
+        ussdQueue[(ussdQueueHead + i) % USSD_QUEUE_SIZE].code = "";
+    ussdQueueCount = kept;
+}
+
+/**
+ * @brief Queues a USSD code for a client. Starts at once if no session is active.
+ * @param client The WebSocket client number that will own the session, or
+ *               USSD_NO_OWNER for a session the gateway starts itself.
+ * @param code The USSD code (e.g., "*100#").
+ */
+void requestUssd(uint8_t client, const String &code) {
+    if (ussdQueueCount >= USSD_QUEUE_SIZE) {
+        notifyClient(client, "error", "ussd_queue_full");
+        return;
+    }
+    UssdRequest &r = ussdQueue[(ussdQueueHead + ussdQueueCount) % USSD_QUEUE_SIZE];
+    r.client = client;
+    r.code = code;
+    ussdQueueCount++;
+    if (ussdState != USSD_IDLE || ussdQueueCount > 1) {
+        notifyClient(client, "ussd_queued", "{\"position\":" + String(ussdQueueCount) + "}");
+    }
+}
+
+/**
+ * @brief Sends the owner's reply to an interactive USSD session.
+ * @param client The WebSocket client number sending the reply.
+ * @param reply The reply text.
+ */
+void replyUssd(uint8_t client, const String &reply) {
+    if (ussdState != USSD_AWAITING_USER || client != ussdOwner) {
+        notifyClient(client, "error", "no_ussd_session");
+        return;
+    }
+    ussdText = reply;
+    setState(USSD_STARTING);
+}
+
+/**
+ * @brief Cancels the client's USSD session and drops its queued requests.
+ * @param client The WebSocket client number.
+ */
+void cancelUssd(uint8_t client) {
+    dropQueued(client);
+    if (ussdState == USSD_IDLE || client != ussdOwner) return;
+    if (ussdState == USSD_STARTING && !ussdInSession) {
+        setState(USSD_IDLE); // Nothing was sent to the network yet
+        return;
+    }
+    if (ussdState != USSD_CANCELLING) setState(USSD_CANCEL_PENDING);
+}
+
+/**
+ * @brief Releases everything a disconnected client held.
+ */
+void handleUssdClientGone(uint8_t client) {
+    cancelUssd(client);
+}
+
+/**
+ * @brief Handles a +CUSD unsolicited result code.
+ * @details USSD sessions run on the primary modem; +CUSD from another modem is ignored.
+ * @param modem The modem the URC arrived on.
+ * @param line The full URC line: +CUSD: <m>[,<str>[,<dcs>]].
+ */
+void handleUssdUrc(Modem &modem, const String &line) {
+    if (modem.id() != PRIMARY_MODEM) {
+        LOG_W("USSD: Ignoring +CUSD from modem %u.", modem.id());
+        return;
+    }
+    AtTokenizer tok(line);
+    if (!tok.prefix("+CUSD:")) return;
+
+    long responseType = -1;
+    long dcs = -1;
+    AtField msg;
+    String ussdMsg = "";
+
+    tok.nextInt(responseType);
+    if (tok.next(msg)) {
+        ussdMsg = msg.toString();
+        ussdMsg.trim();
+        tok.nextInt(dcs);
+    }
+    ussdMsg = decodeUcs2(ussdMsg);
+
+    PooledJsonDocument doc;
+    doc["type"] = responseType;
+    doc["message"] = ussdMsg;
+    if (dcs != -1) doc["dcs"] = dcs;
+    String out;
+    serializeJson(doc, out);
+
+    if ((ussdState == USSD_AWAITING_NETWORK || ussdState == USSD_SETTING_CHARSET) && ussdOwner == USSD_NO_OWNER) {
+        // Started by the gateway: show the result to everyone; nobody can answer a menu
+        LOG_I("USSD: %s", ussdMsg.c_str());
+        notifyClients("ussd_response", out);
+        setState(responseType == 1 ? USSD_CANCEL_PENDING : USSD_IDLE);
+    } else if (ussdState == USSD_AWAITING_NETWORK || ussdState == USSD_SETTING_CHARSET) {
+        notifyClient(ussdOwner, "ussd_response", out);
+        setState(responseType == 1 ? USSD_AWAITING_USER : USSD_IDLE);
+    } else if (ussdState == USSD_IDLE) {
+        notifyClients("ussd_response", out); // Network-initiated USSD
+    }
+}
+
+/**
+ * @brief Returns true while a USSD command is waiting for its final result code.
+ * @details Other modules must not send commands to the modem meanwhile.
+ */
+bool ussdCommandPending() {
+    return ussdCmdPending;
+}
+
+/**
+ * @brief Handles a final result line for the pending USSD command.
+ * @param line The received line.
+ */
+void handleUssdLine(const String &line) {
+    bool ok = line.startsWith("OK");
+    bool err = line.indexOf("ERROR") != -1;
+    if (!ok && !err) {
+        LOG_D("USSD RX: %s", line.c_str());
+        return;
+    }
+    ussdCmdPending = false;
+
+    switch (ussdState) {
+    case USSD_SETTING_CHARSET:
+        // Send the code even if the charset could not be set
+        if (ok) modemRegisterSet(MODEM_REG_CSCS, "\"GSM\"");
+        else modemRegisterClear(MODEM_REG_CSCS);
+        sim900.println("AT+CUSD=1,\"" + ussdText + "\",15");
+        ussdCmdPending = true;
+        setState(USSD_AWAITING_NETWORK);
+        break;
+    case USSD_AWAITING_NETWORK:
+        if (err) {
+            LOG_W("USSD: Request rejected: %s", line.c_str());
+            notifyOwner(4, "ussd_failed", line);
+            setState(USSD_IDLE);
+        }
+        break;
+    case USSD_CANCELLING:
+        setState(USSD_IDLE);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Main-loop driver of the USSD session: starts queued requests, sends
+ *        pending text and cancellations when the modem is free, and enforces timeouts.
+ */
+void handleUssdSession() {
+    unsigned long elapsed = millis() - ussdStateSince;
+
+    if (ussdCmdPending && elapsed > USSD_COMMAND_TIMEOUT) {
+        LOG_W("USSD: Command timed out.");
+        ussdCmdPending = false;
+        modemCommandTimedOut();
+        if (ussdState == USSD_SETTING_CHARSET) {
+            handleUssdLine("ERROR"); // Proceed with the code anyway
+            return;
+        }
+        if (ussdState == USSD_CANCELLING) {
+            setState(USSD_IDLE);
+            return;
+        }
+    }
+
+    switch (ussdState) {
+    case USSD_IDLE:
+        if (ussdQueueCount > 0) {
+            UssdRequest &r = ussdQueue[ussdQueueHead];
+            ussdOwner = r.client;
+            ussdText = r.code;
+            r.code = "";
+            ussdQueueHead = (ussdQueueHead + 1) % USSD_QUEUE_SIZE;
+            ussdQueueCount--;
+            notifyOwner(-1, "ussd_sending");
+            setState(USSD_STARTING);
+        }
+        break;
+    case USSD_STARTING:
+        if (!modemIdle()) break;
+        if (modemRegisterIs(MODEM_REG_CSCS, "\"GSM\"")) {
+            sim900.println("AT+CUSD=1,\"" + ussdText + "\",15");
+            ussdCmdPending = true;
+            setState(USSD_AWAITING_NETWORK);
+            break;
+        }
+        sim900.println(F("AT+CSCS=\"GSM\""));
+        ussdCmdPending = true;
+        setState(USSD_SETTING_CHARSET);
+        break;
+    case USSD_AWAITING_NETWORK:
+        if (!ussdCmdPending && elapsed > USSD_NETWORK_TIMEOUT) {
+            LOG_W("USSD: No response from the network.");
+            notifyOwner(2, "ussd_timeout");
+            setState(USSD_CANCEL_PENDING);
+        }
+        break;
+    case USSD_AWAITING_USER:
+        if (elapsed > USSD_REPLY_TIMEOUT) {
+            LOG_W("USSD: Owner did not reply, closing session.");
+            notifyOwner(2, "ussd_session_timeout");
+            setState(USSD_CANCEL_PENDING);
+        }
+        break;
+    case USSD_CANCEL_PENDING:
+        if (!modemIdle()) break;
+        sim900.println(F("AT+CUSD=2"));
+        ussdCmdPending = true;
+        setState(USSD_CANCELLING);
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,43 @@
+/**
+ * @file    ussd_session.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Function prototypes for the USSD session manager.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares the interface of the USSD session manager, which owns the
+ *              single USSD session the modem supports, queues requests from other
+ *              clients and drives all USSD modem I/O from the main loop.
+ */
+
+
+/**
+ * @file ussd_session.h
+ * @brief Function prototypes for the USSD session manager.
+ */
+
+#ifndef USSD_SESSION_H
+#define USSD_SESSION_H
+
+#include <Arduino.h>
+#include "urc_dispatch.h"
+
+void requestUssd(uint8_t client, const String &code);
+void replyUssd(uint8_t client, const String &reply);
+void cancelUssd(uint8_t client);
+void handleUssdClientGone(uint8_t client);
+
+void handleUssdUrc(Modem &modem, const String &line);
+bool ussdCommandPending();
+void handleUssdLine(const String &line);
+void handleUssdSession();
+
+// Merged into the URC dispatch table (urc_dispatch.cpp)
+constexpr UrcRoute ussdUrcRoutes[] = {
+    {"+CUSD:", handleUssdUrc},
+};
+
+#endif // USSD_SESSION_H
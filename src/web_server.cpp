@@ -10,7 +10,10 @@
  * 
  * @description Implements all web-facing logic. This includes serving the frontend files
  *              (HTML, CSS, JS), handling API requests, and managing the WebSocket
- *              connection for bidirectional, real-time updates with clients.
+ *              connection for bidirectional, real-time updates with clients. The
+ *              WebSocket is a handler of the same HTTP server; its events arrive in
+ *              the network callback context and client actions are handed to the
+ *              main loop, which owns the modem.
  */
 
 
@@ -21,8 +24,24 @@
 
 #include "config.h"
 #include "web_server.h"
+#include "logger.h"
+#include "json_arena.h"
 #include "file_system.h" // For saveConfig()
 #include "sim_handler.h" // For WebSocket actions like sendSMS, etc.
+#include "sms_scheduler.h"
+#include "delivery_reports.h"
+#include "sms_archive.h"
+#include "sms_dedup.h"
+#include "sms_rules.h"
+#include "boot_sequencer.h"
+#include "wifi_manager.h"
+#include "ussd_session.h"
+#include "modem_state.h"
+#include "signal_history.h"
+#include "modem_health.h"
+#include "ws_queue.h"
+
+static void dispatchWebSocketEvents();
 
 /**
  * @brief Serves static files (CSS, JS, HTML) from LittleFS.
@@ -70,23 +89,33 @@ void setupWebServer() {
     server.on("/getmode", HTTP_GET, [](AsyncWebServerRequest *r) {
         JsonDocument d;
         d["mode"] = apMode ? "AP" : "STA";
-        d["sim_ready"] = simPinOk;
-        d["sim_pin_required"] = simRequiresPin && !simPinOk;
+        const Modem &primary = modems[PRIMARY_MODEM];
+        d["sim_ready"] = primary.simPinOk;
+        d["sim_pin_required"] = primary.simRequiresPin && !primary.simPinOk;
         String s;
         serializeJson(d, s);
         r->send(200, "application/json", s);
     });
 
+    // API endpoint to page through the SMS archive (streamed, newest first)
+    server.on("/api/inbox", HTTP_GET, handleInboxQuery);
+
+    // API endpoint for the signal quality history (raw samples and roll-ups)
+    server.on("/api/signal", HTTP_GET, handleSignalQuery);
+
+    // API endpoint for the most recent log messages (plain text, ?since= to tail)
+    server.on("/logs", HTTP_GET, handleLogQuery);
+
     // API endpoint to scan for WiFi networks (only in AP mode)
     server.on("/scanwifi", HTTP_GET, [](AsyncWebServerRequest *r) {
-        if (!apMode) { r->send(403, "application/json", R"({"success":false,"message":"Scan only available in AP mode"})"); return; }
+        if (!apMode) { r->send_P(403, "application/json", PSTR(R"({"success":false,"code":"scan_ap_only"})")); return; }
         int n = WiFi.scanNetworks();
         JsonDocument doc;
         if (n > 0) {
             // ... (WiFi scanning logic remains identical)
         } else {
             doc["success"] = false;
-            doc["message"] = (n == 0) ? "No networks found" : "Scan Error";
+            doc["code"] = (n == 0) ? "no_networks" : "scan_error";
         }
         String buf;
         serializeJson(doc, buf);
@@ -100,19 +129,63 @@ void setupWebServer() {
         if (r->hasParam("ssid", true)) {
             strlcpy(config.wifi_ssid, r->getParam("ssid", true)->value().c_str(), sizeof(config.wifi_ssid));
             strlcpy(config.wifi_password, r->getParam("password", true)->value().c_str(), sizeof(config.wifi_password));
+            if (r->hasParam("static_ip", true)) {
+                strlcpy(config.static_ip, r->getParam("static_ip", true)->value().c_str(), sizeof(config.static_ip));
+                strlcpy(config.static_gateway, r->getParam("static_gateway", true)->value().c_str(), sizeof(config.static_gateway));
+                strlcpy(config.static_subnet, r->getParam("static_subnet", true)->value().c_str(), sizeof(config.static_subnet));
+                strlcpy(config.static_dns, r->getParam("static_dns", true)->value().c_str(), sizeof(config.static_dns));
+            }
+            config.wifi_channel = 0; // Forget the cached link of the previous network
             if (saveConfig()) {
-                r->send(200, "application/json", R"({"success":true,"message":"WiFi credentials saved. Rebooting..."})");
+                r->send_P(200, "application/json", PSTR(R"({"success":true,"code":"wifi_saved"})"));
                 delay(1500);
                 ESP.restart();
                 return;
             }
         }
-        r->send(500, "application/json", R"({"success":false,"message":"Failed to save configuration"})");
+        r->send_P(500, "application/json", PSTR(R"({"success":false,"code":"config_save_failed"})"));
+    });
+
+    // API endpoints to export/import the configuration as JSON (only in AP mode)
+    server.on("/api/config/export", HTTP_GET, [](AsyncWebServerRequest *r) {
+        if (!apMode) { r->send(403); return; }
+        String buf;
+        exportConfigJson(buf);
+        AsyncWebServerResponse *p = r->beginResponse(200, "application/json", buf);
+        p->addHeader("Content-Disposition", "attachment; filename=config.json");
+        r->send(p);
+    });
+    server.on("/api/config/import", HTTP_POST, [](AsyncWebServerRequest *r) {
+        if (!apMode) { r->send(403); return; }
+        if (r->hasParam("config", true) && importConfigJson(r->getParam("config", true)->value()) && saveConfig()) {
+            r->send_P(200, "application/json", PSTR(R"({"success":true,"code":"config_imported"})"));
+            delay(1500);
+            ESP.restart();
+            return;
+        }
+        r->send_P(400, "application/json", PSTR(R"({"success":false,"code":"config_invalid"})"));
+    });
+
+    // API endpoints for the rules run on incoming SMS (only in AP mode; see sms_rules.h)
+    server.on("/api/rules", HTTP_GET, [](AsyncWebServerRequest *r) {
+        if (!apMode) { r->send(403); return; }
+        String buf;
+        exportSmsRules(buf);
+        r->send(200, "application/json", buf);
+    });
+    server.on("/api/rules", HTTP_POST, [](AsyncWebServerRequest *r) {
+        if (!apMode) { r->send(403); return; }
+        // Compiled and saved by the main loop; GET shows the rules once they are in effect
+        if (r->hasParam("rules", true) && queueSmsRules(r->getParam("rules", true)->value())) {
+            r->send_P(202, "application/json", PSTR(R"({"success":true,"code":"rules_queued"})"));
+            return;
+        }
+        r->send_P(400, "application/json", PSTR(R"({"success":false,"code":"rules_invalid"})"));
     });
 
     // API endpoint to reboot the device
     server.on("/reboot", HTTP_POST, [](AsyncWebServerRequest *r) {
-        r->send(200, "application/json", R"({"success":true,"message":"Rebooting..."})");
+        r->send_P(200, "application/json", PSTR(R"({"success":true,"code":"rebooting"})"));
         delay(100);
         ESP.restart();
     });
@@ -134,21 +207,109 @@ void handleWebServer() {
     if (apMode) {
         dnsServer.processNextRequest();
     } else {
-        webSocket.loop();
+        dispatchWebSocketEvents();
+        handleWsQueues();
+        webSocket.cleanupClients(WS_MAX_CLIENTS);
     }
 }
 
 /**
- * @brief Broadcasts a message to all connected WebSocket clients.
- * @param type A string defining the message type (e.g., "status", "sms_item").
- * @param data The payload of the message, either a simple string or a JSON string.
+ * @struct WsProtocolStats
+ * @brief Frames, bytes and encoding time per wire format, to compare the two.
  */
-void notifyClients(const String &type, const String &data) {
-    JsonDocument doc;
+struct WsProtocolStats {
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t encodeMicros;
+};
+
+/**
+ * @enum WsInboundKind
+ * @brief Client events handed from the network callback to the main loop.
+ */
+enum WsInboundKind {
+    WS_INBOUND_GONE,   // Client disconnected
+    WS_INBOUND_TEXT,   // JSON action
+    WS_INBOUND_BINARY  // MessagePack action
+};
+
+/**
+ * @struct WsInboundEvent
+ * @brief A client event waiting for the main loop.
+ */
+struct WsInboundEvent {
+    uint8_t num;
+    WsInboundKind kind;
+    String payload;
+    unsigned long receivedAt; // micros()
+};
+
+static uint32_t clientIds[WS_MAX_CLIENTS] = {0};       // Library client id per client number (0 = free)
+static bool binaryClient[WS_MAX_CLIENTS] = {false};    // Client negotiated WS_BINARY_PROTOCOL
+static uint8_t clientTopics[WS_MAX_CLIENTS] = {0};     // WsTopic mask per client
+static String partialMessage[WS_MAX_CLIENTS];          // Message arriving in several TCP segments
+static WsInboundEvent inbound[WS_INBOUND_QUEUE];
+static uint8_t inboundHead = 0;
+static uint8_t inboundCount = 0;
+static uint32_t inboundWaitMax = 0; // Longest wait of a client action for the main loop (us)
+static WsProtocolStats textStats = {0, 0, 0};
+static WsProtocolStats binaryStats = {0, 0, 0};
+
+/**
+ * @struct WsTopicName
+ * @brief Maps a name (topic or event type) to its topic bit.
+ */
+struct WsTopicName {
+    const char *name;
+    uint8_t topic;
+};
+
+static const WsTopicName topicNames[] = {
+    {"status", WS_TOPIC_STATUS}, {"inbox", WS_TOPIC_INBOX}, {"ussd", WS_TOPIC_USSD},
+    {"calls", WS_TOPIC_CALLS}, {"campaign", WS_TOPIC_CAMPAIGN},
+};
+
+// Event types not listed here (e.g., 'error') reach every client
+static const WsTopicName eventTopics[] = {
+    {"status", WS_TOPIC_STATUS},
+    {"sms_item", WS_TOPIC_INBOX}, {"sms_list_started", WS_TOPIC_INBOX}, {"sms_list_finished", WS_TOPIC_INBOX},
+    {"sms_content", WS_TOPIC_INBOX}, {"sms_deleted", WS_TOPIC_INBOX}, {"sms_received_indication", WS_TOPIC_INBOX},
+    {"ussd_response", WS_TOPIC_USSD}, {"ussd_queued", WS_TOPIC_USSD},
+    {"call_incoming", WS_TOPIC_CALLS}, {"call_status", WS_TOPIC_CALLS}, {"caller_id", WS_TOPIC_CALLS},
+    {"sms_queued", WS_TOPIC_CAMPAIGN}, {"sms_sent", WS_TOPIC_CAMPAIGN}, {"sms_delivery", WS_TOPIC_CAMPAIGN},
+};
+
+/**
+ * @brief (Static) Looks up a name in a topic table.
+ * @return The topic bit, or 0 if the name is not listed.
+ */
+template <size_t N> static uint8_t findTopic(const WsTopicName (&table)[N], const char *name) {
+    for (const WsTopicName &t : table) {
+        if (strcmp(t.name, name) == 0) return t.topic;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks whether any connected client wants events of a topic.
+ * @details Producers of expensive payloads can skip building them.
+ * @param topic A WsTopic bit.
+ */
+bool wsTopicSubscribed(uint8_t topic) {
+    for (uint8_t num = 0; num < WS_MAX_CLIENTS; num++) {
+        if (clientIds[num] != 0 && (clientTopics[num] & topic)) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief (Static) Wraps a payload into the {"type":..., "data":...} message format.
+ */
+static void buildMessage(JsonDocument &doc, const String &type, const String &data) {
     doc["type"] = type;
     bool isJson = (data.startsWith("{") && data.endsWith("}")) || (data.startsWith("[") && data.endsWith("]"));
     if (isJson) {
-        JsonDocument nestedDoc;
+        PooledJsonDocument nestedDoc;
         if (deserializeJson(nestedDoc, data) == DeserializationError::Ok) {
             doc["data"] = nestedDoc;
         } else {
@@ -157,36 +318,230 @@ void notifyClients(const String &type, const String &data) {
     } else {
         doc["data"] = data;
     }
-    String s;
-    if (serializeJson(doc, s) > 0) {
-        webSocket.broadcastTXT(s);
+}
+
+/**
+ * @brief (Static) Encodes a message as MessagePack into a String used as a byte buffer.
+ * @details MessagePack holds 0x00 bytes (e.g. the integer 0), and serializing into a
+ *          String directly appends through C-string concat, which stops at the first
+ *          NUL. The frame is sized with measureMsgPack(), encoded into a plain buffer
+ *          and copied with the length-aware concat; the queue sends c_str()/length().
+ * @return False if the buffer could not be allocated.
+ */
+static bool encodeMsgPack(const JsonDocument &doc, String &out) {
+    size_t len = measureMsgPack(doc);
+    if (len == 0) return false;
+    uint8_t *buf = (uint8_t *)malloc(len + 1); // concat() also copies the terminator
+    if (!buf) return false;
+    size_t written = serializeMsgPack(doc, buf, len);
+    buf[written] = 0;
+    bool ok = written == len && out.reserve(len) && out.concat((const char *)buf, len);
+    free(buf);
+    return ok;
+}
+
+/**
+ * @brief (Static) Queues a message for one client in the format it connected with.
+ * @details Each format is encoded at most once per message; text and binary hold
+ *          the encoded frames across calls for the same message.
+ */
+static void sendMessage(uint8_t num, const JsonDocument &doc, std::shared_ptr<String> &text, std::shared_ptr<String> &binary) {
+    const char *type = doc["type"];
+    WsFrameClass frameClass = WS_FRAME_NORMAL;
+    if (strcmp(type, "status") == 0) frameClass = WS_FRAME_STATUS;
+    else if (strcmp(type, "sms_sent") == 0) frameClass = WS_FRAME_CRITICAL;
+
+    if (binaryClient[num]) {
+        if (!binary) {
+            unsigned long start = micros();
+            binary = std::make_shared<String>();
+            if (!encodeMsgPack(doc, *binary)) {
+                LOG_E("WS: Out of memory encoding '%s' as MessagePack, not sent.", type);
+                *binary = String();
+            }
+            binaryStats.encodeMicros += micros() - start;
+            binaryStats.frames++;
+            binaryStats.bytes += binary->length();
+        }
+        if (binary->length() > 0) wsQueueFrame(num, binary, true, frameClass);
+    } else {
+        if (!text) {
+            unsigned long start = micros();
+            text = std::make_shared<String>();
+            serializeJson(doc, *text);
+            textStats.encodeMicros += micros() - start;
+            textStats.frames++;
+            textStats.bytes += text->length();
+        }
+        if (text->length() > 0) wsQueueFrame(num, text, false, frameClass);
+    }
+}
+
+/**
+ * @brief (Static) Queues a built message for every client subscribed to its topic.
+ * @details A document that ran out of memory is dropped rather than sent truncated.
+ */
+static void broadcastMessage(const JsonDocument &doc, uint8_t topic) {
+    if (doc.overflowed()) {
+        LOG_E("WS: Out of memory building '%s', not sent.", doc["type"] | "");
+        return;
     }
+    std::shared_ptr<String> text, binary;
+    for (uint8_t num = 0; num < WS_MAX_CLIENTS; num++) {
+        if (clientIds[num] != 0 && (topic == 0 || (clientTopics[num] & topic))) sendMessage(num, doc, text, binary);
+    }
+}
+
+/**
+ * @brief Broadcasts a message to all connected WebSocket clients.
+ * @param type A string defining the message type (e.g., "status", "sms_item").
+ * @param data The payload of the message, either a simple string or a JSON string.
+ */
+void notifyClients(const String &type, const String &data) {
+    uint8_t topic = findTopic(eventTopics, type.c_str());
+    if (topic != 0 && !wsTopicSubscribed(topic)) return; // Nobody listens: skip encoding
+    PooledJsonDocument doc;
+    buildMessage(doc, type, data);
+    broadcastMessage(doc, topic);
 }
 
 /**
- * @brief Handles incoming messages from WebSocket clients.
+ * @brief Sends a message to a single WebSocket client, regardless of its topics.
  * @param num The client number.
- * @param type The type of WebSocket event.
+ * @param type A string defining the message type.
+ * @param data The payload of the message, either a simple string or a JSON string.
+ */
+void notifyClient(uint8_t num, const String &type, const String &data) {
+    if (num >= WS_MAX_CLIENTS || clientIds[num] == 0) return;
+    PooledJsonDocument doc;
+    buildMessage(doc, type, data);
+    if (doc.overflowed()) {
+        LOG_E("WS: Out of memory building '%s', not sent.", type.c_str());
+        return;
+    }
+    std::shared_ptr<String> text, binary;
+    sendMessage(num, doc, text, binary);
+}
+
+/**
+ * @brief (Static) Adds the per-format frame counters to the status payload.
+ * @details Bytes per frame and encoding time per frame of the two formats can be
+ *          compared directly, e.g. after loading the inbox with each.
+ */
+static void wsStatsToJson(JsonObject obj) {
+    obj["text_frames"] = textStats.frames;
+    obj["text_bytes"] = textStats.bytes;
+    obj["text_us"] = textStats.encodeMicros;
+    obj["bin_frames"] = binaryStats.frames;
+    obj["bin_bytes"] = binaryStats.bytes;
+    obj["bin_us"] = binaryStats.encodeMicros;
+    obj["rx_wait_us"] = inboundWaitMax;
+}
+
+/**
+ * @brief Broadcasts the current gateway status to all connected WebSocket clients.
+ * @details Uses the cached status variables, which the URC handlers keep current.
+ *          The payload (the largest event) is built straight into the message
+ *          instead of being serialized and parsed again by notifyClients().
+ */
+void notifyStatus() {
+    if (!wsTopicSubscribed(WS_TOPIC_STATUS)) return;
+    PooledJsonDocument message;
+    message["type"] = "status";
+    JsonObject doc = message["data"].to<JsonObject>();
+    doc["wifi_status"] = (WiFi.status() == WL_CONNECTED) ? "Connected" : "Disconnected";
+    doc["ip_address"] = WiFi.localIP().toString();
+    const Modem &primary = modems[PRIMARY_MODEM];
+    doc["sim_status"] = primary.simStatus;
+    doc["signal_quality"] = primary.signalQuality;
+    doc["network_operator"] = primary.networkOperator;
+    doc["sim_phone_number"] = primary.simPhoneNumber;
+    doc["sim_pin_status"] = primary.simRequiresPin ? (primary.simPinOk ? "OK" : "Required") : "Not Required";
+    JsonArray modemList = doc["modems"].to<JsonArray>();
+    for (const Modem &modem : modems)
+        modem.statusToJson(modemList.add<JsonObject>());
+    doc["sms_queue_depth"] = smsQueueDepth();
+    doc["sms_send_rate"] = round(smsSendRate() * 10) / 10.0;
+    doc["sms_backoff_ms"] = smsBackoffRemaining();
+    doc["dlr_pending"] = pendingDeliveryReports();
+    smsDedupStatsToJson(doc["sms_dedup"].to<JsonObject>());
+    smsRulesStatsToJson(doc["sms_rules"].to<JsonObject>());
+    bootTimingsToJson(doc["boot_ms"].to<JsonObject>());
+    doc["wifi_connect_ms"] = wifiLastConnectTime();
+    doc["wifi_directed"] = wifiLastConnectDirected();
+    doc["modem_rtt_saved"] = modemRoundTripsSaved();
+    modemHealthToJson(doc["modem_health"].to<JsonObject>());
+    doc["free_heap"] = ESP.getFreeHeap();
+    wsStatsToJson(doc["ws_stats"].to<JsonObject>());
+    wsQueueStatsToJson(doc["ws_queue"].to<JsonObject>());
+    jsonArenaStatsToJson(doc["json_arena"].to<JsonObject>());
+    broadcastMessage(message, WS_TOPIC_STATUS);
+}
+
+/**
+ * @brief (Static) Adds topics to or removes them from a client's subscriptions.
+ * @details 'topics' is a topic name or an array of names; unknown names are ignored.
+ *          The client receives the resulting set as a 'subscriptions' event.
+ */
+static void updateSubscriptions(uint8_t num, JsonVariantConst topics, bool subscribe) {
+    uint8_t mask = 0;
+    if (topics.is<JsonArrayConst>()) {
+        for (JsonVariantConst t : topics.as<JsonArrayConst>()) mask |= findTopic(topicNames, t | "");
+    } else {
+        mask = findTopic(topicNames, topics | "");
+    }
+    if (subscribe) clientTopics[num] |= mask;
+    else clientTopics[num] &= ~mask;
+
+    PooledJsonDocument doc;
+    JsonArray current = doc["topics"].to<JsonArray>();
+    for (const WsTopicName &t : topicNames) {
+        if (clientTopics[num] & t.topic) current.add(t.name);
+    }
+    String s;
+    serializeJson(doc, s);
+    notifyClient(num, "subscriptions", s);
+}
+
+/**
+ * @brief (Static) Handles an action message from a WebSocket client (main loop).
+ * @param num The client number.
+ * @param binary True for a MessagePack message, false for JSON.
  * @param payload The message payload.
  * @param length The length of the payload.
  */
-void handleWebSocketMessage(uint8_t num, WStype_t type, uint8_t *payload, size_t length)
+static void handleWebSocketMessage(uint8_t num, bool binary, const uint8_t *payload, size_t length)
 {
-    if (type != WStype_TEXT)
-        return;
-
-    JsonDocument doc;
-    if (deserializeJson(doc, payload, length) != DeserializationError::Ok)
+    PooledJsonDocument doc;
+    if (binary)
+    {
+        DeserializationError err = deserializeMsgPack(doc, (const char *)payload, length);
+        if (err || !doc.is<JsonObject>())
+        {
+            LOG_W("WS: Malformed binary message (%u bytes)", (unsigned)length);
+            return;
+        }
+    }
+    else if (deserializeJson(doc, (const char *)payload, length) != DeserializationError::Ok)
+    {
         return;
+    }
 
     const char *act = doc["action"];
     if (!act)
         return;
 
-    Serial.printf("[%u]WS Action:%s\n", num, act);
-    if ((strcmp(act, "sendSMS") == 0 || strcmp(act, "sendUSSD") == 0 || strcmp(act, "sendUSSDReply") == 0) && !simPinOk)
+    LOG_I("[%u]WS Action:%s", num, act);
+    // SMS may go out on any modem; USSD runs on the primary one
+    bool simReady = modems[PRIMARY_MODEM].simPinOk;
+    if (strcmp(act, "sendSMS") == 0)
     {
-        notifyClients("error", "SIM not ready");
+        for (const Modem &modem : modems)
+            simReady = simReady || modem.simPinOk;
+    }
+    if ((strcmp(act, "sendSMS") == 0 || strcmp(act, "sendUSSD") == 0 || strcmp(act, "sendUSSDReply") == 0) && !simReady)
+    {
+        notifyClients("error", "sim_not_ready");
         return;
     }
 
@@ -201,49 +556,174 @@ void handleWebSocketMessage(uint8_t num, WStype_t type, uint8_t *payload, size_t
     {
         if (!doc["code"].isNull())
         {
-            sendUSSD(doc["code"].as<String>());
+            requestUssd(num, doc["code"].as<String>());
         }
     }
     else if (strcmp(act, "sendUSSDReply") == 0)
     {
         if (!doc["reply"].isNull())
         {
-            sendUSSDReply(doc["reply"].as<String>());
+            replyUssd(num, doc["reply"].as<String>());
         }
     }
+    else if (strcmp(act, "cancelUSSD") == 0)
+    {
+        cancelUssd(num);
+    }
     else if (strcmp(act, "getSMSList") == 0)
     {
-        startGetSmsList();
+        sendArchiveList();
     }
     else if (strcmp(act, "readSMS") == 0)
     {
         if (!doc["index"].isNull())
         {
-            readSMS(doc["index"].as<int>());
+            readArchivedSms(doc["index"].as<uint32_t>());
         }
     }
     else if (strcmp(act, "deleteSMS") == 0)
     {
         if (!doc["index"].isNull())
         {
-            deleteSMS(doc["index"].as<int>());
+            deleteArchivedSms(doc["index"].as<uint32_t>());
         }
     }
 
     else if (strcmp(act, "getStatus") == 0)
     {
-        updateStatus(); // First, refresh the status variables
-        // Then, send the updated status to the client
-        JsonDocument sD;
-        sD["wifi_status"] = (WiFi.status() == WL_CONNECTED) ? "Connected" : "Disconnected";
-        sD["ip_address"] = WiFi.localIP().toString();
-        sD["sim_status"] = simStatus;
-        sD["signal_quality"] = signalQuality;
-        sD["network_operator"] = networkOperator;
-        sD["sim_phone_number"] = simPhoneNumber;
-        sD["sim_pin_status"] = simRequiresPin ? (simPinOk ? "OK" : "Required") : "Not Required";
-        String sS;
-        serializeJson(sD, sS);
-        notifyClients("status", sS);
-    }
-}
\ No newline at end of file
+        // The URC handlers keep the cached status current; no modem poll here
+        notifyStatus();
+    }
+    else if (strcmp(act, "subscribe") == 0 || strcmp(act, "unsubscribe") == 0)
+    {
+        updateSubscriptions(num, doc["topics"], strcmp(act, "subscribe") == 0);
+    }
+#ifdef MODEM_HANG_SIMULATION
+    else if (strcmp(act, "simulateModemHang") == 0)
+    {
+        simulateModemHang(doc["clearedBy"] | 2);
+    }
+#endif
+}
+
+/**
+ * @brief (Static) Returns the client number of a library client id, or -1.
+ */
+static int clientNumber(uint32_t id) {
+    for (uint8_t num = 0; num < WS_MAX_CLIENTS; num++) {
+        if (clientIds[num] == id) return num;
+    }
+    return -1;
+}
+
+/**
+ * @brief (Static) Hands a client event to the main loop.
+ * @return False if the inbound queue is full.
+ */
+static bool queueInbound(uint8_t num, WsInboundKind kind, String &payload) {
+    if (inboundCount >= WS_INBOUND_QUEUE) return false;
+    WsInboundEvent &e = inbound[(inboundHead + inboundCount) % WS_INBOUND_QUEUE];
+    e.num = num;
+    e.kind = kind;
+    e.payload = std::move(payload);
+    e.receivedAt = micros();
+    inboundCount++;
+    return true;
+}
+
+/**
+ * @brief (Static) WebSocket event handler; runs in the network callback context.
+ * @details Only bookkeeping happens here. Messages are reassembled and queued for
+ *          dispatchWebSocketEvents(), since actions may talk to the modem.
+ */
+static void onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+    if (type == WS_EVT_CONNECT) {
+        int num = clientNumber(0); // First free client number
+        if (num < 0) {
+            LOG_W("WS Client limit reached, refusing #%u", client->id());
+            client->close();
+            return;
+        }
+        // The handshake request: the binary format is chosen by offering its subprotocol
+        const String &protocol = ((AsyncWebServerRequest *)arg)->header("Sec-WebSocket-Protocol");
+        clientIds[num] = client->id();
+        binaryClient[num] = protocol.indexOf(WS_BINARY_PROTOCOL) >= 0;
+        clientTopics[num] = WS_TOPIC_ALL; // Until the client narrows it down
+        partialMessage[num] = String();
+        wsQueueReset(num);
+        LOG_I("[%u]WS Connected (%s, free heap %u bytes)", num, binaryClient[num] ? "binary" : "text", ESP.getFreeHeap());
+        return;
+    }
+
+    int num = clientNumber(client->id());
+    if (num < 0) return;
+
+    if (type == WS_EVT_DISCONNECT) {
+        clientIds[num] = 0;
+        binaryClient[num] = false;
+        partialMessage[num] = String();
+        wsQueueReset(num);
+        String none;
+        if (!queueInbound(num, WS_INBOUND_GONE, none)) {
+            LOG_W("[%u]WS Inbound queue full, disconnect not handled", num);
+        }
+    } else if (type == WS_EVT_DATA) {
+        AwsFrameInfo *info = (AwsFrameInfo *)arg;
+        if (info->num != 0 || info->len > WS_MAX_MESSAGE_SIZE) {
+            if (info->index == 0) LOG_W("[%u]WS Ignoring fragmented or oversized message", num);
+            return;
+        }
+        String &message = partialMessage[num];
+        if (info->index == 0) {
+            message = String();
+            message.reserve(info->len);
+        }
+        message.concat((const char *)data, len);
+        if (!info->final || info->index + len < info->len) return; // More segments follow
+        WsInboundKind kind = info->opcode == WS_BINARY ? WS_INBOUND_BINARY : WS_INBOUND_TEXT;
+        if (!queueInbound(num, kind, message)) {
+            LOG_W("[%u]WS Inbound queue full, message dropped", num);
+        }
+        message = String();
+    }
+}
+
+/**
+ * @brief (Static) Handles the client events queued by onWebSocketEvent (main loop).
+ */
+static void dispatchWebSocketEvents() {
+    while (inboundCount > 0) {
+        // Take the event out first; handlers may yield and let new events in
+        WsInboundEvent &e = inbound[inboundHead];
+        uint8_t num = e.num;
+        WsInboundKind kind = e.kind;
+        String payload = std::move(e.payload);
+        inboundWaitMax = std::max(inboundWaitMax, (uint32_t)(micros() - e.receivedAt));
+        inboundHead = (inboundHead + 1) % WS_INBOUND_QUEUE;
+        inboundCount--;
+
+        if (kind == WS_INBOUND_GONE) {
+            handleUssdClientGone(num); // Release the client's USSD session and queued requests
+        } else {
+            handleWebSocketMessage(num, kind == WS_INBOUND_BINARY, (const uint8_t *)payload.c_str(), payload.length());
+        }
+    }
+}
+
+/**
+ * @brief Attaches the WebSocket endpoint (WS_PATH) to the HTTP server.
+ */
+void startWebSocket() {
+    webSocket.onEvent(onWebSocketEvent);
+    server.addHandler(&webSocket);
+}
+
+/**
+ * @brief Returns the library client behind a client number.
+ * @param num The client number.
+ * @return The connected client, or NULL.
+ */
+AsyncWebSocketClient *wsClient(uint8_t num) {
+    if (num >= WS_MAX_CLIENTS || clientIds[num] == 0) return nullptr;
+    return webSocket.client(clientIds[num]);
+}
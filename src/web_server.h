@@ -10,7 +10,7 @@
  * 
  * @description Declares the functions responsible for setting up and managing the
  *              AsyncWebServer, including HTTP routes for the API and static files,
- *              and the WebSocket server for real-time communication.
+ *              and its WebSocket endpoint for real-time communication.
  */
 
 
@@ -24,12 +24,30 @@
 
 #include <Arduino.h>
 
-// Forward declaration to avoid circular dependencies
+// Forward declarations to avoid circular dependencies
 class AsyncWebServerRequest;
+class AsyncWebSocketClient;
+
+/**
+ * @enum WsTopic
+ * @brief Event groups a WebSocket client can subscribe to (bit mask).
+ */
+enum WsTopic : uint8_t {
+    WS_TOPIC_STATUS = 1 << 0,   ///< Gateway status
+    WS_TOPIC_INBOX = 1 << 1,    ///< Inbox listing, message content, new-message indications
+    WS_TOPIC_USSD = 1 << 2,     ///< Network-initiated USSD
+    WS_TOPIC_CALLS = 1 << 3,    ///< Incoming calls and caller id
+    WS_TOPIC_CAMPAIGN = 1 << 4, ///< Outgoing SMS progress: queued, sent, delivery reports
+    WS_TOPIC_ALL = 0x1F
+};
 
 void setupWebServer();
 void handleWebServer();
 void notifyClients(const String &type, const String &data);
-void handleWebSocketMessage(uint8_t num, WStype_t type, uint8_t *payload, size_t length);
+void notifyClient(uint8_t num, const String &type, const String &data);
+void notifyStatus();
+bool wsTopicSubscribed(uint8_t topic);
+void startWebSocket();
+AsyncWebSocketClient *wsClient(uint8_t num);
 
 #endif // WEB_SERVER_H
\ No newline at end of file
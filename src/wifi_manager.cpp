@@ -10,7 +10,8 @@
  * 
  * @description Implements the logic for connecting to a WiFi network, starting a
  *              failsafe Access Point, handling network reconnections, and managing
- *              the device's dual-mode network operation.
+ *              the device's dual-mode network operation. The station link is an
+ *              event-driven state machine, so link loss never blocks the main loop.
  */
 
 
@@ -21,57 +22,276 @@
 
 #include "config.h"
 #include "wifi_manager.h"
-#include "sim_handler.h" // For updateStatus
+#include "logger.h"
+#include "sim_handler.h" // For requestStatusRefresh, modems
 #include "web_server.h"  // For notifyClients
+#include "file_system.h" // For saveConfig
+#include <lwip/dhcp.h>
+#include <lwip/netif.h>
 
 /**
- * @brief Initializes WiFi, deciding whether to start in Station or AP mode.
+ * @enum WifiLinkState
+ * @brief States of the station link state machine.
  */
-void initializeWifi() {
-    if (simPinOk && String(config.wifi_ssid).length() > 0) {
-        if (connectWiFi()) {
-            startSTAMode();
+enum WifiLinkState {
+    WIFI_LINK_DOWN,        // Not connected, waiting for the next attempt
+    WIFI_LINK_CONNECTING,  // WiFi.begin() issued, waiting for an IP address
+    WIFI_LINK_UP           // Connected with an IP address
+};
+
+static WifiLinkState wifiState = WIFI_LINK_DOWN;
+static WiFiEventHandler gotIpHandler;
+static WiFiEventHandler disconnectedHandler;
+static volatile bool gotIpEvent = false;        // Set from the WiFi event callbacks,
+static volatile bool disconnectedEvent = false; // consumed in the main loop
+static volatile uint8_t disconnectReason = 0;
+static unsigned long connectStartedAt = 0;
+static unsigned long nextAttemptAt = 0;
+static unsigned long reconnectDelay = WIFI_RECONNECT_BASE;
+static bool directedAttempt = false;    // Current attempt uses the cached BSSID/channel
+static bool skipDirected = false;       // The cached link failed, do a full scan next
+static unsigned long lastConnectTime = 0; // Duration of the last successful association
+static bool lastConnectDirected = false;
+static bool leaseGranted = false;       // The DHCP server granted the saved lease during this boot
+static unsigned long leaseGrantedAt = 0;
+static uint32_t leaseSeconds = 0;       // Lease time granted by the server (0 = unknown)
+static bool leaseReused = false;        // The link runs on the saved lease instead of the DHCP client
+
+/**
+ * @brief (Static) Returns the lease time the DHCP server granted, in seconds (0 if unknown).
+ */
+static uint32_t dhcpLeaseSeconds() {
+    struct dhcp *d = netif_default ? netif_dhcp_data(netif_default) : nullptr;
+    return d ? d->offered_t0_lease : 0;
+}
+
+/**
+ * @brief (Static) Returns true while the saved lease may still be applied without DHCP.
+ * @details The lease is reused until T1 (half the lease time), when a DHCP client
+ *          would start renewing it. There is no clock across resets, so a lease
+ *          saved by an earlier boot has an unknown age and is never reused.
+ */
+static bool leaseUsable() {
+    if (!leaseGranted || config.lease_ip == 0) return false;
+    uint32_t usable = leaseSeconds > 0 ? leaseSeconds / 2 : WIFI_LEASE_REUSE_DEFAULT;
+    return (millis() - leaseGrantedAt) / 1000 < usable;
+}
+
+/**
+ * @brief (Static) Selects static addressing or DHCP for the next attempt.
+ * @details A configured static IP always wins. Otherwise a directed attempt reuses
+ *          the last DHCP lease to skip the DHCP exchange while it is still fresh;
+ *          full scans use DHCP.
+ */
+static void applyIpConfig(bool reuseLease) {
+    IPAddress ip, gw, mask, dns;
+    leaseReused = false;
+    if (strlen(config.static_ip) > 0 && ip.fromString(config.static_ip) &&
+        gw.fromString(config.static_gateway) && mask.fromString(config.static_subnet)) {
+        if (!dns.fromString(config.static_dns)) dns = gw;
+        WiFi.config(ip, gw, mask, dns);
+    } else if (reuseLease && leaseUsable()) {
+        WiFi.config(IPAddress(config.lease_ip), IPAddress(config.lease_gateway),
+                    IPAddress(config.lease_subnet), IPAddress(config.lease_dns));
+        leaseReused = true;
+    } else {
+        WiFi.config(IPAddress(0u), IPAddress(0u), IPAddress(0u)); // DHCP
+    }
+}
+
+/**
+ * @brief (Static) Persists the BSSID, channel and DHCP lease of the current link.
+ * @details The config image is only rewritten when something changed. A lease
+ *          from the DHCP client also restarts the reuse window.
+ */
+static void rememberLink() {
+    bool usingDhcp = strlen(config.static_ip) == 0 && !leaseReused;
+    if (usingDhcp) {
+        leaseGranted = true;
+        leaseGrantedAt = millis();
+        leaseSeconds = dhcpLeaseSeconds();
+    }
+    uint32_t ip = WiFi.localIP(), gw = WiFi.gatewayIP(), mask = WiFi.subnetMask(), dns = WiFi.dnsIP();
+    bool changed = memcmp(config.wifi_bssid, WiFi.BSSID(), 6) != 0 || config.wifi_channel != WiFi.channel();
+    if (usingDhcp) {
+        changed = changed || config.lease_ip != ip || config.lease_gateway != gw ||
+                  config.lease_subnet != mask || config.lease_dns != dns;
+    }
+    if (!changed) return;
+    memcpy(config.wifi_bssid, WiFi.BSSID(), 6);
+    config.wifi_channel = WiFi.channel();
+    if (usingDhcp) {
+        config.lease_ip = ip;
+        config.lease_gateway = gw;
+        config.lease_subnet = mask;
+        config.lease_dns = dns;
+    }
+    LOG_I("WiFi: Caching link %s on channel %d.", WiFi.BSSIDstr().c_str(), config.wifi_channel);
+    saveConfig();
+}
+
+/**
+ * @brief (Static) Issues a non-blocking association attempt.
+ * @details Tries a directed association to the cached BSSID/channel first and
+ *          falls back to a full scan if that fails.
+ */
+static void startConnect() {
+    directedAttempt = config.wifi_channel > 0 && !skipDirected;
+    applyIpConfig(directedAttempt);
+    if (directedAttempt) {
+        WiFi.begin(config.wifi_ssid, config.wifi_password, config.wifi_channel, config.wifi_bssid);
+    } else {
+        WiFi.begin(config.wifi_ssid, config.wifi_password);
+    }
+    wifiState = WIFI_LINK_CONNECTING;
+    connectStartedAt = millis();
+    LOG_I("Connecting to WiFi%s: %s", directedAttempt ? " (cached BSSID)" : "", config.wifi_ssid);
+}
+
+/**
+ * @brief (Static) Handles a failed attempt: a failed directed attempt is retried
+ *        at once with a full scan, anything else backs off.
+ */
+static void onConnectFailed() {
+    wifiState = WIFI_LINK_DOWN;
+    if (directedAttempt) {
+        LOG_W("WiFi: Cached link failed, falling back to a full scan.");
+        skipDirected = true;
+        nextAttemptAt = millis();
+        return;
+    }
+    skipDirected = false; // The cached link may work again next time
+    LOG_I("WiFi: Retrying in %lu ms.", reconnectDelay);
+    nextAttemptAt = millis() + reconnectDelay;
+    reconnectDelay = std::min(reconnectDelay * 2, WIFI_RECONNECT_MAX);
+}
+
+/**
+ * @brief (Static) Applies the events reported by the WiFi callbacks to the link state.
+ * @return true if the link state changed.
+ */
+static bool processWifiEvents() {
+    bool changed = false;
+    if (gotIpEvent) {
+        gotIpEvent = false;
+        if (wifiState != WIFI_LINK_UP) {
+            wifiState = WIFI_LINK_UP;
+            reconnectDelay = WIFI_RECONNECT_BASE;
+            skipDirected = false;
+            lastConnectTime = millis() - connectStartedAt;
+            lastConnectDirected = directedAttempt;
+            currentIP = WiFi.localIP().toString();
+            LOG_I("WiFi Connected in %lu ms%s! IP Address: %s", lastConnectTime, directedAttempt ? " (directed)" : "",
+                  currentIP.c_str());
+            rememberLink();
+            changed = true;
         } else {
-            Serial.println("Initial WiFi connection failed.");
-            startAPMode();
+            // The DHCP client took over a link that ran on the saved lease
+            currentIP = WiFi.localIP().toString();
+            LOG_I("WiFi: DHCP lease bound, IP Address: %s", currentIP.c_str());
+            rememberLink();
+            changed = true;
+        }
+    }
+    if (disconnectedEvent) {
+        disconnectedEvent = false;
+        if (wifiState == WIFI_LINK_UP && WiFi.status() != WL_CONNECTED) {
+            LOG_W("WiFi link lost (reason %u).", disconnectReason);
+            wifiState = WIFI_LINK_DOWN;
+            connectStartedAt = millis();
+            startConnect(); // Reassociate at once, ideally on the cached link
+            changed = true;
+        } else if (wifiState == WIFI_LINK_CONNECTING && millis() - connectStartedAt > 250) {
+            // (Events right after WiFi.begin() stem from dropping the previous attempt)
+            LOG_W("WiFi attempt failed (reason %u).", disconnectReason);
+            onConnectFailed();
         }
-    } else {
-        if (!simPinOk) Serial.println("Cannot start in STA mode: SIM not ready.");
-        if (String(config.wifi_ssid).length() == 0) Serial.println("Cannot start in STA mode: No WiFi config.");
-        startAPMode();
     }
+    return changed;
 }
 
 /**
- * @brief Attempts to connect to the configured WiFi network.
- * @return true on success, false on failure.
+ * @brief Advances the station link state machine. Never blocks.
+ * @details Failed or timed-out attempts are retried with exponential back-off,
+ *          from WIFI_RECONNECT_BASE up to WIFI_RECONNECT_MAX.
  */
-bool connectWiFi() {
-    if (strlen(config.wifi_ssid) == 0) return false;
+static void handleWifiLink() {
+    if (processWifiEvents()) notifyStatus();
 
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(config.wifi_ssid, config.wifi_password);
-    Serial.print("Connecting to WiFi: ");
-    Serial.println(config.wifi_ssid);
-
-    unsigned long start = millis();
-    while (WiFi.status() != WL_CONNECTED && millis() - start < 20000) {
-        delay(500);
-        Serial.print(".");
+    unsigned long timeout = directedAttempt ? WIFI_DIRECTED_TIMEOUT : WIFI_CONNECT_TIMEOUT;
+    if (wifiState == WIFI_LINK_CONNECTING && millis() - connectStartedAt > timeout) {
+        LOG_W("WiFi attempt timed out.");
+        WiFi.disconnect();
+        onConnectFailed();
     }
+    if (wifiState == WIFI_LINK_DOWN && (long)(millis() - nextAttemptAt) >= 0) {
+        startConnect();
+    }
+    if (wifiState == WIFI_LINK_UP && leaseReused && !leaseUsable()) {
+        // Nobody renews a lease applied as a static config: hand it to the DHCP client
+        LOG_I("WiFi: Saved lease is due for renewal, starting DHCP.");
+        leaseReused = false;
+        WiFi.config(IPAddress(0u), IPAddress(0u), IPAddress(0u));
+    }
+}
 
-    if (WiFi.status() == WL_CONNECTED) {
-        Serial.println("\nWiFi Connected!");
-        currentIP = WiFi.localIP().toString();
-        Serial.print("IP Address: ");
-        Serial.println(currentIP);
-        return true;
-    } else {
-        Serial.println("\nWiFi Connection Failed.");
+/**
+ * @brief Starts associating with the configured WiFi network without waiting for it.
+ * @details Called at the start of the boot sequence so association runs while the
+ *          modem is being initialized. Reconnection is driven by the link state
+ *          machine instead of the SDK, so attempts can back off.
+ */
+void beginWifi() {
+    if (strlen(config.wifi_ssid) == 0) return;
+    gotIpHandler = WiFi.onStationModeGotIP([](const WiFiEventStationModeGotIP &) {
+        gotIpEvent = true;
+    });
+    disconnectedHandler = WiFi.onStationModeDisconnected([](const WiFiEventStationModeDisconnected &e) {
+        disconnectReason = e.reason;
+        disconnectedEvent = true;
+    });
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(false);
+    startConnect();
+}
+
+/**
+ * @brief Decides whether to run in Station or AP mode once the boot association resolves.
+ * @param timedOut true if the boot sequence gave up waiting for the association.
+ * @return true once the mode has been decided, false while still waiting.
+ */
+bool finishWifiInit(bool timedOut) {
+    if (modems[PRIMARY_MODEM].simPinOk && String(config.wifi_ssid).length() > 0) {
+        handleWifiLink();
+        if (wifiState == WIFI_LINK_UP) {
+            startSTAMode();
+            return true;
+        }
+        wl_status_t st = WiFi.status();
+        if (!timedOut && st != WL_CONNECT_FAILED && st != WL_NO_SSID_AVAIL && st != WL_WRONG_PASSWORD) return false;
+        LOG_W("Initial WiFi connection failed.");
         WiFi.disconnect(true);
-        WiFi.mode(WIFI_OFF);
-        return false;
+        wifiState = WIFI_LINK_DOWN;
+    } else {
+        if (!modems[PRIMARY_MODEM].simPinOk) LOG_W("Cannot start in STA mode: SIM not ready.");
+        if (String(config.wifi_ssid).length() == 0) LOG_W("Cannot start in STA mode: No WiFi config.");
     }
+    startAPMode();
+    return true;
+}
+
+/**
+ * @brief Returns the duration of the last successful association in ms (0 if none yet).
+ */
+unsigned long wifiLastConnectTime() {
+    return lastConnectTime;
+}
+
+/**
+ * @brief Returns true if the last successful association used the cached link.
+ */
+bool wifiLastConnectDirected() {
+    return lastConnectDirected;
 }
 
 /**
@@ -88,7 +308,7 @@ void startAPMode() {
         success = WiFi.softAP(AP_SSID, config.ap_password);
     }
     if (!success) {
-        if (strlen(config.ap_password) > 0) Serial.println("AP Password is too short. Starting an open AP.");
+        if (strlen(config.ap_password) > 0) LOG_W("AP Password is too short. Starting an open AP.");
         WiFi.softAP(AP_SSID);
     }
 
@@ -96,10 +316,7 @@ void startAPMode() {
     dnsServer.start(53, "*", ip);
     currentIP = WiFi.softAPIP().toString();
 
-    Serial.print("AP Mode Enabled. SSID: ");
-    Serial.print(AP_SSID);
-    Serial.print(" | IP: ");
-    Serial.println(currentIP);
+    LOG_I("AP Mode Enabled. SSID: %s | IP: %s", AP_SSID, currentIP.c_str());
 }
 
 /**
@@ -109,7 +326,8 @@ void startSTAMode() {
     apMode = false;
     WiFi.mode(WIFI_STA);
     dnsServer.stop();
-    Serial.println("Station (STA) Mode Enabled.");
+    configTime(0, 0, NTP_SERVER); // UTC; used to timestamp the signal history
+    LOG_I("Station (STA) Mode Enabled.");
 }
 
 /**
@@ -118,31 +336,13 @@ void startSTAMode() {
 void handleMainLoopTasks() {
     if (apMode) return;
 
-    // Check for WiFi connection loss
-    if (WiFi.status() != WL_CONNECTED) {
-        static unsigned long lastReconnectAttempt = 0;
-        if (millis() - lastReconnectAttempt > 30000) {
-            Serial.println("WiFi connection lost. Attempting to reconnect...");
-            connectWiFi();
-            lastReconnectAttempt = millis();
-        }
-    }
+    // Keep the station link up without blocking the modem pipeline
+    handleWifiLink();
 
     // Handle periodic status updates
     if (millis() - lastStatusUpdate > STATUS_UPDATE_INTERVAL) {
-        Serial.println("Performing periodic status update...");
-        updateStatus(); // from sim_handler
-        JsonDocument doc;
-        doc["wifi_status"] = (WiFi.status() == WL_CONNECTED) ? "Connected" : "Disconnected";
-        doc["ip_address"] = WiFi.localIP().toString();
-        doc["sim_status"] = simStatus;
-        doc["signal_quality"] = signalQuality;
-        doc["network_operator"] = networkOperator;
-        doc["sim_phone_number"] = simPhoneNumber;
-        doc["sim_pin_status"] = simRequiresPin ? (simPinOk ? "OK" : "Required") : "Not Required";
-        String s;
-        serializeJson(doc, s);
-        notifyClients("status", s); // from web_server
+        LOG_I("Performing periodic status update...");
+        requestStatusRefresh();  // from sim_handler; polled and broadcast once each modem is idle
         lastStatusUpdate = millis();
     }
 }
\ No newline at end of file
@@ -22,8 +22,10 @@
 #ifndef WIFI_MANAGER_H
 #define WIFI_MANAGER_H
 
-void initializeWifi();
-bool connectWiFi();
+void beginWifi();
+bool finishWifiInit(bool timedOut);
+unsigned long wifiLastConnectTime();
+bool wifiLastConnectDirected();
 void startAPMode();
 void startSTAMode();
 void handleMainLoopTasks();
@@ -0,0 +1,196 @@
+/**
+ * @file    ws_queue.cpp
+ * @author  Eng: Anas Alhawija
+ * @brief   Implementation of the per-client WebSocket send queues.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Every outgoing frame goes through its client's queue, which is
+ *              handed to the WebSocket library only while fewer than
+ *              WS_QUEUE_INFLIGHT messages of that client are still unsent, so a
+ *              slow link holds its backlog here, within a byte budget, instead of
+ *              as per-message copies inside the library. While a client's queue is over
+ *              WS_QUEUE_BUDGET, new frames are dropped (status frames are
+ *              coalesced, SMS results are always kept); after
+ *              WS_OVER_BUDGET_TIMEOUT the client is disconnected and resyncs when
+ *              it reconnects. Frames are shared between the queues, so a broadcast
+ *              is held in RAM only once per format.
+ */
+
+
+/**
+ * @file ws_queue.cpp
+ * @brief Implementation of the per-client WebSocket send queues.
+ */
+
+#include "config.h"
+#include "ws_queue.h"
+#include "logger.h"
+#include "web_server.h" // For wsClient
+
+/**
+ * @struct WsFrame
+ * @brief One queued frame.
+ */
+struct WsFrame {
+    std::shared_ptr<String> payload;
+    bool binary;
+    WsFrameClass frameClass;
+};
+
+/**
+ * @struct WsClientQueue
+ * @brief Outbound queue of one client (oldest frame first).
+ */
+struct WsClientQueue {
+    WsFrame frames[WS_QUEUE_FRAMES];
+    uint8_t count;
+    uint32_t bytes;                // Payload bytes waiting
+    unsigned long overBudgetSince; // 0 = within budget
+};
+
+static WsClientQueue queues[WS_MAX_CLIENTS];
+static uint32_t droppedFrames = 0;
+static uint32_t coalescedFrames = 0;
+static uint32_t blockedFlushes = 0; // Flushes stopped by a client with WS_QUEUE_INFLIGHT unsent messages
+static uint32_t kickedClients = 0;
+
+/**
+ * @brief (Static) Removes the frame at position i, keeping the order of the others.
+ */
+static void removeFrame(WsClientQueue &q, uint8_t i) {
+    q.bytes -= q.frames[i].payload->length();
+    for (; i + 1 < q.count; i++) q.frames[i] = std::move(q.frames[i + 1]);
+    q.count--;
+    q.frames[q.count].payload.reset();
+}
+
+/**
+ * @brief Empties a client's queue; call when the client connects or disconnects.
+ * @param num The client number.
+ */
+void wsQueueReset(uint8_t num) {
+    if (num >= WS_MAX_CLIENTS) return;
+    WsClientQueue &q = queues[num];
+    for (uint8_t i = 0; i < q.count; i++) q.frames[i].payload.reset();
+    q.count = 0;
+    q.bytes = 0;
+    q.overBudgetSince = 0;
+}
+
+/**
+ * @brief (Static) Hands queued frames to the client until it has enough in flight.
+ */
+static void flushQueue(uint8_t num) {
+    WsClientQueue &q = queues[num];
+    AsyncWebSocketClient *client = wsClient(num);
+    if (!client) {
+        wsQueueReset(num); // Gone; the disconnect event may still be on its way
+        return;
+    }
+    while (q.count > 0) {
+        if (client->queueLen() >= WS_QUEUE_INFLIGHT) {
+            blockedFlushes++;
+            break;
+        }
+        WsFrame &f = q.frames[0];
+        if (f.binary) client->binary(f.payload->c_str(), f.payload->length());
+        else client->text(f.payload->c_str(), f.payload->length());
+        removeFrame(q, 0);
+    }
+    if (q.bytes <= WS_QUEUE_BUDGET && q.count < WS_QUEUE_FRAMES) q.overBudgetSince = 0;
+}
+
+/**
+ * @brief (Static) Disconnects a client whose queue cannot be kept within limits.
+ */
+static void kickClient(uint8_t num) {
+    kickedClients++;
+    wsQueueReset(num);
+    AsyncWebSocketClient *client = wsClient(num);
+    if (client) client->close();
+}
+
+/**
+ * @brief Queues a frame for a client and sends what the client can take now.
+ * @param num The client number.
+ * @param frame The encoded frame (may be shared with other clients' queues).
+ * @param binary True for a binary frame, false for text.
+ * @param frameClass Drop policy of the frame.
+ */
+void wsQueueFrame(uint8_t num, const std::shared_ptr<String> &frame, bool binary, WsFrameClass frameClass) {
+    if (num >= WS_MAX_CLIENTS) return;
+    WsClientQueue &q = queues[num];
+    size_t len = frame->length();
+
+    if (frameClass == WS_FRAME_STATUS) {
+        for (uint8_t i = 0; i < q.count; i++) {
+            if (q.frames[i].frameClass != WS_FRAME_STATUS) continue;
+            q.bytes = q.bytes - q.frames[i].payload->length() + len;
+            q.frames[i].payload = frame; // Only the latest status matters
+            coalescedFrames++;
+            flushQueue(num);
+            return;
+        }
+    }
+
+    bool overBudget = q.bytes + len > WS_QUEUE_BUDGET || q.count >= WS_QUEUE_FRAMES;
+    if (overBudget) {
+        if (q.overBudgetSince == 0) q.overBudgetSince = millis() | 1;
+        if (frameClass != WS_FRAME_CRITICAL) {
+            droppedFrames++;
+            return;
+        }
+        if (q.count >= WS_QUEUE_FRAMES) {
+            // Make room by dropping the oldest frame that may be dropped
+            uint8_t i = 0;
+            while (i < q.count && q.frames[i].frameClass == WS_FRAME_CRITICAL) i++;
+            if (i == q.count) {
+                LOG_W("[%u]WS Queue full of SMS results, disconnecting", num);
+                kickClient(num);
+                return;
+            }
+            removeFrame(q, i);
+            droppedFrames++;
+        }
+    }
+
+    q.frames[q.count++] = {frame, binary, frameClass};
+    q.bytes += len;
+    flushQueue(num);
+}
+
+/**
+ * @brief Main-loop driver: refills the clients that caught up and disconnects the
+ *        ones that stayed over budget for WS_OVER_BUDGET_TIMEOUT.
+ */
+void handleWsQueues() {
+    for (uint8_t num = 0; num < WS_MAX_CLIENTS; num++) {
+        WsClientQueue &q = queues[num];
+        if (q.count > 0) flushQueue(num);
+        if (q.overBudgetSince != 0 && millis() - q.overBudgetSince >= WS_OVER_BUDGET_TIMEOUT) {
+            LOG_W("[%u]WS Client over budget for %lu ms, disconnecting", num, millis() - q.overBudgetSince);
+            kickClient(num);
+        }
+    }
+}
+
+/**
+ * @brief Adds the queue depths and drop counters to a JSON object.
+ */
+void wsQueueStatsToJson(JsonObject obj) {
+    JsonArray depth = obj["depth"].to<JsonArray>();
+    uint32_t bytes = 0;
+    for (uint8_t num = 0; num < WS_MAX_CLIENTS; num++) {
+        depth.add(queues[num].count);
+        bytes += queues[num].bytes;
+    }
+    obj["bytes"] = bytes;
+    obj["dropped"] = droppedFrames;
+    obj["coalesced"] = coalescedFrames;
+    obj["blocked"] = blockedFlushes;
+    obj["kicked"] = kickedClients;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file    ws_queue.h
+ * @author  Eng: Anas Alhawija
+ * @brief   Function prototypes for the per-client WebSocket send queues.
+ * @version 2.1
+ * @date    2025-07-04
+ *
+ * @project Smart GSM Gateway
+ * @license MIT License
+ *
+ * @description Declares the bounded outbound queue kept for each WebSocket client.
+ *              Frames that cannot be sent right away wait within a byte budget;
+ *              status updates are coalesced, SMS results are never dropped, and a
+ *              client that stays over its budget is disconnected.
+ */
+
+
+/**
+ * @file ws_queue.h
+ * @brief Function prototypes for the per-client WebSocket send queues.
+ */
+
+#ifndef WS_QUEUE_H
+#define WS_QUEUE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <memory>
+
+/**
+ * @enum WsFrameClass
+ * @brief Drop policy of a queued frame.
+ */
+enum WsFrameClass {
+    WS_FRAME_NORMAL,   ///< Dropped while the client is over budget
+    WS_FRAME_STATUS,   ///< Replaces a status frame that is still waiting
+    WS_FRAME_CRITICAL  ///< Never dropped (SMS send results)
+};
+
+void wsQueueFrame(uint8_t num, const std::shared_ptr<String> &frame, bool binary, WsFrameClass frameClass);
+void wsQueueReset(uint8_t num);
+void handleWsQueues();
+void wsQueueStatsToJson(JsonObject obj);
+
+#endif // WS_QUEUE_H